@@ -15,7 +15,8 @@ colors = [
     'orange',
     'purple',
     'pink',
-    'gray'
+    'gray',
+    'white'
 ]
 
 packet_types = [
@@ -27,7 +28,8 @@ packet_types = [
     "DELAYED_CLIENT_PACKET",
     "DROPPED_SERVER_PACKET",
     "DELAYED_SERVER_PACKET",
-    "CORRUPTED_PACKET"
+    "CORRUPTED_PACKET",
+    "KERNEL_DROPPED_PACKET"
 ]
 
 server_names = [
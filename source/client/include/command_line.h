@@ -13,6 +13,7 @@
 int                 parse_arguments(int argc, char *argv[], char **server_addr,
                                     char **client_addr, char **server_port_str,
                                     char **client_port_str, uint8_t *window_size,
+                                    bool *zerocopy, char **busy_poll_str, char **cpus_str,
                                     struct fsm_error *err);
 int                 handle_arguments(const char *binary_name, const char *server_addr,
                                      const char *client_addr, const char *server_port_str,
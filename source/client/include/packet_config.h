@@ -18,6 +18,7 @@ uint8_t                     first_empty_packet;
 uint8_t                     first_unacked_packet;
 uint8_t                     is_window_available;
 uint8_t                     window_size;
+uint32_t                    connection_id;
 
 typedef struct header
 {
@@ -26,6 +27,9 @@ typedef struct header
     uint8_t                     flags;
     uint8_t                     window_size;
     uint16_t                    checksum;
+    // 0 until the server hands it out in its first reply after the handshake, the SYN-ACK still carries 0;
+    // sits in what used to be padding
+    uint32_t                    connection_id;
     struct timeval              tv;
 } header;
 
@@ -36,13 +40,25 @@ typedef struct packet
     char            data[DATA_SIZE];
 } packet;
 
+// a slot sent with MSG_ZEROCOPY is pinned by the kernel until send id completes
+typedef struct zerocopy_slot
+{
+    uint32_t            id;
+    volatile uint8_t    is_pending;
+} zerocopy_slot;
+
 typedef struct sent_packet
 {
-    struct packet   pt;
-    uint32_t        expected_ack_number;
-    uint8_t         is_packet_full;
+    struct packet           pt;
+    uint32_t                expected_ack_number;
+    uint8_t                 is_packet_full;
+    // Karn's rule: a retransmitted packet's ack can't tell which send it answers
+    uint8_t                 retransmits;
+    struct zerocopy_slot    zerocopy;
 } sent_packet;
 
+struct packet_pool;
+
 int                 create_window(struct sent_packet **window, uint8_t window_size, struct fsm_error *err);
 int                 window_empty(struct sent_packet *window);
 int                 first_packet_ring_buffer(struct sent_packet *window);
@@ -50,9 +66,20 @@ int                 first_unacked_ring_buffer(struct sent_packet *window);
 int                 send_packet(int sockfd, struct sockaddr_storage *addr,
                                 struct sent_packet *window, struct packet *pt,
                                 FILE *fp, struct fsm_error *err);
+int                 enqueue_packet(int sockfd, struct sockaddr_storage *addr,
+                                   struct sent_packet *window, struct packet *pt,
+                                   FILE *fp, struct fsm_error *err);
+int                 enqueue_window_packet(int sockfd, struct sockaddr_storage *addr,
+                                          struct sent_packet *window, uint8_t index,
+                                          FILE *fp, struct fsm_error *err);
+int                 flush_packets(int sockfd, FILE *fp, struct fsm_error *err);
+int                 enable_zerocopy(int sockfd);
+int                 enable_timestamps(int sockfd);
+int                 packet_sent_at(uint32_t seq_number, struct timespec *sent);
 int                 add_packet_to_window(struct sent_packet *window, struct packet *pt);
-int                 receive_packet(int sockfd, struct sent_packet *window,
-                                    struct packet *pt, FILE *fp, struct fsm_error *err);
+int                 receive_packet(int sockfd, struct sent_packet *window, struct packet_pool *pool,
+                                   struct packet **pt, struct timespec *received_at, uint32_t *kernel_drops,
+                                   unsigned int spin_usec, FILE *fp, struct fsm_error *err);
 int                 remove_packet_from_window(struct sent_packet *window, struct packet *pt);
 int                 remove_single_packet(struct sent_packet *window, struct packet *pt);
 int                 remove_cumulative_packets(struct sent_packet *window, struct packet *pt);
@@ -0,0 +1,29 @@
+#ifndef CLIENT_RTT_H
+#define CLIENT_RTT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+// RFC 6298, with the 1 s initial timeout the fixed resend timer used before
+#define RTO_INITIAL_USEC 1000000L
+// RFC 6298 asks for a 1 s floor, on a LAN that hides every loss behind a second of silence
+#define RTO_MIN_USEC 200000L
+#define RTO_MAX_USEC 60000000L
+#define RTT_CLOCK_GRANULARITY_USEC 1000L
+
+typedef struct rtt_estimator
+{
+    pthread_mutex_t             lock;
+    long                        srtt_usec, rttvar_usec, rto_usec;
+    uint32_t                    samples;
+} rtt_estimator;
+
+int                 rtt_init(struct rtt_estimator *rtt);
+void                rtt_sample(struct rtt_estimator *rtt, long sample_usec);
+long                rtt_timeout(struct rtt_estimator *rtt, unsigned int backoff);
+void                rtt_destroy(struct rtt_estimator *rtt);
+long                timespec_diff_usec(const struct timespec *later, const struct timespec *earlier);
+void                sleep_usec(long usec);
+
+#endif //CLIENT_RTT_H
@@ -0,0 +1,62 @@
+#ifndef CLIENT_SEND_QUEUE_H
+#define CLIENT_SEND_QUEUE_H
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/udp.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <time.h>
+#include "packet_config.h"
+
+// also the kernel's UDP_MAX_SEGMENTS, so a full queue fits in one GSO send
+#define SEND_QUEUE_SIZE 64
+// below this the page pinning and completion round trip cost more than the copy
+#define ZEROCOPY_MIN_SIZE 16384
+// one record per packet put on the wire, enough to outlive a full window of 255 in flight
+#define TX_STAMP_RING 512
+
+// when a packet left, a kernel timestamp replaces the user-space time once its send key is reported
+typedef struct tx_stamp
+{
+    uint32_t                    key, seq_number;
+    struct timespec             sent;
+} tx_stamp;
+
+typedef struct send_queue
+{
+    struct packet               packets[SEND_QUEUE_SIZE];
+    struct sockaddr_storage     addrs[SEND_QUEUE_SIZE];
+    struct iovec                iovs[SEND_QUEUE_SIZE];
+    struct mmsghdr              msgs[SEND_QUEUE_SIZE];
+    struct zerocopy_slot        *slots[SEND_QUEUE_SIZE];
+    unsigned int                count;
+    int                         gso_enabled, same_destination;
+    int                         zerocopy_enabled, errqueue_fd;
+    uint32_t                    zerocopy_next_id;
+    // completions drained alongside timestamps wait here for the next zerocopy reap
+    int                         has_zerocopy_done;
+    uint32_t                    zerocopy_done_lo, zerocopy_done_hi;
+    int                         timestamps_enabled;
+    uint32_t                    stamp_next_key;
+    unsigned int                stamp_head, stamp_count;
+    struct tx_stamp             stamps[TX_STAMP_RING];
+    pthread_mutex_t             lock;
+} send_queue;
+
+int                 send_queue_init(struct send_queue *queue);
+int                 send_queue_push(struct send_queue *queue, int sockfd, struct sockaddr_storage *addr,
+                                    const struct packet *pt, FILE *fp, struct fsm_error *err);
+int                 send_queue_push_slot(struct send_queue *queue, int sockfd, struct sockaddr_storage *addr,
+                                         struct packet *pt, struct zerocopy_slot *slot, FILE *fp,
+                                         struct fsm_error *err);
+int                 send_queue_flush(struct send_queue *queue, int sockfd, FILE *fp, struct fsm_error *err);
+int                 send_queue_enable_zerocopy(struct send_queue *queue, int sockfd);
+int                 send_queue_enable_timestamps(struct send_queue *queue, int sockfd);
+int                 send_queue_sent_at(struct send_queue *queue, uint32_t seq_number, struct timespec *sent);
+int                 send_queue_reap_zerocopy(struct send_queue *queue, uint32_t *lo, uint32_t *hi);
+void                send_queue_wait_zerocopy(struct send_queue *queue, int timeout_ms);
+void                send_queue_destroy(struct send_queue *queue);
+
+#endif //CLIENT_SEND_QUEUE_H
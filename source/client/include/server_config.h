@@ -16,6 +16,9 @@
 #include "fsm.h"
 #include "protocol.h"
 
+// each queued datagram is charged its skb truesize rather than its payload, budget that per window slot
+#define SOCKET_BUFFER_OVERHEAD 768
+
 int             socket_create(int domain, int type, int protocol, struct fsm_error *err);
 int             start_listening(int sockfd, int backlog, struct fsm_error *err);
 int             socket_accept_connection(int sockfd, struct fsm_error *err);
@@ -28,5 +31,8 @@ socklen_t       size_of_address(struct sockaddr_storage *addr);
 int             get_sockaddr_info(struct sockaddr_storage *addr, char **ip_address, char **port, struct fsm_error *err);
 void            *safe_malloc(uint32_t size, struct fsm_error *err);
 int             send_stats_gui(int sockfd, int stat);
+int             socket_size_buffers(int sockfd, size_t window_packets, size_t packet_size, struct fsm_error *err);
+int             socket_count_drops(int sockfd);
+int             read_drop_count(struct msghdr *msg, uint32_t *dropped);
 
 #endif //CLIENT_SERVER_CONFIG_H
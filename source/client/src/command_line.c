@@ -3,10 +3,11 @@
 int parse_arguments(int argc, char *argv[], char **server_addr,
                                     char **client_addr, char **server_port_str,
                                     char **client_port_str, uint8_t *window_size,
+                                    bool *zerocopy, char **busy_poll_str, char **cpus_str,
                                     struct fsm_error *err)
 {
     int opt;
-    bool C_flag, c_flag, S_flag, s_flag, w_flag;
+    bool C_flag, c_flag, S_flag, s_flag, w_flag, b_flag, a_flag;
 
     opterr = 0;
     C_flag = 0;
@@ -14,8 +15,10 @@ int parse_arguments(int argc, char *argv[], char **server_addr,
     S_flag = 0;
     s_flag = 0;
     w_flag = 0;
+    b_flag = 0;
+    a_flag = 0;
 
-    while ((opt = getopt(argc, argv, "C:c:S:s:w:h")) != -1)
+    while ((opt = getopt(argc, argv, "C:c:S:s:w:zb:a:h")) != -1)
     {
         switch (opt)
         {
@@ -111,6 +114,45 @@ int parse_arguments(int argc, char *argv[], char **server_addr,
                 }
                 break;
             }
+            case 'z':
+            {
+                *zerocopy = true;
+                break;
+            }
+            case 'b':
+            {
+                if (b_flag)
+                {
+                    char message[40];
+
+                    snprintf(message, sizeof(message), "option '-b' can only be passed in once.");
+                    usage(argv[0]);
+                    SET_ERROR(err, message);
+
+                    return -1;
+                }
+
+                b_flag++;
+                *busy_poll_str = optarg;
+                break;
+            }
+            case 'a':
+            {
+                if (a_flag)
+                {
+                    char message[40];
+
+                    snprintf(message, sizeof(message), "option '-a' can only be passed in once.");
+                    usage(argv[0]);
+                    SET_ERROR(err, message);
+
+                    return -1;
+                }
+
+                a_flag++;
+                *cpus_str = optarg;
+                break;
+            }
             case 'h':
             {
                 usage(argv[0]);
@@ -140,7 +182,7 @@ int parse_arguments(int argc, char *argv[], char **server_addr,
 
 void usage(const char *program_name)
 {
-    fprintf(stderr, "Usage: %s [-C] <value> [-c] <value> [-S] <value> [-s] <value> [-w] <value> [-h]\n", program_name);
+    fprintf(stderr, "Usage: %s [-C] <value> [-c] <value> [-S] <value> [-s] <value> [-w] <value> [-z] [-b] <value> [-a] <value> [-h]\n", program_name);
     fputs("Options:\n", stderr);
     fputs("  -h                     Display this help message\n", stderr);
     fputs("  -C <value>             Option 'C' (required) with value, Sets the IP client_addr\n", stderr);
@@ -148,6 +190,9 @@ void usage(const char *program_name)
     fputs("  -S <value>             Option 'S' (required) with value, Sets the IP server_addr\n", stderr);
     fputs("  -s <value>             Option 's' (required) with value, Sets the server port\n", stderr);
     fputs("  -w <value>             Option 'w' (required) with value, Sets the window size\n", stderr);
+    fputs("  -z                     Option 'z' (optional), Sends large batches with MSG_ZEROCOPY\n", stderr);
+    fputs("  -b <value>             Option 'b' (optional) with value, Busy polls receives for this many microseconds\n", stderr);
+    fputs("  -a <value>             Option 'a' (optional) with value, Pins the receive thread to this comma separated CPU list\n", stderr);
 }
 
 int handle_arguments(const char *binary_name, const char *server_addr,
@@ -3,10 +3,11 @@
 #include "server_config.h"
 #include "command_line.h"
 #include "linked_list.h"
+#include "packet_pool.h"
+#include "busy_poll.h"
+#include "rtt.h"
 #include <pthread.h>
 
-#define TIMER_TIME 1
-
 enum main_application_states
 {
     STATE_PARSE_ARGUMENTS = FSM_USER_START,
@@ -52,7 +53,8 @@ enum gui_stats
     DELAYED_CLIENT_PACKET,
     DROPPED_SERVER_PACKET,
     DELAYED_SERVER_PACKET,
-    CORRUPTED_DATA
+    CORRUPTED_DATA,
+    KERNEL_DROPPED_PACKET
 };
 
 static int parse_arguments_handler(struct fsm_context *context, struct fsm_error *err);
@@ -84,6 +86,8 @@ static int remove_packet_from_window_handler(struct fsm_context *context, struct
 static int send_packet_handler(struct fsm_context *context, struct fsm_error *err);
 static int termination_handler(struct fsm_context *context, struct fsm_error *err);
 
+static void                     report_kernel_drops(struct fsm_context *ctx);
+static void                     sample_rtt(struct fsm_context *ctx);
 static void                     sigint_handler(int signum);
 static int                      setup_signal_handler(struct fsm_error *err);
 int                             create_file(const char *filepath, FILE **fp, struct fsm_error *err);
@@ -99,13 +103,21 @@ typedef struct arguments
 {
     int                     sockfd, num_of_threads, is_buffered;
     int                     client_gui_fd, connected_gui_fd, is_connected_gui;
+    bool                    zerocopy;
     uint8_t                 window_size;
+    uint32_t                kernel_drops, reported_kernel_drops;
     char                    *server_addr, *client_addr, *server_port_str, *client_port_str;
+    char                    *busy_poll_str, *cpus_str;
+    unsigned int            busy_poll_usec;
+    struct cpu_list         cpus;
     in_port_t               server_port, client_port;
     struct sockaddr_storage server_addr_struct, client_addr_struct, gui_addr_struct;
     struct sent_packet      *window;
     pthread_t               recv_thread, accept_gui_thread, *thread_pool;
-    struct packet           temp_packet, temp_message;
+    struct packet           *temp_packet, temp_message;
+    struct packet_pool      pool;
+    struct rtt_estimator    rtt;
+    struct timespec         received_at;
     char                    *temp_buffer;
     struct node             *head;
     FILE                    *sent_data, *received_data;
@@ -181,7 +193,8 @@ static int parse_arguments_handler(struct fsm_context *context, struct fsm_error
     if (parse_arguments(ctx -> argc, ctx -> argv, &ctx -> args -> server_addr,
                         &ctx -> args -> client_addr, &ctx -> args -> server_port_str,
                         &ctx -> args -> client_port_str, &ctx -> args -> window_size,
-                        err) != 0)
+                        &ctx -> args -> zerocopy, &ctx -> args -> busy_poll_str,
+                        &ctx -> args -> cpus_str, err) != 0)
 
     {
         return STATE_ERROR;
@@ -202,6 +215,14 @@ static int handle_arguments_handler(struct fsm_context *context, struct fsm_erro
         return STATE_ERROR;
     }
 
+    if ((ctx -> args -> busy_poll_str != NULL &&
+         parse_busy_poll(ctx -> args -> busy_poll_str, &ctx -> args -> busy_poll_usec, err) == -1) ||
+        (ctx -> args -> cpus_str != NULL && parse_cpu_list(ctx -> args -> cpus_str, &ctx -> args -> cpus, err) == -1))
+    {
+        usage(ctx -> argv[0]);
+        return STATE_ERROR;
+    }
+
     if (create_file("../client_received_data.csv", &ctx -> args -> received_data, err) == -1)
     {
         return STATE_ERROR;
@@ -311,11 +332,32 @@ static int create_window_handler(struct fsm_context *context, struct fsm_error *
     struct fsm_context *ctx;
     ctx = context;
     SET_TRACE(context, "in create window", "STATE_CREATE_WINDOW");
-    if (create_window(&ctx -> args -> window, ctx -> args -> window_size, err) != 0)
+    if (create_window(&ctx -> args -> window, ctx -> args -> window_size, err) != 0 ||
+        packet_pool_init(&ctx -> args -> pool, PACKET_POOL_SIZE, err) != 0 ||
+        rtt_init(&ctx -> args -> rtt) != 0 ||
+        socket_size_buffers(ctx -> args -> sockfd, ctx -> args -> window_size, sizeof(struct packet), err) != 0)
     {
         return STATE_ERROR;
     }
 
+    // best effort, without it the drop counter just stays at zero
+    socket_count_drops(ctx -> args -> sockfd);
+
+    // raising SO_BUSY_POLL needs CAP_NET_ADMIN, the user space spin still works without it
+    if (ctx -> args -> busy_poll_usec > 0 &&
+        socket_busy_poll(ctx -> args -> sockfd, ctx -> args -> busy_poll_usec, err) == -1)
+    {
+        fprintf(stderr, "SO_BUSY_POLL unavailable: %s\n", err -> err_msg);
+    }
+
+    if (ctx -> args -> zerocopy)
+    {
+        enable_zerocopy(ctx -> args -> sockfd);
+    }
+
+    // before the SYN goes out, the kernel numbers sends from here on
+    enable_timestamps(ctx -> args -> sockfd);
+
     return STATE_START_HANDSHAKE;
 }
 
@@ -371,22 +413,25 @@ static int wait_for_syn_ack_handler(struct fsm_context *context, struct fsm_erro
     while (!exit_flag)
     {
         result = receive_packet(ctx->args->sockfd, ctx -> args -> window,
-                                &ctx -> args -> temp_packet, ctx -> args -> received_data,
-                                err);
+                                &ctx -> args -> pool, &ctx -> args -> temp_packet, &ctx -> args -> received_at,
+                                &ctx -> args -> kernel_drops,
+                                ctx -> args -> busy_poll_usec, ctx -> args -> received_data, err);
         if (result == -1)
         {
             return STATE_ERROR;
         }
 
+        report_kernel_drops(ctx);
+
         if (ctx -> args -> is_connected_gui)
         {
             send_stats_gui(ctx -> args -> connected_gui_fd, RECEIVED_PACKET);
         }
 
-        printf("Server packet with ack number: %u flag: %u received\n", ctx -> args -> temp_packet.hd.ack_number,
-               ctx -> args -> temp_packet.hd.flags);
+        printf("Server packet with ack number: %u flag: %u received\n", ctx -> args -> temp_packet -> hd.ack_number,
+               ctx -> args -> temp_packet -> hd.flags);
 
-        if (ctx -> args -> temp_packet.hd.flags == SYNACK)
+        if (ctx -> args -> temp_packet -> hd.flags == SYNACK)
         {
             return STATE_SEND_HANDSHAKE_ACK;
         }
@@ -401,7 +446,7 @@ static int send_handshake_ack_handler(struct fsm_context *context, struct fsm_er
     ctx = context;
     SET_TRACE(context, "in connect socket", "STATE_SEND_HANDSHAKE_ACK");
     read_received_packet(ctx -> args -> sockfd, &ctx -> args -> server_addr_struct,
-                         ctx -> args -> window, &ctx -> args -> temp_packet,
+                         ctx -> args -> window, ctx -> args -> temp_packet,
                          ctx -> args -> sent_data, err);
 
     if (ctx -> args -> is_connected_gui)
@@ -560,6 +605,17 @@ static int cleanup_handler(struct fsm_context *context, struct fsm_error *err)
         pthread_join(ctx -> args -> thread_pool[i], NULL);
     }
 
+    if (ctx -> args -> kernel_drops > 0)
+    {
+        printf("%u datagrams dropped by the kernel on a full receive buffer\n", ctx -> args -> kernel_drops);
+    }
+
+    if (ctx -> args -> rtt.samples > 0)
+    {
+        printf("Smoothed RTT: %ld us, RTO: %ld us over %u samples\n", ctx -> args -> rtt.srtt_usec,
+               ctx -> args -> rtt.rto_usec, ctx -> args -> rtt.samples);
+    }
+
     if (ctx -> args -> sockfd)
     {
         if (socket_close(ctx -> args -> sockfd, err) == -1)
@@ -587,6 +643,9 @@ static int cleanup_handler(struct fsm_context *context, struct fsm_error *err)
 
     free(ctx -> args -> thread_pool);
     free(ctx -> args -> window);
+    rtt_destroy(&ctx -> args -> rtt);
+    packet_release(ctx -> args -> temp_packet);
+    packet_pool_destroy(&ctx -> args -> pool);
     fclose(ctx -> args -> sent_data);
     fclose(ctx -> args -> received_data);
 
@@ -611,19 +670,22 @@ static int wait_handler(struct fsm_context *context, struct fsm_error *err)
     while (!exit_flag)
     {
         result = receive_packet(ctx->args->sockfd, ctx -> args -> window,
-                                &ctx -> args -> temp_packet, ctx -> args -> received_data,
-                                err);
+                                &ctx -> args -> pool, &ctx -> args -> temp_packet, &ctx -> args -> received_at,
+                                &ctx -> args -> kernel_drops,
+                                ctx -> args -> busy_poll_usec, ctx -> args -> received_data, err);
         if (result == -1)
         {
             return STATE_ERROR;
         }
 
+        report_kernel_drops(ctx);
+
         if (ctx -> args -> is_connected_gui)
         {
             send_stats_gui(ctx -> args -> connected_gui_fd, RECEIVED_PACKET);
         }
 
-        printf("Server packet with ack number: %u flags: %u received\n", ctx -> args -> temp_packet.hd.ack_number, ctx -> args -> temp_packet.hd.flags);
+        printf("Server packet with ack number: %u flags: %u received\n", ctx -> args -> temp_packet -> hd.ack_number, ctx -> args -> temp_packet -> hd.flags);
 
         return STATE_CHECK_ACK_NUMBER;
     }
@@ -639,13 +701,19 @@ static int check_ack_number_handler(struct fsm_context *context, struct fsm_erro
     ctx = context;
     SET_TRACE(context, "", "STATE_CHECK_ACK_NUMBER");
 
-    result = read_flags(ctx -> args -> temp_packet.hd.flags);
+    // the server only picks an id once the handshake is through, its first reply after that carries it
+    if (ctx -> args -> temp_packet -> hd.connection_id != 0)
+    {
+        connection_id = ctx -> args -> temp_packet -> hd.connection_id;
+    }
+
+    result = read_flags(ctx -> args -> temp_packet -> hd.flags);
 
     if (result == RECV_ACK)
     {
         printf("received ack\n");
         if (check_ack_number(ctx -> args -> window[first_unacked_packet].expected_ack_number,
-                             ctx -> args -> temp_packet.hd.ack_number, ctx -> args -> window))
+                             ctx -> args -> temp_packet -> hd.ack_number, ctx -> args -> window))
         {
             return STATE_REMOVE_FROM_WINDOW;
         }
@@ -661,9 +729,8 @@ static int check_ack_number_handler(struct fsm_context *context, struct fsm_erro
     else if (result == SEND_HANDSHAKE_ACK)
     {
         printf("recieved syn ack again\n");
-        packet pt = ctx -> args -> temp_packet;
         create_handshake_ack_packet(ctx->args->sockfd, &ctx -> args -> server_addr_struct,
-                                    ctx -> args -> window,&ctx -> args -> temp_packet,
+                                    ctx -> args -> window, ctx -> args -> temp_packet,
                                     ctx -> args -> sent_data, err);
 
         if (ctx -> args -> is_connected_gui)
@@ -683,7 +750,8 @@ static int remove_packet_from_window_handler(struct fsm_context *context, struct
     ctx = context;
     SET_TRACE(context, "", "STATE_REMOVE_FROM_WINDOW");
 
-    remove_packet_from_window(ctx -> args -> window, &ctx -> args -> temp_packet);
+    sample_rtt(ctx);
+    remove_packet_from_window(ctx -> args -> window, ctx -> args -> temp_packet);
 
     if (ctx -> args -> is_connected_gui)
     {
@@ -700,7 +768,7 @@ static int send_packet_handler(struct fsm_context *context, struct fsm_error *er
     SET_TRACE(context, "", "STATE_SEND_PACKET");
 
     read_received_packet(ctx -> args -> sockfd, &ctx -> args -> server_addr_struct,
-                         ctx -> args -> window, &ctx -> args -> temp_packet,
+                         ctx -> args -> window, ctx -> args -> temp_packet,
                          ctx -> args -> sent_data, err);
 
     if (ctx -> args -> is_connected_gui)
@@ -735,6 +803,12 @@ void *init_recv_function(void *ptr)
             {STATE_ERROR,              FSM_EXIT, NULL},
     };
 
+    // only this thread sits in recvmsg, so it is the one worth keeping on a chosen core
+    if (pin_thread(&ctx -> args -> cpus, 0, &err) == -1)
+    {
+        fprintf(stderr, "Receive thread could not be pinned: %s\n", err.err_msg);
+    }
+
     fsm_run(ctx, &err, transitions);
 
     return NULL;
@@ -758,10 +832,11 @@ void *init_timer_function(void *ptr)
     while (ctx -> args -> window[index].pt.hd.seq_number == temp_seq_number
             && ctx -> args -> window[index].is_packet_full)
     {
-        sleep(TIMER_TIME);
+        sleep_usec(rtt_timeout(&ctx -> args -> rtt, (unsigned int) counter));
 //        printf("in timer the window: %d for index: %d\n", ctx -> args -> window[index].is_packet_full, index);
         if (ctx -> args -> window[index].is_packet_full && ctx -> args -> window[index].pt.hd.seq_number == temp_seq_number)
         {
+            ctx -> args -> window[index].retransmits++;
             send_packet(ctx -> args -> sockfd, &ctx -> args -> server_addr_struct,
                         ctx -> args -> window, &ctx -> args -> window[index].pt,
                         ctx -> args -> sent_data, &err);
@@ -782,34 +857,79 @@ void *init_timer_function(void *ptr)
 void *init_window_checker_function(void *ptr)
 {
     struct fsm_context *ctx = (struct fsm_context*) ptr;
-    struct fsm_error *err = NULL;
+    struct fsm_error err;
 
     while (ctx -> args -> head != NULL)
     {
         if (is_window_available)
         {
             struct packet pt;
+            uint8_t       slot;
 
+            // data is sent out of its window slot, which stays put until acked
+            slot = first_empty_packet;
             create_data_packet(&pt, ctx -> args -> window, ctx -> args -> head->data);
-            send_packet(ctx -> args -> sockfd, &ctx -> args -> server_addr_struct,
-                        ctx -> args -> window, &pt, ctx -> args -> sent_data,
-                        err);
+            enqueue_window_packet(ctx -> args -> sockfd, &ctx -> args -> server_addr_struct,
+                                  ctx -> args -> window, slot, ctx -> args -> sent_data, &err);
 
-            create_timer_thread_handler(ctx, err);
+            create_timer_thread_handler(ctx, &err);
             pop(&ctx -> args -> head);
 
             if (ctx -> args -> is_connected_gui)
             {
                 send_stats_gui(ctx -> args -> connected_gui_fd, SENT_PACKET);
             }
+
+            continue;
         }
+
+        // window closed: push out everything opened so far in one batch
+        flush_packets(ctx -> args -> sockfd, ctx -> args -> sent_data, &err);
     }
 
+    flush_packets(ctx -> args -> sockfd, ctx -> args -> sent_data, &err);
     ctx -> args -> is_buffered = 0;
 
     return NULL;
 }
 
+// both ends of the sample are kernel stamps when SO_TIMESTAMPING is on, so scheduling delay stays out of it
+static void sample_rtt(struct fsm_context *ctx)
+{
+    struct timespec sent;
+    int             index;
+
+    index = get_ack_number_index(ctx -> args -> temp_packet -> hd.ack_number, ctx -> args -> window);
+
+    if (index == -1 || !ctx -> args -> window[index].is_packet_full || ctx -> args -> window[index].retransmits > 0)
+    {
+        return;
+    }
+
+    if (packet_sent_at(ctx -> args -> window[index].pt.hd.seq_number, &sent) == -1)
+    {
+        return;
+    }
+
+    rtt_sample(&ctx -> args -> rtt, timespec_diff_usec(&ctx -> args -> received_at, &sent));
+}
+
+// overflow drops never reach the protocol, so they are reported next to its own drops to tell the two apart
+static void report_kernel_drops(struct fsm_context *ctx)
+{
+    if (!ctx -> args -> is_connected_gui)
+    {
+        ctx -> args -> reported_kernel_drops = ctx -> args -> kernel_drops;
+        return;
+    }
+
+    while (ctx -> args -> reported_kernel_drops != ctx -> args -> kernel_drops)
+    {
+        ctx -> args -> reported_kernel_drops++;
+        send_stats_gui(ctx -> args -> connected_gui_fd, KERNEL_DROPPED_PACKET);
+    }
+}
+
 void *init_gui_function(void *ptr)
 {
     struct fsm_context *ctx = (struct fsm_context*) ptr;
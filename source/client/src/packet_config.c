@@ -1,5 +1,16 @@
 #include <netinet/in.h>
 #include "packet_config.h"
+#include "send_queue.h"
+#include "packet_pool.h"
+#include "busy_poll.h"
+
+#define ZEROCOPY_WAIT_MS 10
+
+static struct send_queue tx_queue;
+
+static void reap_zerocopy(struct sent_packet *window);
+static void wait_for_zerocopy(struct sent_packet *window, struct sent_packet *slot);
+static void read_rx_timestamp(struct msghdr *msg, struct timespec *received_at);
 
 int create_window(struct sent_packet **window, uint8_t cmd_line_window_size, struct fsm_error *err)
 {
@@ -14,13 +25,21 @@ int create_window(struct sent_packet **window, uint8_t cmd_line_window_size, str
 
     for (int i = 0; i < window_size; i++)
     {
-        (*window)[i].is_packet_full = 0;
+        (*window)[i].is_packet_full         = 0;
+        (*window)[i].retransmits            = 0;
+        (*window)[i].zerocopy.is_pending    = FALSE;
     }
 
     first_empty_packet      = 0;
     first_unacked_packet    = 0;
     is_window_available     = TRUE;
 
+    if (send_queue_init(&tx_queue) == -1)
+    {
+        SET_ERROR(err, "Error in creating send queue.");
+        return -1;
+    }
+
     return 0;
 }
 
@@ -102,32 +121,95 @@ int first_unacked_ring_buffer(struct sent_packet *window)
 int send_packet(int sockfd, struct sockaddr_storage *addr, struct sent_packet *window,
                 struct packet *pt, FILE *fp, struct fsm_error *err)
 {
-    ssize_t result;
+    if (enqueue_packet(sockfd, addr, window, pt, fp, err) == -1)
+    {
+        return -1;
+    }
 
-    result = sendto(sockfd, pt, sizeof(*pt), 0, (struct sockaddr *) addr,
-                    size_of_address(addr));
+    return flush_packets(sockfd, fp, err);
+}
 
-//    printf("\n\nSENDING:\n");
-//    printf("seq number: %u\n", pt->hd.seq_number);
-//    printf("flags: %u\n", pt->hd.flags);
-//    printf("checksum: %u\n", pt->hd.checksum);
-//    printf("data: %s\n\n\n\n", pt->data);
+int enqueue_packet(int sockfd, struct sockaddr_storage *addr, struct sent_packet *window,
+                   struct packet *pt, FILE *fp, struct fsm_error *err)
+{
+    return send_queue_push(&tx_queue, sockfd, addr, pt, fp, err);
+}
+
+int enqueue_window_packet(int sockfd, struct sockaddr_storage *addr, struct sent_packet *window,
+                          uint8_t index, FILE *fp, struct fsm_error *err)
+{
+    return send_queue_push_slot(&tx_queue, sockfd, addr, &window[index].pt,
+                                &window[index].zerocopy, fp, err);
+}
 
-    if (result < 0)
+int flush_packets(int sockfd, FILE *fp, struct fsm_error *err)
+{
+    return send_queue_flush(&tx_queue, sockfd, fp, err);
+}
+
+int enable_zerocopy(int sockfd)
+{
+    if (send_queue_enable_zerocopy(&tx_queue, sockfd) == -1)
     {
-        SET_ERROR(err, strerror(errno));
+        printf("MSG_ZEROCOPY unavailable, sending with copies: %s\n", strerror(errno));
         return -1;
     }
 
-    write_stats_to_file(fp, pt);
+    return 0;
+}
+
+int enable_timestamps(int sockfd)
+{
+    if (send_queue_enable_timestamps(&tx_queue, sockfd) == -1)
+    {
+        printf("Kernel timestamps unavailable, timing sends and acks in user space: %s\n", strerror(errno));
+        return -1;
+    }
 
     return 0;
 }
 
+int packet_sent_at(uint32_t seq_number, struct timespec *sent)
+{
+    return send_queue_sent_at(&tx_queue, seq_number, sent);
+}
+
+static void reap_zerocopy(struct sent_packet *window)
+{
+    uint32_t lo, hi;
+
+    while (send_queue_reap_zerocopy(&tx_queue, &lo, &hi))
+    {
+        for (int i = 0; i < window_size; i++)
+        {
+            // unsigned distance also covers a range that wraps past UINT32_MAX
+            if (window[i].zerocopy.is_pending && window[i].zerocopy.id - lo <= hi - lo)
+            {
+                window[i].zerocopy.is_pending = FALSE;
+            }
+        }
+    }
+}
+
+static void wait_for_zerocopy(struct sent_packet *window, struct sent_packet *slot)
+{
+    while (slot -> zerocopy.is_pending)
+    {
+        reap_zerocopy(window);
+
+        if (slot -> zerocopy.is_pending)
+        {
+            send_queue_wait_zerocopy(&tx_queue, ZEROCOPY_WAIT_MS);
+        }
+    }
+}
+
 int add_packet_to_window(struct sent_packet *window, struct packet *pt)
 {
     gettimeofday(&pt->hd.tv, NULL);
+    wait_for_zerocopy(window, &window[first_empty_packet]);
     window[first_empty_packet].pt                           = *pt;
+    window[first_empty_packet].retransmits                  = 0;
 
     if (pt->hd.flags == ACK)
     {
@@ -160,36 +242,82 @@ int add_packet_to_window(struct sent_packet *window, struct packet *pt)
     return 0;
 }
 
-int receive_packet(int sockfd, struct sent_packet *window, struct packet *pt, FILE *fp,
-                    struct fsm_error *err)
+int receive_packet(int sockfd, struct sent_packet *window, struct packet_pool *pool, struct packet **pt,
+                   struct timespec *received_at, uint32_t *kernel_drops, unsigned int spin_usec,
+                   FILE *fp, struct fsm_error *err)
 {
     struct sockaddr_storage     client_addr;
-    socklen_t                   client_addr_len;
-    struct packet               temp_pt;
+    struct packet               *received;
+    struct msghdr               msg;
+    struct iovec                iov;
     ssize_t                     result;
+    union
+    {
+        char                    buf[CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(struct scm_timestamping))];
+        struct cmsghdr          align;
+    } control;
+
+    received            = packet_pool_get(pool);
+    if (received == NULL)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
 
-    client_addr_len     = sizeof(client_addr);
-    result              = recvfrom(sockfd, &temp_pt, sizeof(temp_pt), 0, (struct sockaddr *) &client_addr, &client_addr_len);
+    // the datagram lands straight in the pooled packet the handlers then read by pointer
+    iov.iov_base        = received;
+    iov.iov_len         = sizeof(*received);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name        = &client_addr;
+    msg.msg_namelen     = sizeof(client_addr);
+    msg.msg_iov         = &iov;
+    msg.msg_iovlen      = 1;
+    msg.msg_control     = control.buf;
+    msg.msg_controllen  = sizeof(control.buf);
+    result              = spin_recvmsg(sockfd, &msg, spin_usec);
 
     if (result == -1)
     {
         SET_ERROR(err, strerror(errno));
+        packet_release(received);
         return -1;
     }
 
-    *pt = temp_pt;
+    read_drop_count(&msg, kernel_drops);
+    read_rx_timestamp(&msg, received_at);
+    packet_release(*pt);
+    *pt = received;
 
 //    printf("\n\nRECEIVED:\n");
 //    printf("seq number: %u\n", pt->hd.seq_number);
 //    printf("ack number: %u\n", pt->hd.ack_number);
 //    printf("flags: %u\n", pt->hd.flags);
 
-    write_stats_to_file(fp, pt);
+    write_stats_to_file(fp, *pt);
     window_empty(window);
 
     return 0;
 }
 
+// the kernel's software stamp when the datagram arrived, not when this thread got to it
+static void read_rx_timestamp(struct msghdr *msg, struct timespec *received_at)
+{
+    struct cmsghdr          *cmsg;
+    struct scm_timestamping tss;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg -> cmsg_level == SOL_SOCKET && cmsg -> cmsg_type == SO_TIMESTAMPING)
+        {
+            memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+            *received_at = tss.ts[0];
+            return;
+        }
+    }
+
+    clock_gettime(CLOCK_REALTIME, received_at);
+}
+
 int remove_packet_from_window(struct sent_packet *window, struct packet *pt)
 {
     if (window[first_unacked_packet].expected_ack_number == pt->hd.ack_number)
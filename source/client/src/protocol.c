@@ -89,6 +89,7 @@ int send_syn_packet(int sockfd, struct sockaddr_storage *addr, struct sent_packe
     packet_to_send.hd.ack_number            = create_ack_number(0, 0);
     packet_to_send.hd.flags                 = SYN;
     packet_to_send.hd.window_size           = window_size;
+    packet_to_send.hd.connection_id         = connection_id;
     memset(packet_to_send.data, 0, sizeof(packet_to_send.data));
     calculate_checksum(&packet_to_send.hd.checksum, packet_to_send.data, strlen(packet_to_send.data));
 
@@ -107,6 +108,7 @@ int send_syn_ack_packet(int sockfd, struct sockaddr_storage *addr, struct sent_p
     packet_to_send.hd.ack_number        = create_ack_number(pt->hd.seq_number, 1);
     packet_to_send.hd.flags             = create_flags(pt->hd.flags);
     packet_to_send.hd.window_size       = window_size;
+    packet_to_send.hd.connection_id     = connection_id;
     memset(packet_to_send.data, 0, sizeof(packet_to_send.data));
     calculate_checksum(&packet_to_send.hd.checksum, packet_to_send.data, strlen(packet_to_send.data));
 
@@ -125,6 +127,7 @@ int finish_handshake_ack(int sockfd, struct sockaddr_storage *addr, struct sent_
     packet_to_send.hd.ack_number        = create_ack_number(pt->hd.seq_number, 1);
     packet_to_send.hd.flags             = create_flags(pt->hd.flags);
     packet_to_send.hd.window_size       = window_size;
+    packet_to_send.hd.connection_id     = connection_id;
     memset(packet_to_send.data, 0, sizeof(packet_to_send.data));
     calculate_checksum(&packet_to_send.hd.checksum, packet_to_send.data, strlen(packet_to_send.data));
 
@@ -143,6 +146,7 @@ int send_handshake_ack_packet(int sockfd, struct sockaddr_storage *addr, struct
     packet_to_send.hd.ack_number        = create_ack_number(pt->hd.seq_number, 1);
     packet_to_send.hd.flags             = create_flags(pt->hd.flags);
     packet_to_send.hd.window_size       = window_size;
+    packet_to_send.hd.connection_id     = connection_id;
     memset(packet_to_send.data, 0, sizeof(packet_to_send.data));
     calculate_checksum(&packet_to_send.hd.checksum, packet_to_send.data, strlen(packet_to_send.data));
 
@@ -161,6 +165,7 @@ int send_data_packet(int sockfd, struct sockaddr_storage *addr, struct sent_pack
     packet_to_send.hd.ack_number        = create_ack_number(previous_ack_number(window), 0);
     packet_to_send.hd.flags             = PSHACK;
     packet_to_send.hd.window_size       = window_size;
+    packet_to_send.hd.connection_id     = connection_id;
     strcpy(packet_to_send.data, data);
     calculate_checksum(&packet_to_send.hd.checksum, packet_to_send.data, strlen(packet_to_send.data));
 
@@ -179,6 +184,7 @@ int send_data_ack_packet(int sockfd, struct sockaddr_storage *addr, struct sent_
     packet_to_send.hd.ack_number        = create_ack_number(pt->hd.seq_number, strlen(pt->data));
     packet_to_send.hd.flags             = create_flags(pt->hd.flags);
     packet_to_send.hd.window_size       = window_size;
+    packet_to_send.hd.connection_id     = connection_id;
     memset(packet_to_send.data, 0, sizeof(packet_to_send.data));
     calculate_checksum(&packet_to_send.hd.checksum, packet_to_send.data, strlen(packet_to_send.data));
 
@@ -212,6 +218,7 @@ int initiate_termination(int sockfd, struct sockaddr_storage *addr, struct sent_
     packet_to_send.hd.ack_number            = create_ack_number(previous_ack_number(window), previous_data_size(window));
     packet_to_send.hd.flags                 = FINACK;
     packet_to_send.hd.window_size           = window_size;
+    packet_to_send.hd.connection_id         = connection_id;
 
     send_packet(sockfd, addr, window, &packet_to_send, fp, err);
     return 0;
@@ -251,6 +258,7 @@ int create_data_packet(struct packet *pt, struct sent_packet *window, char *data
     packet_to_send.hd.ack_number        = create_ack_number(previous_ack_number(window), 0);
     packet_to_send.hd.flags             = PSHACK;
     packet_to_send.hd.window_size       = window_size;
+    packet_to_send.hd.connection_id     = connection_id;
     strcpy(packet_to_send.data, data);
     calculate_checksum(&packet_to_send.hd.checksum, packet_to_send.data, strlen(packet_to_send.data));
 
@@ -269,6 +277,7 @@ int create_handshake_ack_packet(int sockfd, struct sockaddr_storage *addr, struc
     packet_to_send.hd.ack_number        = create_ack_number(pt->hd.seq_number, 1);
     packet_to_send.hd.flags             = create_flags(pt->hd.flags);
     packet_to_send.hd.window_size       = window_size;
+    packet_to_send.hd.connection_id     = connection_id;
     memset(packet_to_send.data, 0, sizeof(packet_to_send.data));
     calculate_checksum(&packet_to_send.hd.checksum, packet_to_send.data, strlen(packet_to_send.data));
 
@@ -0,0 +1,85 @@
+#include "rtt.h"
+#include <errno.h>
+
+int rtt_init(struct rtt_estimator *rtt)
+{
+    rtt -> srtt_usec    = 0;
+    rtt -> rttvar_usec  = 0;
+    rtt -> rto_usec     = RTO_INITIAL_USEC;
+    rtt -> samples      = 0;
+
+    return pthread_mutex_init(&rtt -> lock, NULL) == 0 ? 0 : -1;
+}
+
+void rtt_sample(struct rtt_estimator *rtt, long sample_usec)
+{
+    long deviation, variance;
+
+    // a clock step or a mismatched stamp, nothing the estimator should learn from
+    if (sample_usec < 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&rtt -> lock);
+
+    if (rtt -> samples == 0)
+    {
+        rtt -> srtt_usec    = sample_usec;
+        rtt -> rttvar_usec  = sample_usec / 2;
+    }
+    else
+    {
+        deviation           = rtt -> srtt_usec - sample_usec;
+        deviation           = deviation < 0 ? -deviation : deviation;
+        rtt -> rttvar_usec  = (3 * rtt -> rttvar_usec + deviation) / 4;
+        rtt -> srtt_usec    = (7 * rtt -> srtt_usec + sample_usec) / 8;
+    }
+
+    variance        = 4 * rtt -> rttvar_usec;
+    rtt -> rto_usec = rtt -> srtt_usec + (variance > RTT_CLOCK_GRANULARITY_USEC ? variance : RTT_CLOCK_GRANULARITY_USEC);
+    rtt -> rto_usec = rtt -> rto_usec < RTO_MIN_USEC ? RTO_MIN_USEC : rtt -> rto_usec;
+    rtt -> rto_usec = rtt -> rto_usec > RTO_MAX_USEC ? RTO_MAX_USEC : rtt -> rto_usec;
+    rtt -> samples++;
+
+    pthread_mutex_unlock(&rtt -> lock);
+}
+
+// the timeout doubles with every resend of the same packet, up to the ceiling
+long rtt_timeout(struct rtt_estimator *rtt, unsigned int backoff)
+{
+    long timeout;
+
+    pthread_mutex_lock(&rtt -> lock);
+    timeout = rtt -> rto_usec;
+    pthread_mutex_unlock(&rtt -> lock);
+
+    while (backoff-- > 0 && timeout < RTO_MAX_USEC)
+    {
+        timeout *= 2;
+    }
+
+    return timeout > RTO_MAX_USEC ? RTO_MAX_USEC : timeout;
+}
+
+void rtt_destroy(struct rtt_estimator *rtt)
+{
+    pthread_mutex_destroy(&rtt -> lock);
+}
+
+long timespec_diff_usec(const struct timespec *later, const struct timespec *earlier)
+{
+    return (later -> tv_sec - earlier -> tv_sec) * 1000000L + (later -> tv_nsec - earlier -> tv_nsec) / 1000L;
+}
+
+void sleep_usec(long usec)
+{
+    struct timespec remaining;
+
+    remaining.tv_sec    = usec / 1000000L;
+    remaining.tv_nsec   = (usec % 1000000L) * 1000L;
+
+    while (nanosleep(&remaining, &remaining) == -1 && errno == EINTR)
+    {
+    }
+}
@@ -0,0 +1,536 @@
+#include "send_queue.h"
+#include <poll.h>
+
+static int push_locked(struct send_queue *queue, int sockfd, struct sockaddr_storage *addr,
+                       struct packet *pt, struct zerocopy_slot *slot, FILE *fp, struct fsm_error *err);
+static int flush_locked(struct send_queue *queue, int sockfd, FILE *fp, struct fsm_error *err);
+static int can_zerocopy(const struct send_queue *queue);
+static void mark_zerocopy(struct send_queue *queue, int is_pending);
+static int send_segmented(struct send_queue *queue, int sockfd, int flags);
+static void stamp_headers(struct send_queue *queue, const struct timespec *now);
+static void record_sends(struct send_queue *queue, unsigned int first, unsigned int count,
+                         int is_one_send, const struct timespec *now);
+static void reap_errqueue_locked(struct send_queue *queue);
+static void apply_tx_stamp(struct send_queue *queue, uint32_t key, const struct timespec *ts);
+
+int send_queue_init(struct send_queue *queue)
+{
+    queue -> count              = 0;
+    queue -> same_destination   = TRUE;
+    queue -> zerocopy_enabled   = FALSE;
+    queue -> errqueue_fd        = -1;
+    queue -> zerocopy_next_id   = 0;
+    queue -> has_zerocopy_done  = FALSE;
+    queue -> timestamps_enabled = FALSE;
+    queue -> stamp_next_key     = 0;
+    queue -> stamp_head         = 0;
+    queue -> stamp_count        = 0;
+#ifdef UDP_SEGMENT
+    queue -> gso_enabled        = TRUE;
+#else
+    queue -> gso_enabled        = FALSE;
+#endif
+
+    return pthread_mutex_init(&queue -> lock, NULL) == 0 ? 0 : -1;
+}
+
+int send_queue_push(struct send_queue *queue, int sockfd, struct sockaddr_storage *addr,
+                    const struct packet *pt, FILE *fp, struct fsm_error *err)
+{
+    int result;
+
+    pthread_mutex_lock(&queue -> lock);
+    result = push_locked(queue, sockfd, addr, NULL, NULL, fp, err);
+    queue -> packets[queue -> count - 1] = *pt;
+    pthread_mutex_unlock(&queue -> lock);
+
+    return result;
+}
+
+// the packet is sent straight from the caller's buffer, which must stay untouched
+// until the flush and, for zerocopy sends, until the slot is no longer pending
+int send_queue_push_slot(struct send_queue *queue, int sockfd, struct sockaddr_storage *addr,
+                         struct packet *pt, struct zerocopy_slot *slot, FILE *fp,
+                         struct fsm_error *err)
+{
+    int result;
+
+    pthread_mutex_lock(&queue -> lock);
+    result = push_locked(queue, sockfd, addr, pt, slot, fp, err);
+    pthread_mutex_unlock(&queue -> lock);
+
+    return result;
+}
+
+int send_queue_flush(struct send_queue *queue, int sockfd, FILE *fp, struct fsm_error *err)
+{
+    int result;
+
+    pthread_mutex_lock(&queue -> lock);
+    result = flush_locked(queue, sockfd, fp, err);
+    pthread_mutex_unlock(&queue -> lock);
+
+    return result;
+}
+
+int send_queue_enable_zerocopy(struct send_queue *queue, int sockfd)
+{
+#ifdef SO_ZEROCOPY
+    int on = 1;
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == -1)
+    {
+        return -1;
+    }
+
+    queue -> errqueue_fd        = sockfd;
+    queue -> zerocopy_enabled   = TRUE;
+
+    return 0;
+#else
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+// must run before the first send, the kernel numbers every send after this from key 0
+int send_queue_enable_timestamps(struct send_queue *queue, int sockfd)
+{
+    int flags;
+
+    flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+            SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == -1)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&queue -> lock);
+    queue -> errqueue_fd        = sockfd;
+    queue -> timestamps_enabled = TRUE;
+    queue -> stamp_next_key     = 0;
+    pthread_mutex_unlock(&queue -> lock);
+
+    return 0;
+}
+
+// the latest send of seq_number, kernel stamped if its report is already in
+int send_queue_sent_at(struct send_queue *queue, uint32_t seq_number, struct timespec *sent)
+{
+    unsigned int    index;
+    int             result;
+
+    result = -1;
+
+    pthread_mutex_lock(&queue -> lock);
+    reap_errqueue_locked(queue);
+
+    for (unsigned int i = 1; i <= queue -> stamp_count; i++)
+    {
+        index = (queue -> stamp_head + TX_STAMP_RING - i) % TX_STAMP_RING;
+
+        if (queue -> stamps[index].seq_number == seq_number)
+        {
+            *sent   = queue -> stamps[index].sent;
+            result  = 0;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&queue -> lock);
+
+    return result;
+}
+
+// hands out the completed send ids [lo, hi], every one of them is done with its pages
+int send_queue_reap_zerocopy(struct send_queue *queue, uint32_t *lo, uint32_t *hi)
+{
+    int result;
+
+    if (queue -> errqueue_fd == -1)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&queue -> lock);
+    reap_errqueue_locked(queue);
+
+    result = queue -> has_zerocopy_done;
+    if (result)
+    {
+        *lo                         = queue -> zerocopy_done_lo;
+        *hi                         = queue -> zerocopy_done_hi;
+        queue -> has_zerocopy_done  = FALSE;
+    }
+
+    pthread_mutex_unlock(&queue -> lock);
+
+    return result;
+}
+
+void send_queue_wait_zerocopy(struct send_queue *queue, int timeout_ms)
+{
+    struct pollfd pfd;
+
+    // completions only raise POLLERR, which poll always reports
+    pfd.fd      = queue -> errqueue_fd;
+    pfd.events  = 0;
+    pfd.revents = 0;
+    poll(&pfd, 1, timeout_ms);
+}
+
+void send_queue_destroy(struct send_queue *queue)
+{
+    pthread_mutex_destroy(&queue -> lock);
+}
+
+static int push_locked(struct send_queue *queue, int sockfd, struct sockaddr_storage *addr,
+                       struct packet *pt, struct zerocopy_slot *slot, FILE *fp, struct fsm_error *err)
+{
+    unsigned int    index;
+    int             result;
+
+    result = 0;
+
+    if (queue -> count == SEND_QUEUE_SIZE)
+    {
+        result = flush_locked(queue, sockfd, fp, err);
+    }
+
+    index                                   = queue -> count++;
+
+    if (index == 0)
+    {
+        queue -> same_destination           = TRUE;
+    }
+    else if (size_of_address(addr) != queue -> msgs[0].msg_hdr.msg_namelen ||
+             memcmp(addr, &queue -> addrs[0], size_of_address(addr)) != 0)
+    {
+        queue -> same_destination           = FALSE;
+    }
+
+    queue -> addrs[index]                   = *addr;
+    queue -> slots[index]                   = slot;
+    queue -> iovs[index].iov_base           = pt != NULL ? pt : &queue -> packets[index];
+    queue -> iovs[index].iov_len            = sizeof(queue -> packets[index]);
+
+    memset(&queue -> msgs[index], 0, sizeof(queue -> msgs[index]));
+    queue -> msgs[index].msg_hdr.msg_name       = &queue -> addrs[index];
+    queue -> msgs[index].msg_hdr.msg_namelen    = size_of_address(addr);
+    queue -> msgs[index].msg_hdr.msg_iov        = &queue -> iovs[index];
+    queue -> msgs[index].msg_hdr.msg_iovlen     = 1;
+
+    return result;
+}
+
+static int flush_locked(struct send_queue *queue, int sockfd, FILE *fp, struct fsm_error *err)
+{
+    struct timespec now;
+    unsigned int    sent;
+    int             result, zerocopy;
+
+    if (queue -> count == 0)
+    {
+        return 0;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    stamp_headers(queue, &now);
+
+    if (queue -> gso_enabled && queue -> same_destination && queue -> count > 1)
+    {
+        zerocopy = can_zerocopy(queue);
+
+        // marked before the send so a completion reaped on another thread is never missed
+        if (zerocopy)
+        {
+            mark_zerocopy(queue, TRUE);
+        }
+
+        if (send_segmented(queue, sockfd, zerocopy ? MSG_ZEROCOPY : 0) == 0)
+        {
+            for (unsigned int i = 0; i < queue -> count; i++)
+            {
+                write_stats_to_file(fp, queue -> iovs[i].iov_base);
+            }
+
+            if (zerocopy)
+            {
+                queue -> zerocopy_next_id++;
+            }
+
+            record_sends(queue, 0, queue -> count, TRUE, &now);
+            queue -> count = 0;
+            return 0;
+        }
+
+        if (zerocopy)
+        {
+            mark_zerocopy(queue, FALSE);
+        }
+
+        if (errno != EIO && errno != EINVAL && errno != ENOPROTOOPT && errno != EOPNOTSUPP)
+        {
+            SET_ERROR(err, strerror(errno));
+            queue -> count = 0;
+            return -1;
+        }
+
+        // no GSO on this path, stay on plain sendmmsg from now on
+        queue -> gso_enabled = FALSE;
+    }
+
+    sent = 0;
+    while (sent < queue -> count)
+    {
+        result = sendmmsg(sockfd, &queue -> msgs[sent], queue -> count - sent, 0);
+
+        if (result == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            // the rest of the batch is dropped, retransmission timers recover it
+            SET_ERROR(err, strerror(errno));
+            queue -> count = 0;
+            return -1;
+        }
+
+        for (int i = 0; i < result; i++)
+        {
+            write_stats_to_file(fp, queue -> iovs[sent + i].iov_base);
+        }
+
+        record_sends(queue, sent, (unsigned int) result, FALSE, &now);
+        sent += result;
+    }
+
+    queue -> count = 0;
+
+    return 0;
+}
+
+// only batches sent entirely from caller slots qualify, the queue's own copies are reused right away
+static int can_zerocopy(const struct send_queue *queue)
+{
+    if (!queue -> zerocopy_enabled || queue -> count * sizeof(queue -> packets[0]) < ZEROCOPY_MIN_SIZE)
+    {
+        return FALSE;
+    }
+
+    for (unsigned int i = 0; i < queue -> count; i++)
+    {
+        if (queue -> slots[i] == NULL)
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static void mark_zerocopy(struct send_queue *queue, int is_pending)
+{
+    for (unsigned int i = 0; i < queue -> count; i++)
+    {
+        queue -> slots[i] -> id            = queue -> zerocopy_next_id;
+        queue -> slots[i] -> is_pending    = (uint8_t) is_pending;
+    }
+}
+
+static int send_segmented(struct send_queue *queue, int sockfd, int flags)
+{
+#ifdef UDP_SEGMENT
+    struct msghdr       msg;
+    struct cmsghdr      *cmsg;
+    ssize_t             result;
+    union
+    {
+        char            buf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr  align;
+    } control;
+
+    // the queued packets are equal-sized, the kernel slices the gathered payload back up
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_name            = &queue -> addrs[0];
+    msg.msg_namelen         = queue -> msgs[0].msg_hdr.msg_namelen;
+    msg.msg_iov             = queue -> iovs;
+    msg.msg_iovlen          = queue -> count;
+    msg.msg_control         = control.buf;
+    msg.msg_controllen      = sizeof(control.buf);
+
+    cmsg                    = CMSG_FIRSTHDR(&msg);
+    cmsg -> cmsg_level      = SOL_UDP;
+    cmsg -> cmsg_type       = UDP_SEGMENT;
+    cmsg -> cmsg_len        = CMSG_LEN(sizeof(uint16_t));
+    *(uint16_t *) CMSG_DATA(cmsg) = sizeof(queue -> packets[0]);
+
+    do
+    {
+        result = sendmsg(sockfd, &msg, flags);
+    } while (result == -1 && errno == EINTR);
+
+    return result == -1 ? -1 : 0;
+#else
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+// the header carries the send time so the receiver can take a one-way delay against its own stamp
+static void stamp_headers(struct send_queue *queue, const struct timespec *now)
+{
+    struct packet *pt;
+
+    for (unsigned int i = 0; i < queue -> count; i++)
+    {
+        pt                  = queue -> iovs[i].iov_base;
+        pt -> hd.tv.tv_sec  = now -> tv_sec;
+        pt -> hd.tv.tv_usec = now -> tv_nsec / 1000;
+    }
+}
+
+// a GSO send is one sendmsg and so one key, every datagram of sendmmsg gets its own
+static void record_sends(struct send_queue *queue, unsigned int first, unsigned int count,
+                         int is_one_send, const struct timespec *now)
+{
+    struct tx_stamp *stamp;
+    struct packet   *pt;
+
+    for (unsigned int i = first; i < first + count; i++)
+    {
+        pt                      = queue -> iovs[i].iov_base;
+        stamp                   = &queue -> stamps[queue -> stamp_head];
+        stamp -> key            = queue -> stamp_next_key;
+        stamp -> seq_number     = pt -> hd.seq_number;
+        stamp -> sent           = *now;
+
+        queue -> stamp_head     = (queue -> stamp_head + 1) % TX_STAMP_RING;
+        if (queue -> stamp_count < TX_STAMP_RING)
+        {
+            queue -> stamp_count++;
+        }
+
+        if (!is_one_send)
+        {
+            queue -> stamp_next_key++;
+        }
+    }
+
+    if (is_one_send)
+    {
+        queue -> stamp_next_key++;
+    }
+}
+
+// timestamps and zerocopy completions share the error queue, whichever reap runs takes both
+static void reap_errqueue_locked(struct send_queue *queue)
+{
+    struct msghdr               msg;
+    struct cmsghdr              *cmsg;
+    struct sock_extended_err    *serr;
+    struct scm_timestamping     tss;
+    int                         has_ts;
+    union
+    {
+        char                    buf[CMSG_SPACE(sizeof(struct scm_timestamping)) +
+                                    CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+        struct cmsghdr          align;
+    } control;
+
+    if (queue -> errqueue_fd == -1)
+    {
+        return;
+    }
+
+    for (;;)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control         = control.buf;
+        msg.msg_controllen      = sizeof(control.buf);
+
+        if (recvmsg(queue -> errqueue_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+        {
+            return;
+        }
+
+        has_ts = FALSE;
+        serr   = NULL;
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg -> cmsg_level == SOL_SOCKET && cmsg -> cmsg_type == SO_TIMESTAMPING)
+            {
+                memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+                has_ts = TRUE;
+            }
+            else if ((cmsg -> cmsg_level == SOL_IP && cmsg -> cmsg_type == IP_RECVERR) ||
+                     (cmsg -> cmsg_level == SOL_IPV6 && cmsg -> cmsg_type == IPV6_RECVERR))
+            {
+                serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+            }
+        }
+
+        if (serr == NULL)
+        {
+            continue;
+        }
+
+        if (serr -> ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+        {
+            // the kernel had to copy anyway (loopback, no SG on the device): stop paying for pinning
+            if (serr -> ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                queue -> zerocopy_enabled = FALSE;
+            }
+
+            // ids complete in order, so a range not yet handed out simply grows
+            if (!queue -> has_zerocopy_done)
+            {
+                queue -> zerocopy_done_lo   = serr -> ee_info;
+                queue -> has_zerocopy_done  = TRUE;
+            }
+            queue -> zerocopy_done_hi       = serr -> ee_data;
+        }
+        else if (serr -> ee_origin == SO_EE_ORIGIN_TIMESTAMPING && serr -> ee_info == SCM_TSTAMP_SND && has_ts)
+        {
+            apply_tx_stamp(queue, serr -> ee_data, &tss.ts[0]);
+        }
+    }
+}
+
+static void apply_tx_stamp(struct send_queue *queue, uint32_t key, const struct timespec *ts)
+{
+    struct tx_stamp *stamp;
+    unsigned int    index;
+
+    for (unsigned int i = 1; i <= queue -> stamp_count; i++)
+    {
+        index   = (queue -> stamp_head + TX_STAMP_RING - i) % TX_STAMP_RING;
+        stamp   = &queue -> stamps[index];
+
+        // unsigned distance, keys wrap past UINT32_MAX
+        if (key - stamp -> key > UINT32_MAX / 2)
+        {
+            continue;
+        }
+
+        if (stamp -> key != key)
+        {
+            return;
+        }
+
+        // a stamp from before the send was even issued means the key count drifted, keep the user-space time
+        if (ts -> tv_sec < stamp -> sent.tv_sec ||
+            (ts -> tv_sec == stamp -> sent.tv_sec && ts -> tv_nsec < stamp -> sent.tv_nsec))
+        {
+            continue;
+        }
+
+        stamp -> sent = *ts;
+    }
+}
@@ -210,3 +210,64 @@ int send_stats_gui(int sockfd, int stat)
 
     return 0;
 }
+
+int socket_size_buffers(int sockfd, size_t window_packets, size_t packet_size, struct fsm_error *err)
+{
+    static const int    options[]   = {SO_RCVBUF, SO_SNDBUF};
+    static const int    forced[]    = {SO_RCVBUFFORCE, SO_SNDBUFFORCE};
+    int                 wanted, current;
+    socklen_t           length;
+
+    wanted = (int) (window_packets * (packet_size + SOCKET_BUFFER_OVERHEAD));
+
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++)
+    {
+        length = sizeof(current);
+        if (getsockopt(sockfd, SOL_SOCKET, options[i], &current, &length) == -1)
+        {
+            SET_ERROR(err, strerror(errno));
+            return -1;
+        }
+
+        // the kernel reports back twice what was asked for, and a buffer is never shrunk
+        if (current / 2 >= wanted)
+        {
+            continue;
+        }
+
+        // the FORCE variants go past net.core.[rw]mem_max but need CAP_NET_ADMIN
+        if (setsockopt(sockfd, SOL_SOCKET, forced[i], &wanted, sizeof(wanted)) == -1 &&
+            setsockopt(sockfd, SOL_SOCKET, options[i], &wanted, sizeof(wanted)) == -1)
+        {
+            SET_ERROR(err, strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int socket_count_drops(int sockfd)
+{
+    int on;
+
+    on = 1;
+
+    return setsockopt(sockfd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+}
+
+int read_drop_count(struct msghdr *msg, uint32_t *dropped)
+{
+    struct cmsghdr *cmsg;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg -> cmsg_level == SOL_SOCKET && cmsg -> cmsg_type == SO_RXQ_OVFL)
+        {
+            memcpy(dropped, CMSG_DATA(cmsg), sizeof(*dropped));
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
@@ -2,15 +2,47 @@
 #define CLIENT_COMMAND_LINE_H
 
 #include <glob.h>
+#include <stdbool.h>
 #include <netinet/in.h>
 #include "fsm.h"
+#include "impairment.h"
+
+// long-only options, numbered past every short option character
+enum long_options
+{
+    OPT_CLIENT_LATENCY = 256,
+    OPT_CLIENT_JITTER,
+    OPT_CLIENT_DISTRIBUTION,
+    OPT_SERVER_LATENCY,
+    OPT_SERVER_JITTER,
+    OPT_SERVER_DISTRIBUTION,
+    OPT_DELAY_TABLE,
+    OPT_CLIENT_LOSS_MODEL,
+    OPT_SERVER_LOSS_MODEL,
+    OPT_CLIENT_RATE,
+    OPT_SERVER_RATE,
+    OPT_CLIENT_QUEUE,
+    OPT_SERVER_QUEUE,
+    OPT_CLIENT_REORDER,
+    OPT_SERVER_REORDER,
+    OPT_CLIENT_DUPLICATE,
+    OPT_SERVER_DUPLICATE,
+    OPT_SEED,
+    OPT_CLIENT_TRACE,
+    OPT_SERVER_TRACE,
+    OPT_FLOWS,
+    OPT_SHARED_BOTTLENECK
+};
 
 int                 parse_arguments(int argc, char *argv[], char **server_addr,
                                     char **client_addr, char **proxy_addr, char **server_port_str,
                                     char **client_port_str, uint8_t *client_delay_rate,
                                     uint8_t *client_drop_rate, uint8_t *server_delay_rate,
                                     uint8_t *server_drop_rate, uint8_t *corruption_rate,
-                                    struct fsm_error *err);
+                                    bool *use_uring, char **xdp_ifname, bool *xdp_zerocopy,
+                                    struct impairment *client_impairment, struct impairment *server_impairment,
+                                    char **delay_table_path, char **seed_str, uint64_t *max_flows,
+                                    bool *shared_bottleneck, struct fsm_error *err);
 int                 handle_arguments(const char *binary_name, const char *server_addr,
                                      const char *client_addr, const char *server_port_str,
                                      const char *proxy_addr,  const char *client_port_str,
@@ -19,5 +51,8 @@ int                 handle_arguments(const char *binary_name, const char *server
 void                usage(const char *program_name);
 int                 parse_in_port_t(const char *binary_name, const char *str, in_port_t *port, struct fsm_error *err);
 int                 convert_to_int(const char *binary_name, char *string, uint8_t *value, struct fsm_error *err);
+int                 convert_to_percent(const char *string, double *value, struct fsm_error *err);
+int                 convert_to_rate(const char *binary_name, const char *string, uint64_t *value, struct fsm_error *err);
+int                 convert_to_uint64(const char *binary_name, const char *string, uint64_t *value, struct fsm_error *err);
 
 #endif //CLIENT_COMMAND_LINE_H
@@ -0,0 +1,40 @@
+#ifndef PROXY_DELAY_QUEUE_H
+#define PROXY_DELAY_QUEUE_H
+
+#include <time.h>
+#include <sys/timerfd.h>
+#include "fsm.h"
+#include "proxy_config.h"
+
+#define DELAY_QUEUE_INITIAL_CAPACITY 256
+
+struct flow;
+
+// ordered by due time, and by arrival among packets due at the same instant
+typedef struct delayed_packet
+{
+    struct timespec             due;
+    uint64_t                    order;
+    struct packet               *pt;
+    int                         route;
+    // the flow the packet belongs to when the proxy carries several, NULL otherwise
+    struct flow                 *flow;
+} delayed_packet;
+
+// a binary min-heap in one array, so holding a packet costs no allocation once the array has grown
+typedef struct delay_queue
+{
+    struct delayed_packet       *heap;
+    size_t                      count, capacity;
+    uint64_t                    next_order;
+    int                         timer_fd;
+} delay_queue;
+
+int                 delay_queue_init(struct delay_queue *queue, struct fsm_error *err);
+int                 delay_queue_push(struct delay_queue *queue, struct packet *pt, int route, struct flow *flow,
+                                     uint64_t delay_usec, uint64_t *order, struct fsm_error *err);
+int                 delay_queue_reschedule(struct delay_queue *queue, uint64_t order, uint64_t delay_usec);
+int                 delay_queue_pop(struct delay_queue *queue, struct packet **pt, int *route, struct flow **flow);
+void                delay_queue_destroy(struct delay_queue *queue);
+
+#endif //PROXY_DELAY_QUEUE_H
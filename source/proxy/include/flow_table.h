@@ -0,0 +1,53 @@
+#ifndef PROXY_FLOW_TABLE_H
+#define PROXY_FLOW_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "fsm.h"
+#include "impairment.h"
+#include "receive_batch.h"
+
+// an upstream socket only carries one client's replies, a few slots keep --flows from pinning the pool
+#define FLOW_BATCH_SIZE 4
+
+// one client's connection through the proxy: its own upstream socket, so the server tells the clients apart
+// by the proxy port they arrive from, and its own impairment state on either direction
+typedef struct flow
+{
+    struct sockaddr_storage     client_addr;
+    int                         upstream_fd;
+    struct receive_batch        batch;
+    struct impairment           client_impairment, server_impairment;
+    uint64_t                    client_received, client_forwarded, server_received, server_forwarded;
+    bool                        ready;
+    struct flow                 *next_ready;
+} flow;
+
+// the flows live in one array allocated up front, so a struct flow * stays valid while packets wait in the
+// delay queue; lookups go through an open-addressed index on the client address and one on the socket
+typedef struct flow_table
+{
+    struct flow                 *flows;
+    size_t                      count, capacity;
+    int32_t                     *slots;
+    size_t                      slot_mask;
+    struct flow                 **by_fd;
+    size_t                      fd_limit;
+    struct flow                 *ready_head, *ready_tail;
+} flow_table;
+
+int                 flow_table_init(struct flow_table *table, size_t capacity, struct fsm_error *err);
+struct flow         *flow_table_find(const struct flow_table *table, const struct sockaddr_storage *addr);
+struct flow         *flow_table_add(struct flow_table *table, const struct sockaddr_storage *addr, int upstream_fd,
+                                    struct fsm_error *err);
+void                flow_table_remove_last(struct flow_table *table);
+struct flow         *flow_table_by_fd(const struct flow_table *table, int fd);
+void                flow_table_mark_ready(struct flow_table *table, struct flow *entry);
+struct flow         *flow_table_ready(const struct flow_table *table);
+void                flow_table_yield(struct flow_table *table, bool drained);
+void                flow_table_report(struct flow_table *table);
+void                flow_table_destroy(struct flow_table *table);
+
+#endif //PROXY_FLOW_TABLE_H
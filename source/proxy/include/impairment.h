@@ -0,0 +1,95 @@
+#ifndef PROXY_IMPAIRMENT_H
+#define PROXY_IMPAIRMENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "fsm.h"
+#include "prng.h"
+#include "trace.h"
+
+// tc's .dist files hold an inverse CDF with mean 0 and deviation 1 scaled by this, so they load as they are
+#define DELAY_TABLE_SCALE 8192
+#define DELAY_TABLE_MAX_SIZE 65536
+
+// loss bursts of this length and longer share the last bucket
+#define LOSS_BURST_BUCKETS 16
+#define BOTTLENECK_DEFAULT_QUEUE_BYTES 65536
+
+// a held packet goes out after this long even if fewer than gap packets came along to overtake it
+#define REORDER_MAX_HOLD_USEC 200000
+
+enum delay_distributions
+{
+    DISTRIBUTION_UNIFORM,
+    DISTRIBUTION_NORMAL,
+    DISTRIBUTION_PARETO,
+    DISTRIBUTION_TABLE
+};
+
+typedef struct delay_table
+{
+    int16_t                     *values;
+    size_t                      count;
+} delay_table;
+
+// Gilbert-Elliott: a good and a bad state, each with its own loss probability, so losses come in bursts
+typedef struct loss_model
+{
+    double                      to_bad, to_good, good_loss, bad_loss;
+    bool                        enabled, in_bad;
+    uint64_t                    seen, lost, bursts, run, longest;
+    uint64_t                    burst_lengths[LOSS_BURST_BUCKETS];
+} loss_model;
+
+// a link of fixed rate behind a byte-limited FIFO: each packet leaves once everything ahead of it has been
+// serialised, so the FIFO is implicit in the departure times and the backlog follows from the link's busy time
+typedef struct bottleneck
+{
+    uint64_t                    rate_bps, limit_bytes;
+    uint64_t                    free_at_usec;
+    uint64_t                    backlog_bytes, wait_usec;
+    uint64_t                    accepted, tail_drops, max_backlog_bytes, total_wait_usec, max_wait_usec;
+} bottleneck;
+
+// one packet at a time is held back until gap later packets of the same direction have gone ahead of it
+typedef struct reorder_model
+{
+    double                      reorder, duplicate;
+    uint32_t                    gap, to_pass;
+    uint64_t                    held_order;
+    uint64_t                    reordered, duplicated;
+} reorder_model;
+
+// what one direction of the path does to every packet crossing it, jitter is the spread around the latency
+typedef struct impairment
+{
+    uint64_t                    latency_usec, jitter_usec;
+    int                         distribution;
+    const struct delay_table    *table;
+    struct loss_model           loss;
+    struct bottleneck           link;
+    // set when the direction's flows all queue at one bottleneck instead of each at its own
+    struct bottleneck           *shared_link;
+    struct reorder_model        reorder;
+    struct prng                 rng;
+    struct trace                trace;
+    uint64_t                    trace_delay_usec;
+} impairment;
+
+int                 impairment_parse_distribution(const char *name, int *distribution, struct fsm_error *err);
+int                 delay_table_load(struct delay_table *table, const char *path, struct fsm_error *err);
+void                delay_table_destroy(struct delay_table *table);
+int                 impairment_parse_loss_model(const char *spec, struct loss_model *loss, struct fsm_error *err);
+bool                impairment_drops(struct impairment *imp);
+void                impairment_report(struct impairment *imp, const char *direction);
+int                 impairment_parse_reorder(const char *spec, struct reorder_model *reorder, struct fsm_error *err);
+bool                impairment_reorders(struct impairment *imp);
+bool                impairment_overtaken(struct impairment *imp);
+bool                impairment_duplicates(struct impairment *imp);
+int                 impairment_replay(struct impairment *imp);
+bool                impairment_holds(const struct impairment *imp);
+struct bottleneck   *impairment_link(struct impairment *imp);
+int                 impairment_schedule(struct impairment *imp, size_t length, uint64_t *delay_usec);
+
+#endif //PROXY_IMPAIRMENT_H
@@ -16,6 +16,9 @@ typedef struct header
     uint8_t                     flags;
     uint8_t                     window_size;
     uint16_t                    checksum;
+    // 0 until the server hands it out in its first reply after the handshake, the SYN-ACK still carries 0;
+    // sits in what used to be padding
+    uint32_t                    connection_id;
     struct timeval              tv;
 } header;
 
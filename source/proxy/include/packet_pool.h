@@ -0,0 +1,31 @@
+#ifndef PROXY_PACKET_POOL_H
+#define PROXY_PACKET_POOL_H
+
+#include <stddef.h>
+#include "fsm.h"
+#include "packet_config.h"
+
+#define PACKET_POOL_SIZE 128
+
+// the packet comes first so a struct packet * handed out by the pool converts back
+typedef struct pooled_packet
+{
+    struct packet               pt;
+    unsigned int                refcount;
+    struct packet_pool          *pool;
+    struct pooled_packet        *next;
+} pooled_packet;
+
+// a pool is owned by one thread, packets are only held and released on that thread
+typedef struct packet_pool
+{
+    struct pooled_packet        *free_list;
+} packet_pool;
+
+int                 packet_pool_init(struct packet_pool *pool, size_t count, struct fsm_error *err);
+struct packet       *packet_pool_get(struct packet_pool *pool);
+void                packet_hold(struct packet *pt);
+void                packet_release(struct packet *pt);
+void                packet_pool_destroy(struct packet_pool *pool);
+
+#endif //PROXY_PACKET_POOL_H
@@ -0,0 +1,19 @@
+#ifndef PROXY_PRNG_H
+#define PROXY_PRNG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// xoshiro256**, one state per user so no lock is shared and a seed replays the same stream
+typedef struct prng
+{
+    uint64_t                    s[4];
+} prng;
+
+void                prng_seed(struct prng *rng, uint64_t seed);
+void                prng_jump(struct prng *rng);
+uint64_t            prng_next(struct prng *rng);
+uint32_t            prng_below(struct prng *rng, uint32_t bound);
+double              prng_uniform(struct prng *rng);
+
+#endif //PROXY_PRNG_H
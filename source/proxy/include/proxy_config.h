@@ -7,6 +7,8 @@
 #include <errno.h>
 #include <string.h>
 #include "packet_config.h"
+#include "receive_batch.h"
+#include "impairment.h"
 #include "inttypes.h"
 
 enum bools
@@ -15,6 +17,26 @@ enum bools
     TRUE = 1
 };
 
+enum menu_levels
+{
+    MENU_MAIN,
+    MENU_CLIENT,
+    MENU_SERVER,
+    MENU_CLIENT_DROP,
+    MENU_CLIENT_DELAY,
+    MENU_SERVER_DROP,
+    MENU_SERVER_DELAY,
+    MENU_CORRUPTION
+};
+
+typedef struct keyboard_menu
+{
+    int                         level;
+    char                        line[128];
+    size_t                      length;
+    uint8_t                     *client_drop, *client_delay, *server_drop, *server_delay, *corruption_rate;
+} keyboard_menu;
+
 enum return_states
 {
     DROP,
@@ -24,18 +46,24 @@ enum return_states
 };
 
 
-int         random_number(size_t upperbound);
-int         calculate_lossiness(uint8_t drop_rate, uint8_t delay_rate, uint8_t corruption_rate);
-int         calculate_drop(uint8_t percentage);
-int         calculate_delay(uint8_t percentage);
-int         calculate_corruption(uint8_t percentage);
+int         random_number(struct prng *rng, size_t upperbound);
+int         calculate_lossiness(struct impairment *imp, uint8_t drop_rate, uint8_t delay_rate, uint8_t corruption_rate);
+int         calculate_drop(struct prng *rng, uint8_t percentage);
+int         calculate_delay(struct prng *rng, uint8_t percentage);
+int         calculate_corruption(struct prng *rng, uint8_t percentage);
 int         send_packet(int sockfd, packet *pt, struct sockaddr_storage *addr, FILE *fp);
-int         receive_packet(int sockfd, struct packet *pt, FILE *fp);
-void        delay_packet(uint8_t delay_time);
+int         receive_packet(int sockfd, struct receive_batch *batch, struct packet **pt,
+                           struct sockaddr_storage *addr, FILE *fp);
 void        read_keyboard(uint8_t *client_drop, uint8_t *client_delay, uint8_t *server_drop, uint8_t *server_delay, uint8_t *corruption_rate);
+void        keyboard_menu_init(struct keyboard_menu *menu, uint8_t *client_drop, uint8_t *client_delay,
+                               uint8_t *server_drop, uint8_t *server_delay, uint8_t *corruption_rate);
+int         keyboard_menu_read(struct keyboard_menu *menu, int fd);
+int         keyboard_menu_input(struct keyboard_menu *menu, const char *line);
 int         read_menu(int upperbound);
+int         parse_menu(const char *buf, int upperbound);
 socklen_t   size_of_address(struct sockaddr_storage *addr);
-int         corrupt_data(char **data, size_t length);
+int         corrupt_data(struct prng *rng, char **data, size_t length);
 int         write_stats_to_file(FILE *fp, const struct packet *pt);
+int         write_stats(FILE *fp, const struct packet *pt);
 
 #endif //PROXY_PROXY_CONFIG_H
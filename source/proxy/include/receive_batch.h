@@ -0,0 +1,35 @@
+#ifndef PROXY_RECEIVE_BATCH_H
+#define PROXY_RECEIVE_BATCH_H
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include "fsm.h"
+
+// the kernel's UDP_GRO_CNT_MAX, one coalesced read never holds more segments
+#define RECEIVE_BATCH_SIZE 64
+
+struct packet;
+struct packet_pool;
+
+typedef struct receive_batch
+{
+    struct packet_pool          *pool;
+    struct packet               *packets[RECEIVE_BATCH_SIZE];
+    struct iovec                iovs[RECEIVE_BATCH_SIZE];
+    // how many of the slots are filled from the pool, each one pins a packet while the socket is idle
+    size_t                      size;
+    size_t                      count, next;
+    struct sockaddr_storage     addr;
+    // the socket's running total of datagrams the kernel dropped on a full receive buffer
+    uint32_t                    kernel_drops;
+} receive_batch;
+
+int                 receive_batch_init(struct receive_batch *batch, struct packet_pool *pool, int sockfd,
+                                       size_t size, struct fsm_error *err);
+struct packet       *receive_batch_next(struct receive_batch *batch, int sockfd, struct sockaddr_storage *addr);
+int                 receive_batch_pending(const struct receive_batch *batch);
+void                receive_batch_destroy(struct receive_batch *batch);
+
+#endif //PROXY_RECEIVE_BATCH_H
@@ -0,0 +1,33 @@
+#ifndef PROXY_SEND_QUEUE_H
+#define PROXY_SEND_QUEUE_H
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/udp.h>
+#include "fsm.h"
+#include "proxy_config.h"
+
+// also the kernel's UDP_MAX_SEGMENTS, so a full queue fits in one GSO send
+#define SEND_QUEUE_SIZE 64
+
+typedef struct send_queue
+{
+    struct packet               packets[SEND_QUEUE_SIZE];
+    struct sockaddr_storage     addrs[SEND_QUEUE_SIZE];
+    struct iovec                iovs[SEND_QUEUE_SIZE];
+    struct mmsghdr              msgs[SEND_QUEUE_SIZE];
+    unsigned int                count;
+    // the socket everything queued goes out of, a push for another socket sends the queue first
+    int                         sockfd;
+    int                         gso_enabled, same_destination;
+    pthread_mutex_t             lock;
+} send_queue;
+
+int                 send_queue_init(struct send_queue *queue);
+int                 send_queue_push(struct send_queue *queue, int sockfd, struct sockaddr_storage *addr,
+                                    const struct packet *pt, FILE *fp, struct fsm_error *err);
+int                 send_queue_flush(struct send_queue *queue, FILE *fp, struct fsm_error *err);
+void                send_queue_destroy(struct send_queue *queue);
+
+#endif //PROXY_SEND_QUEUE_H
@@ -12,8 +12,12 @@
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/un.h>
+#include <sys/ioctl.h>
 #include "fsm.h"
 
+// each queued datagram is charged its skb truesize rather than its payload, budget that per window slot
+#define SOCKET_BUFFER_OVERHEAD 768
+
 int         socket_create(int domain, int type, int protocol, struct fsm_error *err);
 int         start_listening(int sockfd, int backlog, struct fsm_error *err);
 int         socket_accept_connection(int sockfd, struct fsm_error *err);
@@ -21,7 +25,9 @@ int         socket_close(int sockfd, struct fsm_error *err);
 int         convert_address(const char *address, struct sockaddr_storage *addr,
                             in_port_t port, struct fsm_error *err);
 int         socket_bind(int sockfd, struct sockaddr_storage *addr, in_port_t port, struct fsm_error *err);
+int         socket_pending(int sockfd);
 int         send_stats_gui(int sockfd, int stat);
+int         socket_size_buffers(int sockfd, size_t window_packets, size_t packet_size, struct fsm_error *err);
 
 
 #endif //CLIENT_SERVER_CONFIG_H
@@ -0,0 +1,62 @@
+#ifndef PROXY_TRACE_H
+#define PROXY_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "fsm.h"
+
+#define TRACE_LINE_LENGTH 512
+
+enum trace_actions
+{
+    TRACE_FORWARD,
+    TRACE_DROP,
+    TRACE_DELAY,
+    TRACE_CORRUPT
+};
+
+// which of the link parameters a timed line sets, the ones it leaves out keep their value
+enum trace_fields
+{
+    TRACE_LATENCY   = 1 << 0,
+    TRACE_JITTER    = 1 << 1,
+    TRACE_RATE      = 1 << 2,
+    TRACE_QUEUE     = 1 << 3,
+    TRACE_LOSS      = 1 << 4
+};
+
+// what happens to one packet, in the order packets of the direction arrive
+typedef struct trace_step
+{
+    uint64_t                    delay_usec;
+    int                         action;
+} trace_step;
+
+// the link as it is from at_usec on, counted from the first packet of the direction
+typedef struct trace_change
+{
+    uint64_t                    at_usec;
+    unsigned int                fields;
+    uint64_t                    latency_usec, jitter_usec, rate_bps, limit_bytes;
+    double                      loss;
+} trace_change;
+
+// the steps start over when they run out, the last change stays in force
+typedef struct trace
+{
+    struct trace_step           *steps;
+    size_t                      step_count, next_step;
+    struct trace_change         *changes;
+    size_t                      change_count, next_change;
+    uint64_t                    start_usec;
+    uint64_t                    replayed, loops;
+} trace;
+
+int                 trace_load(struct trace *replay, const char *path, struct fsm_error *err);
+void                trace_destroy(struct trace *replay);
+bool                trace_loaded(const struct trace *replay);
+const struct trace_step *trace_next_step(struct trace *replay);
+const struct trace_change *trace_due_change(struct trace *replay, uint64_t now_usec);
+
+#endif //PROXY_TRACE_H
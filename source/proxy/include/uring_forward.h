@@ -0,0 +1,68 @@
+#ifndef PROXY_URING_FORWARD_H
+#define PROXY_URING_FORWARD_H
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "fsm.h"
+#include "proxy_config.h"
+
+#define URING_QUEUE_DEPTH 256
+// must be a power of two, the kernel masks buffer ring indices with it
+#define URING_BUFFER_COUNT 256
+#define URING_BUFFER_SIZE (sizeof(struct io_uring_recvmsg_out) + sizeof(struct packet))
+#define URING_MAX_ROUTES 2
+#define URING_BUFFER_GROUP 0
+
+enum uring_events
+{
+    URING_RECEIVED,
+    URING_SENT
+};
+
+typedef struct uring_slot
+{
+    struct msghdr               msg;
+    struct iovec                iov;
+    struct __kernel_timespec    delay;
+} uring_slot;
+
+typedef struct uring_event
+{
+    int                         type;
+    int                         result;
+    unsigned int                route, buffer_id;
+    struct packet               *pt;
+} uring_event;
+
+typedef struct uring
+{
+    int                         ring_fd;
+    unsigned int                sq_entries, sqe_tail, sqe_submitted;
+    unsigned int                *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int                *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe         *sqes;
+    struct io_uring_cqe         *cqes;
+    void                        *sq_ring, *cq_ring;
+    size_t                      sq_ring_size, cq_ring_size, sqes_size;
+    struct io_uring_buf_ring    *buf_ring;
+    unsigned short              buf_tail;
+    unsigned int                free_buffers;
+    char                        *buffers;
+    struct msghdr               recv_msg;
+    unsigned int                routes;
+    int                         rearm[URING_MAX_ROUTES];
+    unsigned int                pending[URING_MAX_ROUTES][URING_BUFFER_COUNT];
+    unsigned int                pending_count[URING_MAX_ROUTES];
+    struct uring_slot           slots[URING_BUFFER_COUNT];
+} uring;
+
+int                 uring_init(struct uring *ring, const int *sockfds, unsigned int routes, struct fsm_error *err);
+int                 uring_forward(struct uring *ring, unsigned int buffer_id, unsigned int route,
+                                  struct sockaddr_storage *addr, uint64_t delay_usec);
+void                uring_release(struct uring *ring, unsigned int buffer_id);
+int                 uring_submit_and_wait(struct uring *ring, struct fsm_error *err);
+int                 uring_next_event(struct uring *ring, struct uring_event *event);
+void                uring_destroy(struct uring *ring);
+
+#endif //PROXY_URING_FORWARD_H
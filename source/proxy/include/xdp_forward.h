@@ -0,0 +1,71 @@
+#ifndef PROXY_XDP_FORWARD_H
+#define PROXY_XDP_FORWARD_H
+
+#include <linux/if_xdp.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "fsm.h"
+#include "proxy_config.h"
+
+// must be powers of two, the rings mask their indices with size - 1
+#define XDP_FRAME_SIZE 2048
+#define XDP_FRAME_COUNT 4096
+#define XDP_RING_SIZE 2048
+#define XDP_BATCH_SIZE 64
+#define XDP_MAX_ROUTES 2
+// the redirect program only hands over queue 0, frames on other queues fall back to the kernel
+#define XDP_QUEUE_ID 0
+#define XDP_HEADERS_SIZE (14 + 20 + 8)
+
+typedef struct xdp_ring
+{
+    uint32_t                    *producer, *consumer, *flags;
+    void                        *descs;
+    uint32_t                    mask, size;
+    void                        *map;
+    size_t                      map_size;
+} xdp_ring;
+
+typedef struct xdp_peer
+{
+    unsigned char               mac[6];
+    int                         has_mac;
+    uint32_t                    ip;
+    uint16_t                    port;
+} xdp_peer;
+
+typedef struct xdp_frame
+{
+    uint64_t                    addr;
+    uint32_t                    len;
+    unsigned int                route;
+    struct packet               *pt;
+} xdp_frame;
+
+typedef struct xdp
+{
+    int                         xsk_fd, map_fd, prog_fd, link_fd, ifindex;
+    int                         need_kick;
+    char                        *umem;
+    size_t                      umem_size;
+    struct xdp_ring             fill, completion, rx, tx;
+    unsigned char               local_mac[6];
+    uint32_t                    local_ip;
+    uint16_t                    ports[XDP_MAX_ROUTES];
+    struct xdp_peer             peers[XDP_MAX_ROUTES];
+} xdp;
+
+int                 xdp_init(struct xdp *sock, const char *ifname, int zerocopy,
+                             const struct sockaddr_storage *local, const uint16_t *ports,
+                             const struct sockaddr_storage *peers, struct fsm_error *err);
+int                 xdp_wait(struct xdp *sock, int extra_fd, int timeout_ms, struct fsm_error *err);
+int                 xdp_next_frame(struct xdp *sock, struct xdp_frame *frame);
+int                 xdp_forward(struct xdp *sock, const struct xdp_frame *frame, unsigned int route);
+void                xdp_release(struct xdp *sock, const struct xdp_frame *frame);
+void                xdp_flush(struct xdp *sock);
+void                xdp_destroy(struct xdp *sock);
+
+#endif //PROXY_XDP_FORWARD_H
@@ -8,15 +8,46 @@
 #include <inttypes.h>
 #include "command_line.h"
 
+static int          option_error(const char *option, struct fsm_error *err);
+
 int                 parse_arguments(int argc, char *argv[], char **server_addr,
                                     char **client_addr, char **proxy_addr, char **server_port_str,
                                     char **client_port_str, uint8_t *client_delay_rate,
                                     uint8_t *client_drop_rate, uint8_t *server_delay_rate,
                                     uint8_t *server_drop_rate, uint8_t *corruption_rate,
-                                    struct fsm_error *err)
+                                    bool *use_uring, char **xdp_ifname, bool *xdp_zerocopy,
+                                    struct impairment *client_impairment, struct impairment *server_impairment,
+                                    char **delay_table_path, char **seed_str, uint64_t *max_flows,
+                                    bool *shared_bottleneck, struct fsm_error *err)
 {
+    static const struct option long_options[] = {
+            {"client-latency",      required_argument, NULL, OPT_CLIENT_LATENCY},
+            {"client-jitter",       required_argument, NULL, OPT_CLIENT_JITTER},
+            {"client-distribution", required_argument, NULL, OPT_CLIENT_DISTRIBUTION},
+            {"server-latency",      required_argument, NULL, OPT_SERVER_LATENCY},
+            {"server-jitter",       required_argument, NULL, OPT_SERVER_JITTER},
+            {"server-distribution", required_argument, NULL, OPT_SERVER_DISTRIBUTION},
+            {"delay-table",         required_argument, NULL, OPT_DELAY_TABLE},
+            {"client-loss-model",   required_argument, NULL, OPT_CLIENT_LOSS_MODEL},
+            {"server-loss-model",   required_argument, NULL, OPT_SERVER_LOSS_MODEL},
+            {"client-rate",         required_argument, NULL, OPT_CLIENT_RATE},
+            {"server-rate",         required_argument, NULL, OPT_SERVER_RATE},
+            {"client-queue",        required_argument, NULL, OPT_CLIENT_QUEUE},
+            {"server-queue",        required_argument, NULL, OPT_SERVER_QUEUE},
+            {"client-reorder",      required_argument, NULL, OPT_CLIENT_REORDER},
+            {"server-reorder",      required_argument, NULL, OPT_SERVER_REORDER},
+            {"client-duplicate",    required_argument, NULL, OPT_CLIENT_DUPLICATE},
+            {"server-duplicate",    required_argument, NULL, OPT_SERVER_DUPLICATE},
+            {"seed",                required_argument, NULL, OPT_SEED},
+            {"client-trace",        required_argument, NULL, OPT_CLIENT_TRACE},
+            {"server-trace",        required_argument, NULL, OPT_SERVER_TRACE},
+            {"flows",               required_argument, NULL, OPT_FLOWS},
+            {"shared-bottleneck",   no_argument,       NULL, OPT_SHARED_BOTTLENECK},
+            {"help",                no_argument,       NULL, 'h'},
+            {NULL,                  0,                 NULL, 0}
+    };
     int opt;
-    bool C_flag, S_flag, s_flag, c_flag, D_flag, d_flag, P_flag, L_flag, l_flag, E_flag;
+    bool C_flag, S_flag, s_flag, c_flag, D_flag, d_flag, P_flag, L_flag, l_flag, E_flag, X_flag;
 
     opterr = 0;
     C_flag = 0;
@@ -28,9 +59,10 @@ int                 parse_arguments(int argc, char *argv[], char **server_addr,
     P_flag = 0;
     L_flag = 0;
     l_flag = 0;
+    X_flag = 0;
     E_flag = 0;
 
-    while ((opt = getopt(argc, argv, "C:c:S:s:P:D:d:L:l:E:h")) != -1)
+    while ((opt = getopt_long(argc, argv, "C:c:S:s:P:D:d:L:l:E:UX:Zh", long_options, NULL)) != -1)
     {
         switch (opt)
         {
@@ -246,6 +278,214 @@ int                 parse_arguments(int argc, char *argv[], char **server_addr,
                 }
                 break;
             }
+            case 'U':
+            {
+                *use_uring = true;
+                break;
+            }
+            case 'X':
+            {
+                if (X_flag)
+                {
+                    char message[40];
+
+                    snprintf(message, sizeof(message), "option '-X' can only be passed in once.");
+                    usage(argv[0]);
+                    SET_ERROR(err, message);
+
+                    return -1;
+                }
+
+                X_flag++;
+                *xdp_ifname = optarg;
+                break;
+            }
+            case 'Z':
+            {
+                *xdp_zerocopy = true;
+                break;
+            }
+            case OPT_CLIENT_LATENCY:
+            {
+                if (convert_to_uint64(argv[0], optarg, &client_impairment -> latency_usec, err) == -1)
+                {
+                    return option_error("--client-latency", err);
+                }
+                break;
+            }
+            case OPT_CLIENT_JITTER:
+            {
+                if (convert_to_uint64(argv[0], optarg, &client_impairment -> jitter_usec, err) == -1)
+                {
+                    return option_error("--client-jitter", err);
+                }
+                break;
+            }
+            case OPT_CLIENT_DISTRIBUTION:
+            {
+                if (impairment_parse_distribution(optarg, &client_impairment -> distribution, err) == -1)
+                {
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            }
+            case OPT_SERVER_LATENCY:
+            {
+                if (convert_to_uint64(argv[0], optarg, &server_impairment -> latency_usec, err) == -1)
+                {
+                    return option_error("--server-latency", err);
+                }
+                break;
+            }
+            case OPT_SERVER_JITTER:
+            {
+                if (convert_to_uint64(argv[0], optarg, &server_impairment -> jitter_usec, err) == -1)
+                {
+                    return option_error("--server-jitter", err);
+                }
+                break;
+            }
+            case OPT_SERVER_DISTRIBUTION:
+            {
+                if (impairment_parse_distribution(optarg, &server_impairment -> distribution, err) == -1)
+                {
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            }
+            case OPT_DELAY_TABLE:
+            {
+                *delay_table_path = optarg;
+                break;
+            }
+            case OPT_CLIENT_LOSS_MODEL:
+            {
+                if (impairment_parse_loss_model(optarg, &client_impairment -> loss, err) == -1)
+                {
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            }
+            case OPT_SERVER_LOSS_MODEL:
+            {
+                if (impairment_parse_loss_model(optarg, &server_impairment -> loss, err) == -1)
+                {
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            }
+            case OPT_CLIENT_RATE:
+            {
+                if (convert_to_rate(argv[0], optarg, &client_impairment -> link.rate_bps, err) == -1)
+                {
+                    return option_error("--client-rate", err);
+                }
+                break;
+            }
+            case OPT_CLIENT_QUEUE:
+            {
+                if (convert_to_uint64(argv[0], optarg, &client_impairment -> link.limit_bytes, err) == -1)
+                {
+                    return option_error("--client-queue", err);
+                }
+                break;
+            }
+            case OPT_SERVER_RATE:
+            {
+                if (convert_to_rate(argv[0], optarg, &server_impairment -> link.rate_bps, err) == -1)
+                {
+                    return option_error("--server-rate", err);
+                }
+                break;
+            }
+            case OPT_SERVER_QUEUE:
+            {
+                if (convert_to_uint64(argv[0], optarg, &server_impairment -> link.limit_bytes, err) == -1)
+                {
+                    return option_error("--server-queue", err);
+                }
+                break;
+            }
+            case OPT_CLIENT_REORDER:
+            {
+                if (impairment_parse_reorder(optarg, &client_impairment -> reorder, err) == -1)
+                {
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            }
+            case OPT_CLIENT_DUPLICATE:
+            {
+                if (convert_to_percent(optarg, &client_impairment -> reorder.duplicate, err) == -1)
+                {
+                    return option_error("--client-duplicate", err);
+                }
+                break;
+            }
+            case OPT_SERVER_REORDER:
+            {
+                if (impairment_parse_reorder(optarg, &server_impairment -> reorder, err) == -1)
+                {
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            }
+            case OPT_SERVER_DUPLICATE:
+            {
+                if (convert_to_percent(optarg, &server_impairment -> reorder.duplicate, err) == -1)
+                {
+                    return option_error("--server-duplicate", err);
+                }
+                break;
+            }
+            case OPT_SEED:
+            {
+                *seed_str = optarg;
+                break;
+            }
+            case OPT_CLIENT_TRACE:
+            {
+                trace_destroy(&client_impairment -> trace);
+                if (trace_load(&client_impairment -> trace, optarg, err) == -1)
+                {
+                    return -1;
+                }
+                break;
+            }
+            case OPT_SERVER_TRACE:
+            {
+                trace_destroy(&server_impairment -> trace);
+                if (trace_load(&server_impairment -> trace, optarg, err) == -1)
+                {
+                    return -1;
+                }
+                break;
+            }
+            case OPT_FLOWS:
+            {
+                if (convert_to_uint64(argv[0], optarg, max_flows, err) == -1)
+                {
+                    return -1;
+                }
+
+                if (*max_flows > INT32_MAX)
+                {
+                    SET_ERROR(err, "Too many flows.");
+                    return -1;
+                }
+                break;
+            }
+            case OPT_SHARED_BOTTLENECK:
+            {
+                *shared_bottleneck = true;
+                break;
+            }
             case 'h':
             {
                 usage(argv[0]);
@@ -255,9 +495,17 @@ int                 parse_arguments(int argc, char *argv[], char **server_addr,
             }
             case '?':
             {
-                char message[24];
+                char message[64];
 
-                snprintf(message, sizeof(message), "Unknown option '-%c'.", optopt);
+                // a long option getopt did not recognise leaves optopt at 0
+                if (optopt == 0)
+                {
+                    snprintf(message, sizeof(message), "Unknown option '%s'.", argv[optind - 1]);
+                }
+                else
+                {
+                    snprintf(message, sizeof(message), "Unknown option '-%c'.", optopt);
+                }
                 usage(argv[0]);
                 SET_ERROR(err, message);
 
@@ -276,7 +524,13 @@ int                 parse_arguments(int argc, char *argv[], char **server_addr,
 void usage(const char *program_name)
 {
     fprintf(stderr, "Usage: %s [-C] <value> [-c] <value> [-S] <value> [-s] <value> [-P] <value>\n", program_name);
-    fprintf(stderr, "[-w] <value> [-D] <value>[-d] <value> [-L] <value> [-l] <value> [-E] <value> [-h]\n");
+    fprintf(stderr, "[-w] <value> [-D] <value>[-d] <value> [-L] <value> [-l] <value> [-E] <value> [-U] [-X] <value> [-Z] [-h]\n");
+    fprintf(stderr, "[--client-latency <us>] [--client-jitter <us>] [--client-distribution <name>]\n");
+    fprintf(stderr, "[--server-latency <us>] [--server-jitter <us>] [--server-distribution <name>] [--delay-table <path>]\n");
+    fprintf(stderr, "[--client-loss-model <p,r[,1-h[,1-k]]>] [--server-loss-model <p,r[,1-h[,1-k]]>]\n");
+    fprintf(stderr, "[--client-rate <bps>] [--client-queue <bytes>] [--server-rate <bps>] [--server-queue <bytes>]\n");
+    fprintf(stderr, "[--client-reorder <percent[,gap]>] [--client-duplicate <percent>]\n");
+    fprintf(stderr, "[--server-reorder <percent[,gap]>] [--server-duplicate <percent>] [--seed <value>]\n");
     fputs("Options:\n", stderr);
     fputs("  -h                     Display this help message\n", stderr);
     fputs("  -C <value>             Option 'C' (required) with value, Sets the IP client_addr\n", stderr);
@@ -289,6 +543,43 @@ void usage(const char *program_name)
     fputs("  -L <value>             Option 'L' (required) with value, Sets the client delay rate\n", stderr);
     fputs("  -l <value>             Option 'l' (required) with value, Sets the server delay rate\n", stderr);
     fputs("  -E <value>             Option 'E' (required) with value, Sets the corruption rate\n", stderr);
+    fputs("  -U                     Option 'U' (optional), Forwards packets through io_uring\n", stderr);
+    fputs("  -X <value>             Option 'X' (optional) with value, Forwards raw frames over AF_XDP on this interface\n", stderr);
+    fputs("  -Z                     Option 'Z' (optional), Binds the AF_XDP socket in zero-copy (native XDP) mode\n", stderr);
+    fputs("  --client-latency <us>  Base one-way latency added to every client packet, in microseconds\n", stderr);
+    fputs("  --client-jitter <us>   Spread of the client latency, in microseconds\n", stderr);
+    fputs("  --client-distribution <name>\n", stderr);
+    fputs("                         Shape of the client jitter: uniform (default), normal, pareto or table\n", stderr);
+    fputs("  --server-latency <us>  Base one-way latency added to every server packet, in microseconds\n", stderr);
+    fputs("  --server-jitter <us>   Spread of the server latency, in microseconds\n", stderr);
+    fputs("  --server-distribution <name>\n", stderr);
+    fputs("                         Shape of the server jitter: uniform (default), normal, pareto or table\n", stderr);
+    fputs("  --delay-table <path>   Distribution table for 'table', in the format of tc's .dist files\n", stderr);
+    fputs("  --client-loss-model <p,r[,1-h[,1-k]]>\n", stderr);
+    fputs("                         Gilbert-Elliott burst loss on client packets, in percent: p good to bad,\n", stderr);
+    fputs("                         r bad to good, 1-h loss in bad (default 100), 1-k loss in good (default 0)\n", stderr);
+    fputs("  --server-loss-model <p,r[,1-h[,1-k]]>\n", stderr);
+    fputs("                         Gilbert-Elliott burst loss on server packets, same fields\n", stderr);
+    fputs("  --client-rate <bps>    Bottleneck rate for client packets in bits per second, k, m and g suffixes allowed\n", stderr);
+    fputs("  --client-queue <bytes> Bottleneck queue ahead of the client rate, tail drop past it (default 65536)\n", stderr);
+    fputs("  --server-rate <bps>    Bottleneck rate for server packets in bits per second, k, m and g suffixes allowed\n", stderr);
+    fputs("  --server-queue <bytes> Bottleneck queue ahead of the server rate, tail drop past it (default 65536)\n", stderr);
+    fputs("  --client-reorder <percent[,gap]>\n", stderr);
+    fputs("                         Holds back this share of client packets until gap later ones (default 1) passed\n", stderr);
+    fputs("  --server-reorder <percent[,gap]>\n", stderr);
+    fputs("                         Holds back this share of server packets until gap later ones (default 1) passed\n", stderr);
+    fputs("  --client-duplicate <percent>\n", stderr);
+    fputs("                         Sends this share of client packets twice\n", stderr);
+    fputs("  --server-duplicate <percent>\n", stderr);
+    fputs("                         Sends this share of server packets twice\n", stderr);
+    fputs("  --seed <value>         Seeds every impairment decision, the same seed and packets replay the same run\n", stderr);
+    fputs("  --client-trace <path>  Replays a recorded trace on client packets: one line per packet, forward, drop,\n", stderr);
+    fputs("                         corrupt or delay <us>, and timed link changes, @<us> latency= jitter= rate= queue= loss=\n", stderr);
+    fputs("  --server-trace <path>  Replays a recorded trace on server packets, same format\n", stderr);
+    fputs("  --flows <max>          Gives every client address its own upstream port and impairment state, up to max\n", stderr);
+    fputs("                         clients; without it every packet goes to the -C/-c client. Each flow holds up to\n", stderr);
+    fputs("                         4 pooled packets (about 2 KiB) for its socket, on top of the shared receive batches\n", stderr);
+    fputs("  --shared-bottleneck    With --flows, all flows of a direction queue at one bottleneck instead of one each\n", stderr);
 }
 
 int handle_arguments(const char *binary_name, const char *server_addr,
@@ -467,3 +758,117 @@ int convert_to_int(const char *binary_name, char *string, uint8_t *value, struct
     return 0;
 }
 
+
+int convert_to_uint64(const char *binary_name, const char *string, uint64_t *value, struct fsm_error *err)
+{
+    char            *endptr;
+    uintmax_t       parsed_value;
+
+    errno = 0;
+    parsed_value = strtoumax(string, &endptr, 10);
+
+    if (errno != 0)
+    {
+        SET_ERROR(err, strerror(errno));
+
+        return -1;
+    }
+
+    if(*endptr != '\0' || *string == '\0')
+    {
+        SET_ERROR(err, "Invalid characters in input.");
+        usage(binary_name);
+
+        return -1;
+    }
+
+    *value = (uint64_t) parsed_value;
+
+    return 0;
+}
+
+int convert_to_rate(const char *binary_name, const char *string, uint64_t *value, struct fsm_error *err)
+{
+    char            *endptr;
+    uintmax_t       parsed_value, scale;
+
+    errno = 0;
+    parsed_value = strtoumax(string, &endptr, 10);
+
+    if (errno != 0)
+    {
+        SET_ERROR(err, strerror(errno));
+
+        return -1;
+    }
+
+    switch (*endptr)
+    {
+        case 'k':
+        {
+            scale = 1000;
+            endptr++;
+            break;
+        }
+        case 'm':
+        {
+            scale = 1000000;
+            endptr++;
+            break;
+        }
+        case 'g':
+        {
+            scale = 1000000000;
+            endptr++;
+            break;
+        }
+        default:
+        {
+            scale = 1;
+        }
+    }
+
+    if(*endptr != '\0' || endptr == string || parsed_value > UINT64_MAX / scale)
+    {
+        SET_ERROR(err, "Invalid rate.");
+        usage(binary_name);
+
+        return -1;
+    }
+
+    *value = (uint64_t) (parsed_value * scale);
+
+    return 0;
+}
+
+int convert_to_percent(const char *string, double *value, struct fsm_error *err)
+{
+    char    *endptr;
+    double  parsed_value;
+
+    errno = 0;
+    parsed_value = strtod(string, &endptr);
+
+    if (errno != 0 || endptr == string || *endptr != '\0' || parsed_value < 0 || parsed_value > 100)
+    {
+        SET_ERROR(err, "Expected a percentage between 0 and 100.");
+
+        return -1;
+    }
+
+    *value = parsed_value / 100;
+
+    return 0;
+}
+
+// SET_ERROR only keeps the pointer, so the option is named in a buffer that outlives the call; the line and
+// function stay those of the conversion that failed
+static int option_error(const char *option, struct fsm_error *err)
+{
+    static char message[128];
+
+    snprintf(message, sizeof(message), "%s: %s", option, err -> err_msg);
+    err -> err_msg = message;
+
+    return -1;
+}
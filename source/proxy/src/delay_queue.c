@@ -0,0 +1,264 @@
+#include "delay_queue.h"
+#include "packet_pool.h"
+
+static int  arm_timer(struct delay_queue *queue);
+static void set_due(struct timespec *due, uint64_t delay_usec);
+static int  is_due(const struct timespec *due, const struct timespec *now);
+static int  comes_before(const struct delayed_packet *a, const struct delayed_packet *b);
+static void sift_up(struct delay_queue *queue, size_t index);
+static void sift_down(struct delay_queue *queue, size_t index);
+
+int delay_queue_init(struct delay_queue *queue, struct fsm_error *err)
+{
+    queue -> count      = 0;
+    queue -> capacity   = DELAY_QUEUE_INITIAL_CAPACITY;
+    queue -> next_order = 0;
+    queue -> timer_fd   = -1;
+    queue -> heap       = malloc(queue -> capacity * sizeof(*queue -> heap));
+
+    if (queue -> heap == NULL)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+    queue -> timer_fd   = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (queue -> timer_fd == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        free(queue -> heap);
+        queue -> heap = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+int delay_queue_push(struct delay_queue *queue, struct packet *pt, int route, struct flow *flow,
+                     uint64_t delay_usec, uint64_t *order, struct fsm_error *err)
+{
+    struct delayed_packet   *entry;
+    uint64_t                entry_order;
+
+    if (queue -> count == queue -> capacity)
+    {
+        struct delayed_packet *grown;
+
+        grown = realloc(queue -> heap, 2 * queue -> capacity * sizeof(*queue -> heap));
+        if (grown == NULL)
+        {
+            SET_ERROR(err, strerror(errno));
+            return -1;
+        }
+
+        queue -> heap       = grown;
+        queue -> capacity  *= 2;
+    }
+
+    // the queue keeps its own reference instead of a copy of the packet
+    packet_hold(pt);
+    entry           = &queue -> heap[queue -> count];
+    entry -> pt     = pt;
+    entry -> route  = route;
+    entry -> flow   = flow;
+    entry -> order  = queue -> next_order++;
+    entry_order     = entry -> order;
+    set_due(&entry -> due, delay_usec);
+
+    if (order != NULL)
+    {
+        *order = entry_order;
+    }
+
+    sift_up(queue, queue -> count++);
+
+    // the timer only has to move when the new packet is now the first one due
+    if (queue -> heap[0].order != entry_order)
+    {
+        return 0;
+    }
+
+    if (arm_timer(queue) == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int delay_queue_pop(struct delay_queue *queue, struct packet **pt, int *route, struct flow **flow)
+{
+    struct timespec         now;
+    uint64_t                expirations;
+
+    // drain the expiration count so the timer fd stops polling readable
+    while (read(queue -> timer_fd, &expirations, sizeof(expirations)) > 0)
+    {
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (queue -> count == 0 || !is_due(&queue -> heap[0].due, &now))
+    {
+        arm_timer(queue);
+        return FALSE;
+    }
+
+    *pt             = queue -> heap[0].pt;
+    *route          = queue -> heap[0].route;
+    *flow           = queue -> heap[0].flow;
+    queue -> heap[0] = queue -> heap[--queue -> count];
+    sift_down(queue, 0);
+
+    return TRUE;
+}
+
+// moves a packet still waiting to a new due time, behind everything pushed before; 0 if it has already left
+int delay_queue_reschedule(struct delay_queue *queue, uint64_t order, uint64_t delay_usec)
+{
+    size_t index;
+
+    for (index = 0; index < queue -> count && queue -> heap[index].order != order; index++)
+    {
+    }
+
+    if (index == queue -> count)
+    {
+        return 0;
+    }
+
+    set_due(&queue -> heap[index].due, delay_usec);
+    queue -> heap[index].order = queue -> next_order++;
+
+    if (index > 0 && comes_before(&queue -> heap[index], &queue -> heap[(index - 1) / 2]))
+    {
+        sift_up(queue, index);
+    }
+    else
+    {
+        sift_down(queue, index);
+    }
+
+    return arm_timer(queue);
+}
+
+void delay_queue_destroy(struct delay_queue *queue)
+{
+    for (size_t i = 0; i < queue -> count; i++)
+    {
+        packet_release(queue -> heap[i].pt);
+    }
+
+    free(queue -> heap);
+    queue -> heap   = NULL;
+    queue -> count  = 0;
+
+    if (queue -> timer_fd >= 0)
+    {
+        close(queue -> timer_fd);
+        queue -> timer_fd = -1;
+    }
+}
+
+static int arm_timer(struct delay_queue *queue)
+{
+    struct itimerspec spec;
+
+    memset(&spec, 0, sizeof(spec));
+
+    // an all-zero value disarms the timer once the queue is empty
+    if (queue -> count > 0)
+    {
+        spec.it_value = queue -> heap[0].due;
+    }
+
+    return timerfd_settime(queue -> timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+static void set_due(struct timespec *due, uint64_t delay_usec)
+{
+    clock_gettime(CLOCK_MONOTONIC, due);
+    due -> tv_sec   += (time_t) (delay_usec / 1000000);
+    due -> tv_nsec  += (long) (delay_usec % 1000000) * 1000;
+
+    if (due -> tv_nsec >= 1000000000L)
+    {
+        due -> tv_sec++;
+        due -> tv_nsec -= 1000000000L;
+    }
+}
+
+static int is_due(const struct timespec *due, const struct timespec *now)
+{
+    return now -> tv_sec > due -> tv_sec ||
+           (now -> tv_sec == due -> tv_sec && now -> tv_nsec >= due -> tv_nsec);
+}
+
+static int comes_before(const struct delayed_packet *a, const struct delayed_packet *b)
+{
+    if (a -> due.tv_sec != b -> due.tv_sec)
+    {
+        return a -> due.tv_sec < b -> due.tv_sec;
+    }
+
+    if (a -> due.tv_nsec != b -> due.tv_nsec)
+    {
+        return a -> due.tv_nsec < b -> due.tv_nsec;
+    }
+
+    return a -> order < b -> order;
+}
+
+static void sift_up(struct delay_queue *queue, size_t index)
+{
+    struct delayed_packet entry;
+
+    entry = queue -> heap[index];
+
+    while (index > 0 && comes_before(&entry, &queue -> heap[(index - 1) / 2]))
+    {
+        queue -> heap[index]    = queue -> heap[(index - 1) / 2];
+        index                   = (index - 1) / 2;
+    }
+
+    queue -> heap[index] = entry;
+}
+
+static void sift_down(struct delay_queue *queue, size_t index)
+{
+    struct delayed_packet   entry;
+    size_t                  child;
+
+    if (queue -> count == 0)
+    {
+        return;
+    }
+
+    entry = queue -> heap[index];
+
+    for (;;)
+    {
+        child = 2 * index + 1;
+        if (child >= queue -> count)
+        {
+            break;
+        }
+
+        if (child + 1 < queue -> count && comes_before(&queue -> heap[child + 1], &queue -> heap[child]))
+        {
+            child++;
+        }
+
+        if (!comes_before(&queue -> heap[child], &entry))
+        {
+            break;
+        }
+
+        queue -> heap[index]    = queue -> heap[child];
+        index                   = child;
+    }
+
+    queue -> heap[index] = entry;
+}
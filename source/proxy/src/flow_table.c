@@ -0,0 +1,325 @@
+#include "flow_table.h"
+#include "proxy_config.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <stdlib.h>
+
+static uint64_t address_hash(const struct sockaddr_storage *addr);
+static bool     address_equal(const struct sockaddr_storage *a, const struct sockaddr_storage *b);
+static double   fairness(const struct flow_table *table, bool client);
+
+int flow_table_init(struct flow_table *table, size_t capacity, struct fsm_error *err)
+{
+    size_t slots;
+
+    memset(table, 0, sizeof(*table));
+
+    // the index stays at most half full, so a probe ends on an empty slot within a few steps
+    for (slots = 16; slots < 2 * capacity; slots *= 2)
+    {
+    }
+
+    table -> flows  = calloc(capacity, sizeof(*table -> flows));
+    table -> slots  = malloc(slots * sizeof(*table -> slots));
+    if (table -> flows == NULL || table -> slots == NULL)
+    {
+        SET_ERROR(err, strerror(errno));
+        flow_table_destroy(table);
+        return -1;
+    }
+
+    memset(table -> slots, -1, slots * sizeof(*table -> slots));
+    table -> capacity   = capacity;
+    table -> slot_mask  = slots - 1;
+
+    return 0;
+}
+
+struct flow *flow_table_find(const struct flow_table *table, const struct sockaddr_storage *addr)
+{
+    size_t slot;
+
+    for (slot = address_hash(addr) & table -> slot_mask; table -> slots[slot] != -1; slot = (slot + 1) & table -> slot_mask)
+    {
+        struct flow *entry;
+
+        entry = &table -> flows[table -> slots[slot]];
+        if (address_equal(&entry -> client_addr, addr))
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+// NULL with err set once every flow is taken, flows stay for the life of the proxy like a NAT without timeouts
+struct flow *flow_table_add(struct flow_table *table, const struct sockaddr_storage *addr, int upstream_fd,
+                            struct fsm_error *err)
+{
+    struct flow *entry;
+    size_t      slot;
+
+    if (table -> count == table -> capacity)
+    {
+        SET_ERROR(err, "Flow table is full.");
+        return NULL;
+    }
+
+    if ((size_t) upstream_fd >= table -> fd_limit)
+    {
+        struct flow **grown;
+        size_t      limit;
+
+        limit = table -> fd_limit == 0 ? 64 : table -> fd_limit;
+        while (limit <= (size_t) upstream_fd)
+        {
+            limit *= 2;
+        }
+
+        grown = realloc(table -> by_fd, limit * sizeof(*table -> by_fd));
+        if (grown == NULL)
+        {
+            SET_ERROR(err, strerror(errno));
+            return NULL;
+        }
+
+        memset(grown + table -> fd_limit, 0, (limit - table -> fd_limit) * sizeof(*grown));
+        table -> by_fd      = grown;
+        table -> fd_limit   = limit;
+    }
+
+    entry                       = &table -> flows[table -> count];
+    entry -> client_addr        = *addr;
+    entry -> upstream_fd        = upstream_fd;
+    table -> by_fd[upstream_fd] = entry;
+
+    for (slot = address_hash(addr) & table -> slot_mask; table -> slots[slot] != -1; slot = (slot + 1) & table -> slot_mask)
+    {
+    }
+
+    table -> slots[slot] = (int32_t) table -> count++;
+
+    return entry;
+}
+
+// undoes the last flow_table_add; no later flow's probe can have passed over its slot, so emptying it is enough
+void flow_table_remove_last(struct flow_table *table)
+{
+    struct flow *entry;
+    size_t      slot;
+
+    if (table -> count == 0)
+    {
+        return;
+    }
+
+    entry = &table -> flows[--table -> count];
+
+    for (slot = address_hash(&entry -> client_addr) & table -> slot_mask;
+         table -> slots[slot] != (int32_t) table -> count; slot = (slot + 1) & table -> slot_mask)
+    {
+    }
+
+    table -> slots[slot]                 = -1;
+    table -> by_fd[entry -> upstream_fd] = NULL;
+    memset(entry, 0, sizeof(*entry));
+}
+
+struct flow *flow_table_by_fd(const struct flow_table *table, int fd)
+{
+    if (fd < 0 || (size_t) fd >= table -> fd_limit)
+    {
+        return NULL;
+    }
+
+    return table -> by_fd[fd];
+}
+
+void flow_table_mark_ready(struct flow_table *table, struct flow *entry)
+{
+    if (entry -> ready)
+    {
+        return;
+    }
+
+    entry -> ready      = true;
+    entry -> next_ready = NULL;
+
+    if (table -> ready_tail != NULL)
+    {
+        table -> ready_tail -> next_ready = entry;
+    }
+    else
+    {
+        table -> ready_head = entry;
+    }
+
+    table -> ready_tail = entry;
+}
+
+struct flow *flow_table_ready(const struct flow_table *table)
+{
+    return table -> ready_head;
+}
+
+// the flow at the head goes to the back after each packet, so the proxy itself serves the flows round-robin
+void flow_table_yield(struct flow_table *table, bool drained)
+{
+    struct flow *entry;
+
+    entry = table -> ready_head;
+    if (entry == NULL)
+    {
+        return;
+    }
+
+    table -> ready_head = entry -> next_ready;
+    if (table -> ready_head == NULL)
+    {
+        table -> ready_tail = NULL;
+    }
+
+    entry -> ready = false;
+
+    if (!drained)
+    {
+        flow_table_mark_ready(table, entry);
+    }
+}
+
+void flow_table_report(struct flow_table *table)
+{
+    if (table -> count == 0)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < table -> count; i++)
+    {
+        struct flow *entry;
+        char        host[NI_MAXHOST], port[NI_MAXSERV], label[48];
+
+        entry = &table -> flows[i];
+        if (getnameinfo((struct sockaddr *) &entry -> client_addr, size_of_address(&entry -> client_addr),
+                        host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+        {
+            strcpy(host, "?");
+            strcpy(port, "?");
+        }
+
+        printf("flow %zu %s:%s: client %" PRIu64 " received %" PRIu64 " forwarded, server %" PRIu64
+               " received %" PRIu64 " forwarded\n", i, host, port, entry -> client_received,
+               entry -> client_forwarded, entry -> server_received, entry -> server_forwarded);
+
+        snprintf(label, sizeof(label), "flow %zu client", i);
+        impairment_report(&entry -> client_impairment, label);
+        snprintf(label, sizeof(label), "flow %zu server", i);
+        impairment_report(&entry -> server_impairment, label);
+    }
+
+    printf("%zu flows, Jain's fairness index of forwarded packets: client %.3f, server %.3f\n",
+           table -> count, fairness(table, true), fairness(table, false));
+}
+
+void flow_table_destroy(struct flow_table *table)
+{
+    for (size_t i = 0; i < table -> count; i++)
+    {
+        receive_batch_destroy(&table -> flows[i].batch);
+        if (table -> flows[i].upstream_fd >= 0)
+        {
+            close(table -> flows[i].upstream_fd);
+        }
+    }
+
+    free(table -> flows);
+    free(table -> slots);
+    free(table -> by_fd);
+    memset(table, 0, sizeof(*table));
+}
+
+// (sum x)^2 / (n sum x^2): 1 when every flow got the same share, 1/n when one flow got everything
+static double fairness(const struct flow_table *table, bool client)
+{
+    uint64_t    total;
+    double      sum, squares;
+
+    total   = 0;
+    sum     = 0;
+    squares = 0;
+    for (size_t i = 0; i < table -> count; i++)
+    {
+        uint64_t share;
+
+        share    = client ? table -> flows[i].client_forwarded : table -> flows[i].server_forwarded;
+        total   += share;
+        sum     += (double) share;
+        squares += (double) share * (double) share;
+    }
+
+    // nothing forwarded yet is as fair as it gets
+    if (total == 0)
+    {
+        return 1;
+    }
+
+    return sum * sum / ((double) table -> count * squares);
+}
+
+// FNV-1a over the port and address, the parts a client is told apart by
+static uint64_t address_hash(const struct sockaddr_storage *addr)
+{
+    const unsigned char *parts[2];
+    size_t              lengths[2];
+    uint64_t            hash;
+
+    if (addr -> ss_family == AF_INET6)
+    {
+        parts[0]    = (const unsigned char *) &((const struct sockaddr_in6 *) addr) -> sin6_port;
+        parts[1]    = (const unsigned char *) &((const struct sockaddr_in6 *) addr) -> sin6_addr;
+        lengths[1]  = sizeof(struct in6_addr);
+    }
+    else
+    {
+        parts[0]    = (const unsigned char *) &((const struct sockaddr_in *) addr) -> sin_port;
+        parts[1]    = (const unsigned char *) &((const struct sockaddr_in *) addr) -> sin_addr;
+        lengths[1]  = sizeof(struct in_addr);
+    }
+
+    lengths[0]  = sizeof(in_port_t);
+    hash        = 14695981039346656037ULL;
+
+    for (size_t part = 0; part < 2; part++)
+    {
+        for (size_t i = 0; i < lengths[part]; i++)
+        {
+            hash ^= parts[part][i];
+            hash *= 1099511628211ULL;
+        }
+    }
+
+    return hash;
+}
+
+static bool address_equal(const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+    if (a -> ss_family != b -> ss_family)
+    {
+        return false;
+    }
+
+    if (a -> ss_family == AF_INET6)
+    {
+        const struct sockaddr_in6 *a6, *b6;
+
+        a6 = (const struct sockaddr_in6 *) a;
+        b6 = (const struct sockaddr_in6 *) b;
+
+        return a6 -> sin6_port == b6 -> sin6_port &&
+               memcmp(&a6 -> sin6_addr, &b6 -> sin6_addr, sizeof(a6 -> sin6_addr)) == 0;
+    }
+
+    return ((const struct sockaddr_in *) a) -> sin_port == ((const struct sockaddr_in *) b) -> sin_port &&
+           ((const struct sockaddr_in *) a) -> sin_addr.s_addr == ((const struct sockaddr_in *) b) -> sin_addr.s_addr;
+}
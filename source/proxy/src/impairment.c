@@ -0,0 +1,556 @@
+#include "impairment.h"
+#include "proxy_config.h"
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+static void     end_burst(struct loss_model *loss);
+static void     report_loss(struct loss_model *loss, const char *direction);
+static void     apply_change(struct impairment *imp, const struct trace_change *change);
+static void     report_link(const struct bottleneck *link, const char *direction);
+static int      bottleneck_admit(struct bottleneck *link, size_t length, uint64_t *delay_usec);
+static uint64_t sample_latency(struct impairment *imp);
+static uint64_t monotonic_usec(void);
+static double   normal(struct prng *rng);
+static double   pareto(struct prng *rng);
+
+int impairment_parse_distribution(const char *name, int *distribution, struct fsm_error *err)
+{
+    static const char *names[] = {"uniform", "normal", "pareto", "table"};
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            *distribution = (int) i;
+            return 0;
+        }
+    }
+
+    SET_ERROR(err, "Unknown delay distribution, expected uniform, normal, pareto or table.");
+    return -1;
+}
+
+int delay_table_load(struct delay_table *table, const char *path, struct fsm_error *err)
+{
+    FILE    *fp;
+    char    line[512];
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+    table -> count  = 0;
+    table -> values = malloc(DELAY_TABLE_MAX_SIZE * sizeof(*table -> values));
+    if (table -> values == NULL)
+    {
+        SET_ERROR(err, strerror(errno));
+        fclose(fp);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL && table -> count < DELAY_TABLE_MAX_SIZE)
+    {
+        char *cursor, *end;
+
+        if (line[0] == '#')
+        {
+            continue;
+        }
+
+        for (cursor = line; table -> count < DELAY_TABLE_MAX_SIZE; cursor = end)
+        {
+            long value;
+
+            errno = 0;
+            value = strtol(cursor, &end, 10);
+            if (end == cursor)
+            {
+                break;
+            }
+
+            if (errno != 0 || value < INT16_MIN || value > INT16_MAX)
+            {
+                SET_ERROR(err, "Delay table value out of range.");
+                delay_table_destroy(table);
+                fclose(fp);
+                return -1;
+            }
+
+            table -> values[table -> count++] = (int16_t) value;
+        }
+    }
+
+    fclose(fp);
+
+    if (table -> count == 0)
+    {
+        SET_ERROR(err, "Delay table is empty.");
+        delay_table_destroy(table);
+        return -1;
+    }
+
+    return 0;
+}
+
+void delay_table_destroy(struct delay_table *table)
+{
+    free(table -> values);
+    table -> values = NULL;
+    table -> count  = 0;
+}
+
+// "p,r[,1-h[,1-k]]" in percent, the same four numbers and order as netem's gemodel
+int impairment_parse_loss_model(const char *spec, struct loss_model *loss, struct fsm_error *err)
+{
+    double      values[4] = {0, 0, 100, 0};
+    const char  *cursor;
+    char        *end;
+    size_t      count;
+
+    cursor = spec;
+    for (count = 0; count < 4; count++)
+    {
+        errno           = 0;
+        values[count]   = strtod(cursor, &end);
+        if (end == cursor || errno != 0 || values[count] < 0 || values[count] > 100)
+        {
+            SET_ERROR(err, "Loss model expects p,r[,1-h[,1-k]] as percentages between 0 and 100.");
+            return -1;
+        }
+
+        cursor = end;
+        if (*cursor != ',')
+        {
+            break;
+        }
+        cursor++;
+    }
+
+    if (*cursor != '\0' || count == 0)
+    {
+        SET_ERROR(err, "Loss model expects p,r[,1-h[,1-k]] as percentages between 0 and 100.");
+        return -1;
+    }
+
+    memset(loss, 0, sizeof(*loss));
+    loss -> to_bad      = values[0] / 100;
+    loss -> to_good     = values[1] / 100;
+    loss -> bad_loss    = values[2] / 100;
+    loss -> good_loss   = values[3] / 100;
+    loss -> enabled     = true;
+
+    return 0;
+}
+
+// the packet sees the state the chain is in, then the chain moves on for the next one
+bool impairment_drops(struct impairment *imp)
+{
+    struct loss_model   *loss;
+    bool                dropped;
+
+    loss = &imp -> loss;
+    if (!loss -> enabled)
+    {
+        return false;
+    }
+
+    dropped = prng_uniform(&imp -> rng) < (loss -> in_bad ? loss -> bad_loss : loss -> good_loss);
+    loss -> seen++;
+
+    if (dropped)
+    {
+        loss -> lost++;
+        loss -> run++;
+    }
+    else if (loss -> run > 0)
+    {
+        end_burst(loss);
+    }
+
+    if (prng_uniform(&imp -> rng) < (loss -> in_bad ? loss -> to_good : loss -> to_bad))
+    {
+        loss -> in_bad = !loss -> in_bad;
+    }
+
+    return dropped;
+}
+
+// "percent[,gap]", the packet picked is overtaken by the next gap packets, one by default
+int impairment_parse_reorder(const char *spec, struct reorder_model *reorder, struct fsm_error *err)
+{
+    char            *end;
+    double          percent;
+    unsigned long   gap;
+
+    errno   = 0;
+    percent = strtod(spec, &end);
+    gap     = 1;
+    if (end == spec || errno != 0 || percent < 0 || percent > 100)
+    {
+        SET_ERROR(err, "Reordering expects percent[,gap] with a percentage between 0 and 100.");
+        return -1;
+    }
+
+    if (*end == ',')
+    {
+        const char *cursor;
+
+        cursor  = end + 1;
+        gap     = strtoul(cursor, &end, 10);
+        if (end == cursor || errno != 0 || gap == 0 || gap > UINT32_MAX)
+        {
+            SET_ERROR(err, "Reordering gap has to be a packet count of at least 1.");
+            return -1;
+        }
+    }
+
+    if (*end != '\0')
+    {
+        SET_ERROR(err, "Reordering expects percent[,gap] with a percentage between 0 and 100.");
+        return -1;
+    }
+
+    reorder -> reorder  = percent / 100;
+    reorder -> gap      = (uint32_t) gap;
+
+    return 0;
+}
+
+// only one packet is held at a time, so a held packet is never itself picked again before it is let go
+bool impairment_reorders(struct impairment *imp)
+{
+    struct reorder_model *reorder;
+
+    reorder = &imp -> reorder;
+    if (reorder -> reorder <= 0 || reorder -> to_pass > 0 || prng_uniform(&imp -> rng) >= reorder -> reorder)
+    {
+        return false;
+    }
+
+    reorder -> to_pass = reorder -> gap;
+    reorder -> reordered++;
+
+    return true;
+}
+
+// true for the packet that completes the gap, the held one is released right behind it
+bool impairment_overtaken(struct impairment *imp)
+{
+    struct reorder_model *reorder;
+
+    reorder = &imp -> reorder;
+    if (reorder -> to_pass == 0)
+    {
+        return false;
+    }
+
+    return --reorder -> to_pass == 0;
+}
+
+bool impairment_duplicates(struct impairment *imp)
+{
+    if (imp -> reorder.duplicate <= 0 || prng_uniform(&imp -> rng) >= imp -> reorder.duplicate)
+    {
+        return false;
+    }
+
+    imp -> reorder.duplicated++;
+
+    return true;
+}
+
+// DROP, CORRUPT or SEND from the trace's next step, -1 when the trace has no steps and the packet is left to the rest
+int impairment_replay(struct impairment *imp)
+{
+    const struct trace_change   *change;
+    const struct trace_step     *step;
+    uint64_t                    now;
+
+    if (!trace_loaded(&imp -> trace))
+    {
+        return -1;
+    }
+
+    now = monotonic_usec();
+    while ((change = trace_due_change(&imp -> trace, now)) != NULL)
+    {
+        apply_change(imp, change);
+    }
+
+    step = trace_next_step(&imp -> trace);
+    if (step == NULL)
+    {
+        return -1;
+    }
+
+    switch (step -> action)
+    {
+        case TRACE_DROP:
+        {
+            return DROP;
+        }
+        case TRACE_CORRUPT:
+        {
+            return CORRUPT;
+        }
+        case TRACE_DELAY:
+        {
+            // picked up by impairment_schedule when the packet is queued
+            imp -> trace_delay_usec = step -> delay_usec;
+            return SEND;
+        }
+        case TRACE_FORWARD:
+        default:
+        {
+            return SEND;
+        }
+    }
+}
+
+// a plain loss rate is the loss model kept in its good state
+static void apply_change(struct impairment *imp, const struct trace_change *change)
+{
+    if (change -> fields & TRACE_LATENCY)
+    {
+        imp -> latency_usec = change -> latency_usec;
+    }
+
+    if (change -> fields & TRACE_JITTER)
+    {
+        imp -> jitter_usec = change -> jitter_usec;
+    }
+
+    if (change -> fields & TRACE_RATE)
+    {
+        impairment_link(imp) -> rate_bps = change -> rate_bps;
+    }
+
+    if (change -> fields & TRACE_QUEUE)
+    {
+        impairment_link(imp) -> limit_bytes = change -> limit_bytes;
+    }
+
+    if (change -> fields & TRACE_LOSS)
+    {
+        imp -> loss.enabled     = true;
+        imp -> loss.in_bad      = false;
+        imp -> loss.to_bad      = 0;
+        imp -> loss.good_loss   = change -> loss;
+    }
+}
+
+void impairment_report(struct impairment *imp, const char *direction)
+{
+    report_link(&imp -> link, direction);
+    report_loss(&imp -> loss, direction);
+
+    if (imp -> reorder.reordered + imp -> reorder.duplicated > 0)
+    {
+        printf("%s reordering: %" PRIu64 " packets held back, %" PRIu64 " duplicated\n",
+               direction, imp -> reorder.reordered, imp -> reorder.duplicated);
+    }
+
+    if (imp -> trace.replayed > 0 || imp -> trace.next_change > 0)
+    {
+        printf("%s trace: %" PRIu64 " packets replayed over %" PRIu64 " full passes, %zu of %zu link changes applied\n",
+               direction, imp -> trace.replayed, imp -> trace.loops, imp -> trace.next_change,
+               imp -> trace.change_count);
+    }
+}
+
+static void report_loss(struct loss_model *loss, const char *direction)
+{
+    if (!loss -> enabled || loss -> seen == 0)
+    {
+        return;
+    }
+
+    // a burst still running when the proxy stops counts with what it reached
+    if (loss -> run > 0)
+    {
+        end_burst(loss);
+    }
+
+    printf("%s loss model: %" PRIu64 " of %" PRIu64 " packets lost in %" PRIu64 " bursts, longest %" PRIu64 "\n",
+           direction, loss -> lost, loss -> seen, loss -> bursts, loss -> longest);
+
+    printf("%s burst lengths:", direction);
+    for (size_t i = 0; i < LOSS_BURST_BUCKETS; i++)
+    {
+        if (loss -> burst_lengths[i] > 0)
+        {
+            printf(" %zu%s:%" PRIu64, i + 1, i == LOSS_BURST_BUCKETS - 1 ? "+" : "", loss -> burst_lengths[i]);
+        }
+    }
+    printf("\n");
+}
+
+static void report_link(const struct bottleneck *link, const char *direction)
+{
+    if (link -> rate_bps == 0 || link -> accepted + link -> tail_drops == 0)
+    {
+        return;
+    }
+
+    printf("%s bottleneck: %" PRIu64 " packets queued, %" PRIu64 " tail drops, backlog up to %" PRIu64
+           " bytes, queueing delay mean %" PRIu64 " max %" PRIu64 " usec\n",
+           direction, link -> accepted, link -> tail_drops, link -> max_backlog_bytes,
+           link -> accepted > 0 ? link -> total_wait_usec / link -> accepted : 0, link -> max_wait_usec);
+}
+
+// true when packets of this direction have to pass through the delay queue rather than straight to the socket
+bool impairment_holds(const struct impairment *imp)
+{
+    return imp -> latency_usec > 0 || imp -> jitter_usec > 0 || imp -> link.rate_bps > 0 ||
+           imp -> reorder.reorder > 0 || imp -> reorder.duplicate > 0 || trace_loaded(&imp -> trace);
+}
+
+struct bottleneck *impairment_link(struct impairment *imp)
+{
+    return imp -> shared_link != NULL ? imp -> shared_link : &imp -> link;
+}
+
+// how long the packet is held: its wait in the bottleneck queue, its serialisation, then the path latency
+int impairment_schedule(struct impairment *imp, size_t length, uint64_t *delay_usec)
+{
+    uint64_t extra;
+
+    // a replayed delay belongs to this packet only, a duplicate or the next packet does not inherit it
+    extra                   = imp -> trace_delay_usec;
+    imp -> trace_delay_usec = 0;
+
+    if (bottleneck_admit(impairment_link(imp), length, delay_usec) == -1)
+    {
+        return -1;
+    }
+
+    *delay_usec += sample_latency(imp) + extra;
+
+    return 0;
+}
+
+static int bottleneck_admit(struct bottleneck *link, size_t length, uint64_t *delay_usec)
+{
+    uint64_t now, start;
+
+    *delay_usec = 0;
+    if (link -> rate_bps == 0)
+    {
+        return 0;
+    }
+
+    now                     = monotonic_usec();
+    start                   = link -> free_at_usec > now ? link -> free_at_usec : now;
+    link -> wait_usec       = start - now;
+    link -> backlog_bytes   = link -> wait_usec * link -> rate_bps / 8000000;
+
+    if (link -> backlog_bytes + length > link -> limit_bytes)
+    {
+        link -> tail_drops++;
+        return -1;
+    }
+
+    link -> free_at_usec    = start + (length * 8000000 + link -> rate_bps - 1) / link -> rate_bps;
+    link -> accepted++;
+    link -> total_wait_usec += link -> wait_usec;
+
+    if (link -> backlog_bytes > link -> max_backlog_bytes)
+    {
+        link -> max_backlog_bytes = link -> backlog_bytes;
+    }
+
+    if (link -> wait_usec > link -> max_wait_usec)
+    {
+        link -> max_wait_usec = link -> wait_usec;
+    }
+
+    *delay_usec = link -> free_at_usec - now;
+
+    return 0;
+}
+
+// uniform spreads over latency +- jitter, the other distributions take jitter as the standard deviation
+static uint64_t sample_latency(struct impairment *imp)
+{
+    double deviation, delay;
+
+    if (imp -> jitter_usec == 0)
+    {
+        return imp -> latency_usec;
+    }
+
+    switch (imp -> distribution)
+    {
+        case DISTRIBUTION_NORMAL:
+        {
+            deviation = normal(&imp -> rng);
+            break;
+        }
+        case DISTRIBUTION_PARETO:
+        {
+            deviation = pareto(&imp -> rng);
+            break;
+        }
+        case DISTRIBUTION_TABLE:
+        {
+            deviation = (double) imp -> table -> values[prng_below(&imp -> rng, (uint32_t) imp -> table -> count)] / DELAY_TABLE_SCALE;
+            break;
+        }
+        case DISTRIBUTION_UNIFORM:
+        default:
+        {
+            deviation = 2 * prng_uniform(&imp -> rng) - 1;
+        }
+    }
+
+    delay = (double) imp -> latency_usec + deviation * (double) imp -> jitter_usec;
+
+    // a packet cannot leave before it arrived, the low tail is clipped at no delay
+    return delay <= 0 ? 0 : (uint64_t) delay;
+}
+
+static void end_burst(struct loss_model *loss)
+{
+    size_t bucket;
+
+    bucket = loss -> run < LOSS_BURST_BUCKETS ? loss -> run - 1 : LOSS_BURST_BUCKETS - 1;
+    loss -> burst_lengths[bucket]++;
+    loss -> bursts++;
+
+    if (loss -> run > loss -> longest)
+    {
+        loss -> longest = loss -> run;
+    }
+
+    loss -> run = 0;
+}
+
+static uint64_t monotonic_usec(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+}
+
+// prng_uniform never returns exactly 0, which log() and cbrt() could not take
+static double normal(struct prng *rng)
+{
+    double pi;
+
+    // folded at compile time, M_PI would be an unsuffixed floating constant
+    pi = acos(-1);
+
+    return sqrt(-2 * log(prng_uniform(rng))) * cos(2 * pi * prng_uniform(rng));
+}
+
+// shape 3 is heavy-tailed but still has a deviation to scale by: mean 3/2, deviation sqrt(3)/2
+static double pareto(struct prng *rng)
+{
+    return (2 / cbrt(prng_uniform(rng)) - 3) / sqrt(3);
+}
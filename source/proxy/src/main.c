@@ -2,12 +2,24 @@
 #include "server_config.h"
 #include "command_line.h"
 #include "proxy_config.h"
+#include "send_queue.h"
+#include "uring_forward.h"
+#include "xdp_forward.h"
+#include "delay_queue.h"
+#include "packet_pool.h"
+#include "impairment.h"
+#include "flow_table.h"
 #include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
 
 #define PROXY_CLIENT_PORT 8000
 #define PROXY_SERVER_PORT 8050
 #define GUI_PORT 61060
-#define DELAY_TIME 5
+#define DELAY_TIME_USEC 5000000ULL
+#define MAX_EVENTS 8
 
 enum main_application_states
 {
@@ -19,26 +31,25 @@ enum main_application_states
     STATE_LISTEN,
     STATE_CREATE_GUI_THREAD,
     STATE_CREATE_WINDOW,
-    STATE_CREATE_SERVER_THREAD,
     STATE_CREATE_KEYBOARD_THREAD,
+    STATE_CREATE_EVENT_LOOP,
+    STATE_EVENT_LOOP,
     STATE_LISTEN_CLIENT,
     STATE_CLIENT_CALCULATE_LOSSINESS,
     STATE_CLIENT_DROP,
     STATE_CLIENT_DELAY_PACKET,
     STATE_CLIENT_CORRUPT,
     STATE_SEND_CLIENT_PACKET,
-    STATE_CLEANUP,
-    STATE_ERROR
-};
-
-enum server_thread_states
-{
-    STATE_LISTEN_SERVER = FSM_USER_START,
+    STATE_LISTEN_SERVER,
     STATE_SERVER_CALCULATE_LOSSINESS,
     STATE_SERVER_DELAY_PACKET,
     STATE_SERVER_DROP,
     STATE_SERVER_CORRUPT,
-    STATE_SEND_SERVER_PACKET
+    STATE_SEND_SERVER_PACKET,
+    STATE_URING_FORWARD,
+    STATE_XDP_FORWARD,
+    STATE_CLEANUP,
+    STATE_ERROR
 };
 
 enum keyboard_thread_states
@@ -46,6 +57,12 @@ enum keyboard_thread_states
     STATE_READ_FROM_KEYBOARD = FSM_USER_START,
 };
 
+enum routes
+{
+    CLIENT_ROUTE,
+    SERVER_ROUTE
+};
+
 enum gui_stats
 {
     SENT_PACKET,
@@ -56,7 +73,8 @@ enum gui_stats
     DELAYED_CLIENT_PACKET,
     DROPPED_SERVER_PACKET,
     DELAYED_SERVER_PACKET,
-    CORRUPTED_DATA
+    CORRUPTED_DATA,
+    KERNEL_DROPPED_PACKET
 };
 
 static int parse_arguments_handler(struct fsm_context *context, struct fsm_error *err);
@@ -66,14 +84,17 @@ static int create_socket_handler(struct fsm_context *context, struct fsm_error *
 static int bind_socket_handler(struct fsm_context *context, struct fsm_error *err);
 static int listen_handler(struct fsm_context *context, struct fsm_error *err);
 static int create_gui_thread_handler(struct fsm_context *context, struct fsm_error *err);
-static int create_server_thread_handler(struct fsm_context *context, struct fsm_error *err);
 static int create_keyboard_thread_handler(struct fsm_context *context, struct fsm_error *err);
+static int create_event_loop_handler(struct fsm_context *context, struct fsm_error *err);
+static int event_loop_handler(struct fsm_context *context, struct fsm_error *err);
 static int listen_client_handler(struct fsm_context *context, struct fsm_error *err);
 static int calculate_client_lossiness_handler(struct fsm_context *context, struct fsm_error *err);
 static int client_drop_packet_handler(struct fsm_context *context, struct fsm_error *err);
 static int client_delay_packet_handler(struct fsm_context *context, struct fsm_error *err);
 static int client_corrupt_packet_handler(struct fsm_context *context, struct fsm_error *err);
 static int send_client_packet_handler(struct fsm_context *context, struct fsm_error *err);
+static int uring_forward_handler(struct fsm_context *context, struct fsm_error *err);
+static int xdp_forward_handler(struct fsm_context *context, struct fsm_error *err);
 static int cleanup_handler(struct fsm_context *context, struct fsm_error *err);
 static int error_handler(struct fsm_context *context, struct fsm_error *err);
 
@@ -86,37 +107,70 @@ static int send_server_packet_handler(struct fsm_context *context, struct fsm_er
 
 static int read_from_keyboard_handler(struct fsm_context *context, struct fsm_error *err);
 
+static void                     uring_route_packet(struct fsm_context *ctx, const struct uring_event *event);
+static int                      xdp_route_frame(struct fsm_context *ctx, const struct xdp_frame *frame,
+                                                struct fsm_error *err);
+static int                      watch_fd(int epoll_fd, int fd);
+static struct impairment        *route_impairment(struct fsm_context *ctx, int route);
+static struct flow              *open_flow(struct fsm_context *ctx, const struct sockaddr_storage *addr,
+                                           struct fsm_error *err);
+static int                      forward_packet(struct fsm_context *ctx, struct flow *current, int route,
+                                               const struct packet *pt, struct fsm_error *err);
+static int                      release_delayed_packets(struct fsm_context *ctx, struct fsm_error *err);
+static int                      schedule_packet(struct fsm_context *ctx, const struct packet *pt, int route,
+                                                uint64_t *delay_usec);
+static int                      hold_packet(struct fsm_context *ctx, struct packet *pt, int route,
+                                            uint64_t extra_usec, uint64_t *held_usec, struct fsm_error *err);
+static void                     accept_gui(struct fsm_context *ctx, struct fsm_error *err);
+static void                     size_for_window(struct fsm_context *ctx, const struct packet *pt);
+static void                     report_kernel_drops(struct fsm_context *ctx);
 static void                     sigint_handler(int signum);
 static int                      setup_signal_handler(struct fsm_error *err);
 int                             create_file(const char *filepath, FILE **fp, struct fsm_error *err);
 
 static volatile sig_atomic_t exit_flag = 0;
 
-void *init_server_thread(void *ptr);
 void *init_keyboard_thread(void *ptr);
-void *init_client_delay_thread(void *ptr);
-void *init_server_delay_thread(void *ptr);
 void *init_gui_function(void *ptr);
 
 typedef struct arguments
 {
-    int                     client_sockfd, server_sockfd, num_of_threads;
+    int                     client_sockfd, server_sockfd, epoll_fd;
     int                     proxy_gui_fd, connected_gui_fd, is_connected_gui;
+    int                     client_ready, server_ready, server_turn;
     char                    *server_addr, *client_addr, *server_port_str, *client_port_str, *proxy_addr;
     in_port_t               server_port, client_port;
     struct sockaddr_storage server_addr_struct, client_addr_struct, proxy_addr_struct, gui_addr_struct;
-    pthread_t               server_thread, keyboard_thread, accept_gui_thread;
-    pthread_t               *thread_pool;
-    struct packet           server_packet, client_packet;
+    pthread_t               keyboard_thread, accept_gui_thread;
+    struct packet           *server_packet, *client_packet;
+    struct packet_pool      pool;
+    struct send_queue       client_queue, server_queue;
+    struct receive_batch    client_batch, server_batch;
+    struct delay_queue      delay_queue;
+    struct impairment       client_impairment, server_impairment;
+    struct delay_table      delay_table;
+    char                    *delay_table_path, *seed_str;
+    uint64_t                seed;
+    // with --flows every client address gets a flow, flow is the one the packet being handled belongs to
+    struct flow_table       flows;
+    struct flow             *flow;
+    uint64_t                max_flows;
+    bool                    shared_bottleneck;
+    // the stream the next flow's client direction draws from, its server direction takes the one after
+    struct prng             next_flow_rng;
+    struct keyboard_menu    keyboard_menu;
+    struct uring            ring;
+    struct xdp              xdp;
+    char                    *xdp_ifname;
+    bool                    use_uring, xdp_zerocopy;
     uint8_t                 client_delay_rate, server_delay_rate, client_drop_rate, server_drop_rate, corruption_rate;
-    FILE                    *sent_data, *received_data;
+    uint8_t                 window_size;
+    uint32_t                reported_kernel_drops;
+    FILE                    *sent_data, *received_data, *queue_data;
 } arguments;
 
 
 
-pthread_mutex_t num_of_threads_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-
 int main(int argc, char **argv)
 {
 
@@ -127,8 +181,12 @@ int main(int argc, char **argv)
             .server_delay_rate  = 0,
             .server_drop_rate   = 0,
             .corruption_rate    = 0,
-            .num_of_threads     = 0,
-            .is_connected_gui   = 0
+            .is_connected_gui   = 0,
+            .use_uring          = false,
+            .xdp_ifname         = NULL,
+            .xdp_zerocopy       = false,
+            .client_impairment  = {.link = {.limit_bytes = BOTTLENECK_DEFAULT_QUEUE_BYTES}},
+            .server_impairment  = {.link = {.limit_bytes = BOTTLENECK_DEFAULT_QUEUE_BYTES}}
     };
 
     struct fsm_context context = {
@@ -145,34 +203,59 @@ int main(int argc, char **argv)
             {STATE_CREATE_SOCKET,               STATE_BIND_SOCKET,              bind_socket_handler},
             {STATE_BIND_SOCKET,                 STATE_LISTEN,                   listen_handler},
             {STATE_LISTEN,                      STATE_CREATE_GUI_THREAD,        create_gui_thread_handler},
-            {STATE_CREATE_GUI_THREAD,           STATE_CREATE_SERVER_THREAD,     create_server_thread_handler},
-            {STATE_CREATE_SERVER_THREAD,        STATE_CREATE_KEYBOARD_THREAD,   create_keyboard_thread_handler},
-            {STATE_CREATE_KEYBOARD_THREAD,      STATE_LISTEN_CLIENT,            listen_client_handler},
+            {STATE_LISTEN,                      STATE_CREATE_EVENT_LOOP,        create_event_loop_handler},
+            {STATE_CREATE_GUI_THREAD,           STATE_CREATE_KEYBOARD_THREAD,   create_keyboard_thread_handler},
+            {STATE_CREATE_KEYBOARD_THREAD,      STATE_URING_FORWARD,            uring_forward_handler},
+            {STATE_CREATE_KEYBOARD_THREAD,      STATE_XDP_FORWARD,              xdp_forward_handler},
+            {STATE_URING_FORWARD,               STATE_CLEANUP,                  cleanup_handler},
+            {STATE_XDP_FORWARD,                 STATE_CLEANUP,                  cleanup_handler},
+            {STATE_CREATE_EVENT_LOOP,           STATE_EVENT_LOOP,               event_loop_handler},
+            {STATE_EVENT_LOOP,                  STATE_LISTEN_CLIENT,            listen_client_handler},
+            {STATE_EVENT_LOOP,                  STATE_LISTEN_SERVER,            listen_server_handler},
+            {STATE_EVENT_LOOP,                  STATE_CLEANUP,                  cleanup_handler},
             {STATE_LISTEN_CLIENT,               STATE_CLIENT_CALCULATE_LOSSINESS,calculate_client_lossiness_handler},
-            {STATE_LISTEN_CLIENT,               STATE_CLEANUP,                  cleanup_handler},
+            {STATE_LISTEN_CLIENT,               STATE_EVENT_LOOP,               event_loop_handler},
             {STATE_CLIENT_CALCULATE_LOSSINESS,  STATE_CLIENT_DROP,               client_drop_packet_handler},
             {STATE_CLIENT_CALCULATE_LOSSINESS,  STATE_CLIENT_DELAY_PACKET,       client_delay_packet_handler},
             {STATE_CLIENT_CALCULATE_LOSSINESS,  STATE_CLIENT_CORRUPT,           client_corrupt_packet_handler},
             {STATE_CLIENT_CALCULATE_LOSSINESS,  STATE_SEND_CLIENT_PACKET,        send_client_packet_handler},
-            {STATE_CLIENT_DROP,                 STATE_LISTEN_CLIENT,             listen_client_handler},
-            {STATE_CLIENT_DELAY_PACKET,         STATE_LISTEN_CLIENT,             listen_client_handler},
+            {STATE_CLIENT_DROP,                 STATE_EVENT_LOOP,                event_loop_handler},
+            {STATE_CLIENT_DELAY_PACKET,         STATE_EVENT_LOOP,                event_loop_handler},
             {STATE_CLIENT_CORRUPT,              STATE_SEND_CLIENT_PACKET,        send_client_packet_handler},
-            {STATE_SEND_CLIENT_PACKET,          STATE_LISTEN_CLIENT,             listen_client_handler},
+            {STATE_SEND_CLIENT_PACKET,          STATE_EVENT_LOOP,                event_loop_handler},
+            {STATE_LISTEN_SERVER,               STATE_SERVER_CALCULATE_LOSSINESS,calculate_server_lossiness_handler},
+            {STATE_LISTEN_SERVER,               STATE_EVENT_LOOP,               event_loop_handler},
+            {STATE_SERVER_CALCULATE_LOSSINESS,  STATE_SERVER_DROP,               server_drop_packet_handler},
+            {STATE_SERVER_CALCULATE_LOSSINESS,  STATE_SERVER_DELAY_PACKET,       server_delay_packet_handler},
+            {STATE_SERVER_CALCULATE_LOSSINESS,  STATE_SERVER_CORRUPT,           server_corrupt_packet_handler},
+            {STATE_SERVER_CALCULATE_LOSSINESS,  STATE_SEND_SERVER_PACKET,        send_server_packet_handler},
+            {STATE_SERVER_DROP,                 STATE_EVENT_LOOP,                event_loop_handler},
+            {STATE_SERVER_DELAY_PACKET,         STATE_EVENT_LOOP,                event_loop_handler},
+            {STATE_SERVER_CORRUPT,              STATE_SEND_SERVER_PACKET,        send_server_packet_handler},
+            {STATE_SEND_SERVER_PACKET,          STATE_EVENT_LOOP,                event_loop_handler},
             {STATE_ERROR,                       STATE_CLEANUP,                   cleanup_handler},
             {STATE_PARSE_ARGUMENTS,             STATE_ERROR,                     error_handler},
             {STATE_HANDLE_ARGUMENTS,            STATE_ERROR,                     error_handler},
             {STATE_CONVERT_ADDRESS,             STATE_ERROR,                     error_handler},
             {STATE_CREATE_SOCKET,               STATE_ERROR,                     error_handler},
             {STATE_BIND_SOCKET,                 STATE_ERROR,                     error_handler},
+            {STATE_LISTEN,                      STATE_ERROR,                     error_handler},
             {STATE_CREATE_WINDOW,               STATE_ERROR,                     error_handler},
-            {STATE_CREATE_SERVER_THREAD,        STATE_ERROR,                     error_handler},
+            {STATE_CREATE_GUI_THREAD,           STATE_ERROR,                     error_handler},
             {STATE_CREATE_KEYBOARD_THREAD,      STATE_ERROR,                     error_handler},
+            {STATE_CREATE_EVENT_LOOP,           STATE_ERROR,                     error_handler},
+            {STATE_EVENT_LOOP,                  STATE_ERROR,                     error_handler},
             {STATE_LISTEN_CLIENT,               STATE_ERROR,                     error_handler},
+            {STATE_LISTEN_SERVER,               STATE_ERROR,                     error_handler},
+            {STATE_URING_FORWARD,               STATE_ERROR,                     error_handler},
+            {STATE_XDP_FORWARD,                 STATE_ERROR,                     error_handler},
             {STATE_CLIENT_DROP,                 STATE_ERROR,                     error_handler},
+            {STATE_CLIENT_DELAY_PACKET,         STATE_ERROR,                     error_handler},
+            {STATE_SERVER_DELAY_PACKET,         STATE_ERROR,                     error_handler},
             {STATE_SEND_CLIENT_PACKET,          STATE_ERROR,                     error_handler},
+            {STATE_SEND_SERVER_PACKET,          STATE_ERROR,                     error_handler},
             {STATE_CLEANUP,                     FSM_EXIT,                        NULL},
     };
-    srand(time(NULL));
 
     fsm_run(&context, &err, transitions);
 
@@ -189,7 +272,11 @@ static int parse_arguments_handler(struct fsm_context *context, struct fsm_error
                         &ctx -> args -> server_port_str, &ctx -> args -> client_port_str,
                         &ctx -> args -> client_delay_rate, &ctx -> args -> client_drop_rate,
                         &ctx -> args -> server_delay_rate, &ctx -> args -> server_drop_rate,
-                        &ctx -> args -> corruption_rate, err) == -1)
+                        &ctx -> args -> corruption_rate, &ctx -> args -> use_uring,
+                        &ctx -> args -> xdp_ifname, &ctx -> args -> xdp_zerocopy,
+                        &ctx -> args -> client_impairment, &ctx -> args -> server_impairment,
+                        &ctx -> args -> delay_table_path, &ctx -> args -> seed_str,
+                        &ctx -> args -> max_flows, &ctx -> args -> shared_bottleneck, err) == -1)
     {
         return STATE_ERROR;
     }
@@ -210,6 +297,50 @@ static int handle_arguments_handler(struct fsm_context *context, struct fsm_erro
         return STATE_ERROR;
     }
 
+    if (ctx -> args -> delay_table_path != NULL &&
+        delay_table_load(&ctx -> args -> delay_table, ctx -> args -> delay_table_path, err) == -1)
+    {
+        return STATE_ERROR;
+    }
+
+    if ((ctx -> args -> client_impairment.distribution == DISTRIBUTION_TABLE ||
+         ctx -> args -> server_impairment.distribution == DISTRIBUTION_TABLE) &&
+        ctx -> args -> delay_table.count == 0)
+    {
+        SET_ERROR(err, "The table distribution needs a --delay-table file.");
+        return STATE_ERROR;
+    }
+
+    ctx -> args -> client_impairment.table = &ctx -> args -> delay_table;
+    ctx -> args -> server_impairment.table = &ctx -> args -> delay_table;
+
+    if (ctx -> args -> seed_str != NULL)
+    {
+        if (convert_to_uint64(ctx -> argv[0], ctx -> args -> seed_str, &ctx -> args -> seed, err) == -1)
+        {
+            return STATE_ERROR;
+        }
+    }
+    else if (getrandom(&ctx -> args -> seed, sizeof(ctx -> args -> seed), 0) != sizeof(ctx -> args -> seed))
+    {
+        ctx -> args -> seed = (uint64_t) time(NULL);
+    }
+
+    // io_uring and AF_XDP forward between two fixed peers, only the epoll path looks a flow up per packet
+    if (ctx -> args -> max_flows > 0 && (ctx -> args -> use_uring || ctx -> args -> xdp_ifname != NULL))
+    {
+        SET_ERROR(err, "--flows cannot be combined with -U or -X.");
+        return STATE_ERROR;
+    }
+
+    // the server stream is the client's jumped ahead, so the two directions never draw the same numbers
+    printf("Impairment seed: %" PRIu64 "\n", ctx -> args -> seed);
+    prng_seed(&ctx -> args -> client_impairment.rng, ctx -> args -> seed);
+    ctx -> args -> server_impairment.rng = ctx -> args -> client_impairment.rng;
+    prng_jump(&ctx -> args -> server_impairment.rng);
+    ctx -> args -> next_flow_rng = ctx -> args -> server_impairment.rng;
+    prng_jump(&ctx -> args -> next_flow_rng);
+
     if (create_file("../proxy_received_data.csv", &ctx -> args -> received_data, err) == -1)
     {
         return STATE_ERROR;
@@ -220,6 +351,13 @@ static int handle_arguments_handler(struct fsm_context *context, struct fsm_erro
         return STATE_ERROR;
     }
 
+    // one row per packet offered to a bottleneck: direction, backlog in bytes, queueing delay in usec, tail-dropped
+    if ((ctx -> args -> client_impairment.link.rate_bps > 0 || ctx -> args -> server_impairment.link.rate_bps > 0) &&
+        create_file("../proxy_queue_data.csv", &ctx -> args -> queue_data, err) == -1)
+    {
+        return STATE_ERROR;
+    }
+
     return STATE_CONVERT_ADDRESS;
 }
 
@@ -274,6 +412,24 @@ static int create_socket_handler(struct fsm_context *context, struct fsm_error *
         return STATE_ERROR;
     }
 
+    if (send_queue_init(&ctx -> args -> client_queue) == -1 ||
+        send_queue_init(&ctx -> args -> server_queue) == -1)
+    {
+        SET_ERROR(err, "Error in creating send queue.");
+        return STATE_ERROR;
+    }
+
+    // io_uring receives into fixed-size provided buffers, so GRO must stay off there
+    if (!ctx -> args -> use_uring &&
+        (packet_pool_init(&ctx -> args -> pool, PACKET_POOL_SIZE, err) == -1 ||
+         receive_batch_init(&ctx -> args -> client_batch, &ctx -> args -> pool, ctx -> args -> client_sockfd,
+                            RECEIVE_BATCH_SIZE, err) == -1 ||
+         receive_batch_init(&ctx -> args -> server_batch, &ctx -> args -> pool, ctx -> args -> server_sockfd,
+                            RECEIVE_BATCH_SIZE, err) == -1))
+    {
+        return STATE_ERROR;
+    }
+
     return STATE_BIND_SOCKET;
 }
 
@@ -310,7 +466,18 @@ static int listen_handler(struct fsm_context *context, struct fsm_error *err)
         return STATE_ERROR;
     }
 
-    return STATE_CREATE_GUI_THREAD;
+    // the loss model counters are only printed on the way out through cleanup
+    if (setup_signal_handler(err) == -1)
+    {
+        return STATE_ERROR;
+    }
+
+    if (ctx -> args -> use_uring || ctx -> args -> xdp_ifname != NULL)
+    {
+        return STATE_CREATE_GUI_THREAD;
+    }
+
+    return STATE_CREATE_EVENT_LOOP;
 }
 
 static int create_gui_thread_handler(struct fsm_context *context, struct fsm_error *err)
@@ -326,69 +493,222 @@ static int create_gui_thread_handler(struct fsm_context *context, struct fsm_err
         return STATE_ERROR;
     }
 
-    return STATE_CREATE_SERVER_THREAD;
+    return STATE_CREATE_KEYBOARD_THREAD;
 }
 
-static int create_server_thread_handler(struct fsm_context *context, struct fsm_error *err)
+static int create_keyboard_thread_handler(struct fsm_context *context, struct fsm_error *err)
 {
-    struct fsm_context      *ctx;
-    int                     result;
+    struct fsm_context *ctx;
+    int result;
     ctx = context;
-    SET_TRACE(context, "in create receive thread", "STATE_CREATE_RECV_THREAD");
-    result = pthread_create(&ctx->args->server_thread, NULL, init_server_thread, (void *) ctx);
+    SET_TRACE(context, "in create keyboard thread", "STATE_CREATE_KEYBOARD_THREAD");
+    result = pthread_create(&ctx->args->keyboard_thread, NULL, init_keyboard_thread, (void *) ctx);
     if (result < 0)
     {
         return STATE_ERROR;
     }
 
-    return STATE_CREATE_KEYBOARD_THREAD;
+    if (ctx -> args -> xdp_ifname != NULL)
+    {
+        return STATE_XDP_FORWARD;
+    }
+
+    return STATE_URING_FORWARD;
 }
 
-static int create_keyboard_thread_handler(struct fsm_context *context, struct fsm_error *err)
+static int create_event_loop_handler(struct fsm_context *context, struct fsm_error *err)
 {
     struct fsm_context *ctx;
-    int result;
     ctx = context;
-    SET_TRACE(context, "in create keyboard thread", "STATE_CREATE_KEYBOARD_THREAD");
-    result = pthread_create(&ctx->args->keyboard_thread, NULL, init_keyboard_thread, (void *) ctx);
-    if (result < 0)
+    SET_TRACE(context, "", "STATE_CREATE_EVENT_LOOP");
+
+    ctx -> args -> epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (ctx -> args -> epoll_fd == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        return STATE_ERROR;
+    }
+
+    if (delay_queue_init(&ctx -> args -> delay_queue, err) == -1)
     {
         return STATE_ERROR;
     }
 
-    return STATE_LISTEN_CLIENT;
+    if (ctx -> args -> max_flows > 0 && flow_table_init(&ctx -> args -> flows, ctx -> args -> max_flows, err) == -1)
+    {
+        return STATE_ERROR;
+    }
+
+    if (fcntl(ctx -> args -> client_sockfd, F_SETFL, O_NONBLOCK) == -1 ||
+        fcntl(ctx -> args -> server_sockfd, F_SETFL, O_NONBLOCK) == -1 ||
+        fcntl(ctx -> args -> proxy_gui_fd, F_SETFL, O_NONBLOCK) == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        return STATE_ERROR;
+    }
+
+    // with flows the server answers on each flow's own socket, the shared one stays unused
+    if (watch_fd(ctx -> args -> epoll_fd, ctx -> args -> client_sockfd) == -1 ||
+        (ctx -> args -> max_flows == 0 && watch_fd(ctx -> args -> epoll_fd, ctx -> args -> server_sockfd) == -1) ||
+        watch_fd(ctx -> args -> epoll_fd, ctx -> args -> delay_queue.timer_fd) == -1 ||
+        watch_fd(ctx -> args -> epoll_fd, ctx -> args -> proxy_gui_fd) == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        return STATE_ERROR;
+    }
+
+    keyboard_menu_init(&ctx -> args -> keyboard_menu, &ctx -> args -> client_drop_rate,
+                       &ctx -> args -> client_delay_rate, &ctx -> args -> server_drop_rate,
+                       &ctx -> args -> server_delay_rate, &ctx -> args -> corruption_rate);
+
+    // stdin cannot be polled when it is a regular file, the proxy then just runs without the menu
+    watch_fd(ctx -> args -> epoll_fd, STDIN_FILENO);
+
+    return STATE_EVENT_LOOP;
 }
 
-static int listen_client_handler(struct fsm_context *context, struct fsm_error *err)
+static int event_loop_handler(struct fsm_context *context, struct fsm_error *err)
 {
     struct fsm_context *ctx;
+    struct epoll_event events[MAX_EVENTS];
+    int                count;
+
+    ctx = context;
+    SET_TRACE(context, "", "STATE_EVENT_LOOP");
+
+    while (!exit_flag)
+    {
+        // one packet per turn from each side, so a busy direction cannot starve the other
+        if (ctx -> args -> client_ready && !(ctx -> args -> server_ready && ctx -> args -> server_turn))
+        {
+            ctx -> args -> server_turn = TRUE;
+            return STATE_LISTEN_CLIENT;
+        }
+
+        if (ctx -> args -> server_ready)
+        {
+            ctx -> args -> server_turn = FALSE;
+            return STATE_LISTEN_SERVER;
+        }
+
+        // both sockets are drained, push out what was batched before blocking
+        send_queue_flush(&ctx -> args -> server_queue, ctx -> args -> sent_data, err);
+        send_queue_flush(&ctx -> args -> client_queue, ctx -> args -> sent_data, err);
+
+        count = epoll_wait(ctx -> args -> epoll_fd, events, MAX_EVENTS, -1);
+        if (count == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            SET_ERROR(err, strerror(errno));
+            return STATE_ERROR;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            struct flow *owner;
+            int         fd;
+
+            fd = events[i].data.fd;
+            if (fd == ctx -> args -> client_sockfd)
+            {
+                ctx -> args -> client_ready = TRUE;
+            }
+            else if (fd == ctx -> args -> server_sockfd)
+            {
+                ctx -> args -> server_ready = TRUE;
+            }
+            else if (fd == ctx -> args -> delay_queue.timer_fd)
+            {
+                if (release_delayed_packets(ctx, err) == -1)
+                {
+                    return STATE_ERROR;
+                }
+            }
+            else if (fd == ctx -> args -> proxy_gui_fd)
+            {
+                accept_gui(ctx, err);
+            }
+            else if (fd == STDIN_FILENO)
+            {
+                if (keyboard_menu_read(&ctx -> args -> keyboard_menu, STDIN_FILENO) != 0)
+                {
+                    epoll_ctl(ctx -> args -> epoll_fd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+                }
+            }
+            else if ((owner = flow_table_by_fd(&ctx -> args -> flows, fd)) != NULL)
+            {
+                flow_table_mark_ready(&ctx -> args -> flows, owner);
+                ctx -> args -> server_ready = TRUE;
+            }
+        }
+    }
+
+    return STATE_CLEANUP;
+}
+
+static int listen_client_handler(struct fsm_context *context, struct fsm_error *err)
+{
+    struct fsm_context      *ctx;
+    struct sockaddr_storage addr;
     ssize_t result;
 
     ctx = context;
     result = 0;
     SET_TRACE(context, "in connect socket", "STATE_LISTEN_CLIENT");
-    while (!exit_flag)
+    result = receive_packet(ctx->args->client_sockfd, &ctx -> args -> client_batch,
+                            &ctx -> args -> client_packet, &addr,
+                            ctx -> args -> received_data);
+
+    if (result == 1)
     {
-        result = receive_packet(ctx->args->client_sockfd, &ctx->args->client_packet,
-                                ctx -> args -> received_data);
+        ctx -> args -> client_ready = FALSE;
+        return STATE_EVENT_LOOP;
+    }
 
-        if (result == -1)
+    if (result == -1)
+    {
+        return STATE_ERROR;
+    }
+
+    if (ctx -> args -> max_flows > 0)
+    {
+        ctx -> args -> flow = flow_table_find(&ctx -> args -> flows, &addr);
+        if (ctx -> args -> flow == NULL && ctx -> args -> flows.count == ctx -> args -> flows.capacity)
         {
-            return STATE_ERROR;
+            printf("Client packet with seq number: %u ack number: %u flags: %u dropped, flow table is full\n",
+                   ctx -> args -> client_packet -> hd.seq_number, ctx -> args -> client_packet -> hd.ack_number,
+                   ctx -> args -> client_packet -> hd.flags);
+            return STATE_EVENT_LOOP;
         }
-        printf("Client packet with seq number: %u ack number: %u flags: %u received\n",
-               ctx -> args -> client_packet.hd.seq_number, ctx -> args -> client_packet.hd.ack_number,
-               ctx -> args -> client_packet.hd.flags);
 
-        if (ctx -> args -> is_connected_gui)
+        if (ctx -> args -> flow == NULL)
         {
-            send_stats_gui(ctx -> args -> connected_gui_fd, RECEIVED_PACKET);
+            ctx -> args -> flow = open_flow(ctx, &addr, err);
+            if (ctx -> args -> flow == NULL)
+            {
+                return STATE_ERROR;
+            }
         }
 
-        return STATE_CLIENT_CALCULATE_LOSSINESS;
+        ctx -> args -> flow -> client_received++;
     }
 
-    return STATE_CLEANUP;
+    printf("Client packet with seq number: %u ack number: %u flags: %u received\n",
+           ctx -> args -> client_packet -> hd.seq_number, ctx -> args -> client_packet -> hd.ack_number,
+           ctx -> args -> client_packet -> hd.flags);
+    size_for_window(ctx, ctx -> args -> client_packet);
+    report_kernel_drops(ctx);
+
+    if (ctx -> args -> is_connected_gui)
+    {
+        send_stats_gui(ctx -> args -> connected_gui_fd, RECEIVED_PACKET);
+    }
+
+    return STATE_CLIENT_CALCULATE_LOSSINESS;
 }
 
 static int calculate_client_lossiness_handler(struct fsm_context *context, struct fsm_error *err)
@@ -397,7 +717,7 @@ static int calculate_client_lossiness_handler(struct fsm_context *context, struc
     int                     result;
     ctx = context;
     SET_TRACE(context, "", "STATE_CLIENT_CALCULATE_LOSSINESS");
-    result = calculate_lossiness(ctx -> args -> client_drop_rate, ctx -> args -> client_delay_rate, ctx -> args -> corruption_rate);
+    result = calculate_lossiness(route_impairment(ctx, CLIENT_ROUTE), ctx -> args -> client_drop_rate, ctx -> args -> client_delay_rate, ctx -> args -> corruption_rate);
     if (result == DROP)
     {
         return STATE_CLIENT_DROP;
@@ -421,47 +741,49 @@ static int client_drop_packet_handler(struct fsm_context *context, struct fsm_er
     SET_TRACE(context, "", "STATE_CLIENT_DROP");
 
     printf("Client packet with seq number: %u ack number: %u flags: %u dropped\n",
-           ctx -> args -> client_packet.hd.seq_number, ctx -> args -> client_packet.hd.ack_number,
-           ctx -> args -> client_packet.hd.flags);
+           ctx -> args -> client_packet -> hd.seq_number, ctx -> args -> client_packet -> hd.ack_number,
+           ctx -> args -> client_packet -> hd.flags);
 
     if (ctx -> args -> is_connected_gui)
     {
         send_stats_gui(ctx -> args -> connected_gui_fd, DROPPED_CLIENT_PACKET);
     }
 
-    return STATE_LISTEN_CLIENT;
+    return STATE_EVENT_LOOP;
 }
 
 static int client_delay_packet_handler(struct fsm_context *context, struct fsm_error *err)
 {
     struct fsm_context *ctx;
-    pthread_t *temp_thread_pool;
+    int                result;
+    uint64_t           held;
 
     ctx = context;
-    temp_thread_pool = ctx -> args -> thread_pool;
     SET_TRACE(context, "", "STATE_CLIENT_DELAY_PACKET");
-    printf("Client packet with seq number: %u ack number: %u flags: %u delayed\n", ctx -> args -> client_packet.hd.seq_number, ctx -> args -> client_packet.hd.ack_number, ctx -> args -> client_packet.hd.flags);
-
-    pthread_mutex_lock(&num_of_threads_mutex);
-    ctx -> args -> num_of_threads++;
-    temp_thread_pool = (pthread_t *) realloc(temp_thread_pool, sizeof(pthread_t) * ctx -> args -> num_of_threads);
-
-
-    if (temp_thread_pool == NULL)
+    result = hold_packet(ctx, ctx -> args -> client_packet, CLIENT_ROUTE, DELAY_TIME_USEC, &held, err);
+    if (result == -1)
     {
         return STATE_ERROR;
     }
 
-    ctx -> args -> thread_pool = temp_thread_pool;
+    if (result == 1)
+    {
+        printf("Client packet with seq number: %u ack number: %u flags: %u dropped by a full bottleneck queue\n",
+               ctx -> args -> client_packet -> hd.seq_number, ctx -> args -> client_packet -> hd.ack_number,
+               ctx -> args -> client_packet -> hd.flags);
+        return STATE_EVENT_LOOP;
+    }
+
+    printf("Client packet with seq number: %u ack number: %u flags: %u delayed for %" PRIu64 " us\n",
+           ctx -> args -> client_packet -> hd.seq_number, ctx -> args -> client_packet -> hd.ack_number,
+           ctx -> args -> client_packet -> hd.flags, held);
 
-    pthread_create(&ctx->args->thread_pool[ctx->args->num_of_threads], NULL, init_client_delay_thread, (void *) ctx);
-    pthread_mutex_unlock(&num_of_threads_mutex);
     if (ctx -> args -> is_connected_gui)
     {
         send_stats_gui(ctx -> args -> connected_gui_fd, DELAYED_CLIENT_PACKET);
     }
 
-    return STATE_LISTEN_CLIENT;
+    return STATE_EVENT_LOOP;
 }
 
 static int client_corrupt_packet_handler(struct fsm_context *context, struct fsm_error *err)
@@ -471,7 +793,7 @@ static int client_corrupt_packet_handler(struct fsm_context *context, struct fsm
     ctx = context;
     SET_TRACE(context, "", "STATE_CLIENT_CORRUPT");
 
-    if (strlen(ctx -> args -> client_packet.data) == 0)
+    if (strlen(ctx -> args -> client_packet -> data) == 0)
     {
         return STATE_SEND_CLIENT_PACKET;
     }
@@ -482,15 +804,15 @@ static int client_corrupt_packet_handler(struct fsm_context *context, struct fsm
     }
 
     char *temp;
-    temp = strdup(ctx -> args -> client_packet.data);
+    temp = strdup(ctx -> args -> client_packet -> data);
 
-    corrupt_data(&temp, strlen(ctx -> args -> client_packet.data));
+    corrupt_data(&route_impairment(ctx, CLIENT_ROUTE) -> rng, &temp, strlen(ctx -> args -> client_packet -> data));
 
-    strcpy(ctx -> args -> client_packet.data, temp);
+    strcpy(ctx -> args -> client_packet -> data, temp);
 
     printf("Client packet with seq number: %u ack number: %u flags: %u corrupted\n",
-           ctx -> args -> client_packet.hd.seq_number, ctx -> args -> client_packet.hd.ack_number,
-           ctx -> args -> client_packet.hd.flags);
+           ctx -> args -> client_packet -> hd.seq_number, ctx -> args -> client_packet -> hd.ack_number,
+           ctx -> args -> client_packet -> hd.flags);
 
     return STATE_SEND_CLIENT_PACKET;
 }
@@ -503,23 +825,149 @@ static int send_client_packet_handler(struct fsm_context *context, struct fsm_er
     ctx = context;
 
     SET_TRACE(context, "", "STATE_SEND_CLIENT_PACKET");
-    result = send_packet(ctx -> args -> server_sockfd, &ctx -> args -> client_packet,
-                         &ctx -> args -> server_addr_struct, ctx -> args -> sent_data);
+
+    // with path latency or a bottleneck configured every packet waits in the delay queue and goes out when it is released
+    if (impairment_holds(route_impairment(ctx, CLIENT_ROUTE)))
+    {
+        result = hold_packet(ctx, ctx -> args -> client_packet, CLIENT_ROUTE, 0, NULL, err);
+        if (result == -1)
+        {
+            return STATE_ERROR;
+        }
+
+        if (result == 1)
+        {
+            printf("Client packet with seq number: %u ack number: %u flags: %u dropped by a full bottleneck queue\n",
+                   ctx -> args -> client_packet -> hd.seq_number, ctx -> args -> client_packet -> hd.ack_number,
+                   ctx -> args -> client_packet -> hd.flags);
+        }
+
+        return STATE_EVENT_LOOP;
+    }
+
+    result = forward_packet(ctx, ctx -> args -> flow, CLIENT_ROUTE, ctx -> args -> client_packet, err);
     if (result < 0)
     {
         return STATE_ERROR;
     }
 
     printf("Client packet with seq number: %u ack number: %u flags: %u sent\n",
-           ctx -> args -> client_packet.hd.seq_number, ctx -> args -> client_packet.hd.ack_number,
-           ctx -> args -> client_packet.hd.flags);
+           ctx -> args -> client_packet -> hd.seq_number, ctx -> args -> client_packet -> hd.ack_number,
+           ctx -> args -> client_packet -> hd.flags);
 
     if (ctx -> args -> is_connected_gui)
     {
         send_stats_gui(ctx -> args -> connected_gui_fd, SENT_PACKET);
     }
 
-    return STATE_LISTEN_CLIENT;
+    return STATE_EVENT_LOOP;
+}
+
+static int uring_forward_handler(struct fsm_context *context, struct fsm_error *err)
+{
+    struct fsm_context  *ctx;
+    struct uring_event  event;
+    int                 sockfds[2];
+
+    ctx = context;
+    SET_TRACE(context, "", "STATE_URING_FORWARD");
+    sockfds[CLIENT_ROUTE] = ctx -> args -> client_sockfd;
+    sockfds[SERVER_ROUTE] = ctx -> args -> server_sockfd;
+
+    if (uring_init(&ctx -> args -> ring, sockfds, 2, err) == -1)
+    {
+        return STATE_ERROR;
+    }
+
+    while (!exit_flag)
+    {
+        if (uring_submit_and_wait(&ctx -> args -> ring, err) == -1)
+        {
+            uring_destroy(&ctx -> args -> ring);
+            return STATE_ERROR;
+        }
+
+        while (uring_next_event(&ctx -> args -> ring, &event))
+        {
+            if (event.type == URING_RECEIVED)
+            {
+                uring_route_packet(ctx, &event);
+                continue;
+            }
+
+            if (event.result >= 0)
+            {
+                write_stats(ctx -> args -> sent_data, event.pt);
+
+                if (ctx -> args -> is_connected_gui)
+                {
+                    send_stats_gui(ctx -> args -> connected_gui_fd, SENT_PACKET);
+                }
+            }
+
+            uring_release(&ctx -> args -> ring, event.buffer_id);
+        }
+
+        // one flush per wakeup instead of one per packet
+        fflush(ctx -> args -> received_data);
+        fflush(ctx -> args -> sent_data);
+    }
+
+    uring_destroy(&ctx -> args -> ring);
+
+    return STATE_CLEANUP;
+}
+
+static int xdp_forward_handler(struct fsm_context *context, struct fsm_error *err)
+{
+    struct fsm_context      *ctx;
+    struct xdp_frame        frame;
+    struct sockaddr_storage peers[XDP_MAX_ROUTES];
+    uint16_t                ports[XDP_MAX_ROUTES];
+
+    ctx = context;
+    SET_TRACE(context, "", "STATE_XDP_FORWARD");
+    ports[CLIENT_ROUTE] = htons(PROXY_CLIENT_PORT);
+    ports[SERVER_ROUTE] = htons(PROXY_SERVER_PORT);
+    peers[CLIENT_ROUTE] = ctx -> args -> client_addr_struct;
+    peers[SERVER_ROUTE] = ctx -> args -> server_addr_struct;
+
+    if (delay_queue_init(&ctx -> args -> delay_queue, err) == -1 ||
+        xdp_init(&ctx -> args -> xdp, ctx -> args -> xdp_ifname, ctx -> args -> xdp_zerocopy,
+                 &ctx -> args -> proxy_addr_struct, ports, peers, err) == -1)
+    {
+        return STATE_ERROR;
+    }
+
+    while (!exit_flag)
+    {
+        if (xdp_wait(&ctx -> args -> xdp, ctx -> args -> delay_queue.timer_fd, -1, err) == -1 ||
+            release_delayed_packets(ctx, err) == -1)
+        {
+            xdp_destroy(&ctx -> args -> xdp);
+            return STATE_ERROR;
+        }
+
+        for (int i = 0; i < XDP_BATCH_SIZE && xdp_next_frame(&ctx -> args -> xdp, &frame); i++)
+        {
+            if (xdp_route_frame(ctx, &frame, err) == -1)
+            {
+                xdp_destroy(&ctx -> args -> xdp);
+                return STATE_ERROR;
+            }
+        }
+
+        // one kick per wakeup, delayed and unresolved packets still go out through the sockets
+        xdp_flush(&ctx -> args -> xdp);
+        send_queue_flush(&ctx -> args -> server_queue, ctx -> args -> sent_data, err);
+        send_queue_flush(&ctx -> args -> client_queue, ctx -> args -> sent_data, err);
+        fflush(ctx -> args -> received_data);
+        fflush(ctx -> args -> sent_data);
+    }
+
+    xdp_destroy(&ctx -> args -> xdp);
+
+    return STATE_CLEANUP;
 }
 
 static int cleanup_handler(struct fsm_context *context, struct fsm_error *err)
@@ -527,7 +975,35 @@ static int cleanup_handler(struct fsm_context *context, struct fsm_error *err)
     struct fsm_context *ctx;
     ctx = context;
     SET_TRACE(context, "in cleanup handler", "STATE_CLEANUP");
-    pthread_join(ctx -> args -> server_thread, NULL);
+    send_queue_flush(&ctx -> args -> server_queue, ctx -> args -> sent_data, err);
+    send_queue_flush(&ctx -> args -> client_queue, ctx -> args -> sent_data, err);
+    send_queue_destroy(&ctx -> args -> server_queue);
+    send_queue_destroy(&ctx -> args -> client_queue);
+    if (ctx -> args -> client_batch.kernel_drops + ctx -> args -> server_batch.kernel_drops > 0)
+    {
+        printf("%u client and %u server datagrams dropped by the kernel on a full receive buffer\n",
+               ctx -> args -> client_batch.kernel_drops, ctx -> args -> server_batch.kernel_drops);
+    }
+
+    impairment_report(&ctx -> args -> client_impairment, "client");
+    impairment_report(&ctx -> args -> server_impairment, "server");
+    flow_table_report(&ctx -> args -> flows);
+
+    packet_release(ctx -> args -> client_packet);
+    packet_release(ctx -> args -> server_packet);
+    receive_batch_destroy(&ctx -> args -> client_batch);
+    receive_batch_destroy(&ctx -> args -> server_batch);
+    delay_queue_destroy(&ctx -> args -> delay_queue);
+    flow_table_destroy(&ctx -> args -> flows);
+    delay_table_destroy(&ctx -> args -> delay_table);
+    trace_destroy(&ctx -> args -> client_impairment.trace);
+    trace_destroy(&ctx -> args -> server_impairment.trace);
+    packet_pool_destroy(&ctx -> args -> pool);
+
+    if (ctx -> args -> epoll_fd > 0)
+    {
+        close(ctx -> args -> epoll_fd);
+    }
 
     if (ctx -> args -> client_sockfd)
     {
@@ -561,43 +1037,89 @@ static int cleanup_handler(struct fsm_context *context, struct fsm_error *err)
         }
     }
 
+    // an argument error ends the run before the files are created
+    if (ctx -> args -> sent_data != NULL)
+    {
+        fclose(ctx -> args -> sent_data);
+    }
+
+    if (ctx -> args -> received_data != NULL)
+    {
+        fclose(ctx -> args -> received_data);
+    }
 
-    fclose(ctx -> args -> sent_data);
-    fclose(ctx -> args -> received_data);
+    if (ctx -> args -> queue_data != NULL)
+    {
+        fclose(ctx -> args -> queue_data);
+    }
 
     return FSM_EXIT;
 }
 
 static int listen_server_handler(struct fsm_context *context, struct fsm_error *err)
 {
-    struct fsm_context *ctx;
+    struct fsm_context      *ctx;
+    struct receive_batch    *batch;
+    int                     sockfd;
     ssize_t result;
 
     ctx = context;
     result = 0;
     SET_TRACE(context, "", "STATE_LISTEN_SERVER");
-    while (!exit_flag)
+    sockfd  = ctx -> args -> server_sockfd;
+    batch   = &ctx -> args -> server_batch;
+
+    if (ctx -> args -> max_flows > 0)
     {
-        result = receive_packet(ctx->args->server_sockfd, &ctx -> args -> server_packet,
-                                ctx -> args -> received_data);
-        if (result == -1)
+        ctx -> args -> flow = flow_table_ready(&ctx -> args -> flows);
+        if (ctx -> args -> flow == NULL)
         {
-            return STATE_ERROR;
+            ctx -> args -> server_ready = FALSE;
+            return STATE_EVENT_LOOP;
         }
 
-        printf("Server packet with seq number: %u ack number: %u flags: %u received\n",
-               ctx -> args -> server_packet.hd.seq_number, ctx -> args -> server_packet.hd.ack_number,
-               ctx -> args -> server_packet.hd.flags);
+        sockfd  = ctx -> args -> flow -> upstream_fd;
+        batch   = &ctx -> args -> flow -> batch;
+    }
 
-        if (ctx -> args -> is_connected_gui)
-        {
-            send_stats_gui(ctx -> args -> connected_gui_fd, RECEIVED_PACKET);
-        }
+    result = receive_packet(sockfd, batch, &ctx -> args -> server_packet, NULL,
+                            ctx -> args -> received_data);
+
+    // one packet per flow per turn, a flow leaves the ready list once its socket is drained
+    if (ctx -> args -> max_flows > 0)
+    {
+        flow_table_yield(&ctx -> args -> flows, result == 1);
+        ctx -> args -> server_ready = flow_table_ready(&ctx -> args -> flows) != NULL;
+    }
 
-        return STATE_SERVER_CALCULATE_LOSSINESS;
+    if (result == 1)
+    {
+        ctx -> args -> server_ready = ctx -> args -> max_flows > 0 && ctx -> args -> server_ready;
+        return STATE_EVENT_LOOP;
     }
 
-    return FSM_EXIT;
+    if (ctx -> args -> flow != NULL)
+    {
+        ctx -> args -> flow -> server_received++;
+    }
+
+    if (result == -1)
+    {
+        return STATE_ERROR;
+    }
+
+    printf("Server packet with seq number: %u ack number: %u flags: %u received\n",
+           ctx -> args -> server_packet -> hd.seq_number, ctx -> args -> server_packet -> hd.ack_number,
+           ctx -> args -> server_packet -> hd.flags);
+    size_for_window(ctx, ctx -> args -> server_packet);
+    report_kernel_drops(ctx);
+
+    if (ctx -> args -> is_connected_gui)
+    {
+        send_stats_gui(ctx -> args -> connected_gui_fd, RECEIVED_PACKET);
+    }
+
+    return STATE_SERVER_CALCULATE_LOSSINESS;
 }
 
 static int calculate_server_lossiness_handler(struct fsm_context *context, struct fsm_error *err)
@@ -606,7 +1128,7 @@ static int calculate_server_lossiness_handler(struct fsm_context *context, struc
     int                     result;
     ctx = context;
     SET_TRACE(context, "", "STATE_SERVER_CALCULATE_LOSSINESS");
-    result = calculate_lossiness(ctx -> args -> server_drop_rate, ctx -> args -> server_delay_rate, ctx -> args -> corruption_rate);
+    result = calculate_lossiness(route_impairment(ctx, SERVER_ROUTE), ctx -> args -> server_drop_rate, ctx -> args -> server_delay_rate, ctx -> args -> corruption_rate);
     if (result == DROP)
     {
         return STATE_SERVER_DROP;
@@ -636,40 +1158,44 @@ static int server_drop_packet_handler(struct fsm_context *context, struct fsm_er
     }
 
     printf("Server packet with seq number: %u ack number: %u flags: %u dropped\n",
-           ctx -> args -> server_packet.hd.seq_number, ctx -> args -> server_packet.hd.ack_number,
-           ctx -> args -> server_packet.hd.flags);
+           ctx -> args -> server_packet -> hd.seq_number, ctx -> args -> server_packet -> hd.ack_number,
+           ctx -> args -> server_packet -> hd.flags);
 
-    return STATE_LISTEN_SERVER;
+    return STATE_EVENT_LOOP;
 }
 
 static int server_delay_packet_handler(struct fsm_context *context, struct fsm_error *err)
 {
     struct fsm_context *ctx;
-    pthread_t *temp_thread_pool;
+    int                result;
+    uint64_t           held;
 
     ctx = context;
-    temp_thread_pool = ctx -> args -> thread_pool;
     SET_TRACE(context, "", "STATE_SERVER_DELAY_PACKET");
-    pthread_mutex_lock(&num_of_threads_mutex);
-    ctx -> args -> num_of_threads++;
-    temp_thread_pool = (pthread_t *) realloc(temp_thread_pool, sizeof(pthread_t) * ctx -> args -> num_of_threads);
-
-
-    if (temp_thread_pool == NULL)
+    result = hold_packet(ctx, ctx -> args -> server_packet, SERVER_ROUTE, DELAY_TIME_USEC, &held, err);
+    if (result == -1)
     {
         return STATE_ERROR;
     }
 
-    ctx -> args -> thread_pool = temp_thread_pool;
+    if (result == 1)
+    {
+        printf("Server packet with seq number: %u ack number: %u flags: %u dropped by a full bottleneck queue\n",
+               ctx -> args -> server_packet -> hd.seq_number, ctx -> args -> server_packet -> hd.ack_number,
+               ctx -> args -> server_packet -> hd.flags);
+        return STATE_EVENT_LOOP;
+    }
+
+    printf("Server packet with seq number: %u ack number: %u flags: %u delayed for %" PRIu64 " us\n",
+           ctx -> args -> server_packet -> hd.seq_number, ctx -> args -> server_packet -> hd.ack_number,
+           ctx -> args -> server_packet -> hd.flags, held);
 
-    pthread_create(&ctx->args->thread_pool[ctx->args->num_of_threads], NULL, init_server_delay_thread, (void *) ctx);
-    pthread_mutex_unlock(&num_of_threads_mutex);
     if (ctx -> args -> is_connected_gui)
     {
         send_stats_gui(ctx -> args -> connected_gui_fd, DELAYED_SERVER_PACKET);
     }
 
-    return STATE_LISTEN_SERVER;
+    return STATE_EVENT_LOOP;
 }
 
 static int server_corrupt_packet_handler(struct fsm_context *context, struct fsm_error *err)
@@ -679,7 +1205,7 @@ static int server_corrupt_packet_handler(struct fsm_context *context, struct fsm
     ctx = context;
     SET_TRACE(context, "", "");
 
-    if (strlen(ctx -> args -> server_packet.data) == 0)
+    if (strlen(ctx -> args -> server_packet -> data) == 0)
     {
         return STATE_SEND_SERVER_PACKET;
     }
@@ -690,15 +1216,15 @@ static int server_corrupt_packet_handler(struct fsm_context *context, struct fsm
     }
 
     char *temp;
-    temp = strdup(ctx -> args -> client_packet.data);
+    temp = strdup(ctx -> args -> server_packet -> data);
 
-    corrupt_data(&temp, strlen(ctx -> args -> server_packet.data));
+    corrupt_data(&route_impairment(ctx, SERVER_ROUTE) -> rng, &temp, strlen(ctx -> args -> server_packet -> data));
 
-    strcpy(ctx -> args -> server_packet.data, temp);
+    strcpy(ctx -> args -> server_packet -> data, temp);
 
     printf("Server packet with seq number: %u ack number: %u flags: %u corrupted\n",
-           ctx -> args -> server_packet.hd.seq_number, ctx -> args -> server_packet.hd.ack_number,
-           ctx -> args -> server_packet.hd.flags);
+           ctx -> args -> server_packet -> hd.seq_number, ctx -> args -> server_packet -> hd.ack_number,
+           ctx -> args -> server_packet -> hd.flags);
 
     return STATE_SEND_SERVER_PACKET;
 }
@@ -711,8 +1237,25 @@ static int send_server_packet_handler(struct fsm_context *context, struct fsm_er
     ctx = context;
     SET_TRACE(context, "", "STATE_SEND_SERVER_PACKET");
 
-    result = send_packet(ctx -> args -> client_sockfd, &ctx -> args -> server_packet,
-                         &ctx -> args -> client_addr_struct, ctx -> args -> sent_data);
+    if (impairment_holds(route_impairment(ctx, SERVER_ROUTE)))
+    {
+        result = hold_packet(ctx, ctx -> args -> server_packet, SERVER_ROUTE, 0, NULL, err);
+        if (result == -1)
+        {
+            return STATE_ERROR;
+        }
+
+        if (result == 1)
+        {
+            printf("Server packet with seq number: %u ack number: %u flags: %u dropped by a full bottleneck queue\n",
+                   ctx -> args -> server_packet -> hd.seq_number, ctx -> args -> server_packet -> hd.ack_number,
+                   ctx -> args -> server_packet -> hd.flags);
+        }
+
+        return STATE_EVENT_LOOP;
+    }
+
+    result = forward_packet(ctx, ctx -> args -> flow, SERVER_ROUTE, ctx -> args -> server_packet, err);
     if (result < 0)
     {
         return STATE_ERROR;
@@ -724,10 +1267,10 @@ static int send_server_packet_handler(struct fsm_context *context, struct fsm_er
     }
 
     printf("Server packet with seq number: %u ack number: %u flags: %u sent\n",
-           ctx -> args -> server_packet.hd.seq_number, ctx -> args -> server_packet.hd.ack_number,
-           ctx -> args -> server_packet.hd.flags);
+           ctx -> args -> server_packet -> hd.seq_number, ctx -> args -> server_packet -> hd.ack_number,
+           ctx -> args -> server_packet -> hd.flags);
 
-    return STATE_LISTEN_SERVER;
+    return STATE_EVENT_LOOP;
 }
 
 static int error_handler(struct fsm_context *context, struct fsm_error *err)
@@ -744,33 +1287,21 @@ static int read_from_keyboard_handler(struct fsm_context *context, struct fsm_er
     ctx = context;
     SET_TRACE(context, "", "STATE_READ_FROM_KEYBOARD");
 
-    while (!exit_flag)
-    {
-        read_keyboard(&ctx->args->client_drop_rate,&ctx->args->client_delay_rate,
-                      &ctx->args->server_drop_rate, &ctx->args->server_delay_rate, &ctx->args->corruption_rate );
-    }
+    read_keyboard(&ctx->args->client_drop_rate,&ctx->args->client_delay_rate,
+                  &ctx->args->server_drop_rate, &ctx->args->server_delay_rate, &ctx->args->corruption_rate );
 
     return FSM_EXIT;
 }
 
-void *init_server_thread(void *ptr)
+void *init_keyboard_thread(void *ptr)
 {
     struct fsm_context *ctx = (struct fsm_context*) ptr;
     struct fsm_error err;
 
     static struct fsm_transition transitions[] = {
-            {FSM_INIT,                          STATE_LISTEN_SERVER,                listen_server_handler},
-            {STATE_LISTEN_SERVER,               STATE_SERVER_CALCULATE_LOSSINESS,   calculate_server_lossiness_handler},
-            {STATE_SERVER_CALCULATE_LOSSINESS,  STATE_SERVER_DROP,                  server_drop_packet_handler},
-            {STATE_SERVER_CALCULATE_LOSSINESS,  STATE_SERVER_DELAY_PACKET,          server_delay_packet_handler},
-            {STATE_SERVER_CALCULATE_LOSSINESS,  STATE_SERVER_CORRUPT,               server_corrupt_packet_handler},
-            {STATE_SERVER_CALCULATE_LOSSINESS,  STATE_SEND_SERVER_PACKET,           send_server_packet_handler},
-            {STATE_SERVER_DROP,                 STATE_LISTEN_SERVER,                listen_server_handler},
-            {STATE_SERVER_DELAY_PACKET,         STATE_LISTEN_SERVER,                listen_server_handler},
-            {STATE_SERVER_CORRUPT,              STATE_SEND_SERVER_PACKET,           send_server_packet_handler},
-            {STATE_SEND_SERVER_PACKET,          STATE_LISTEN_SERVER,                listen_server_handler},
-            {STATE_LISTEN_SERVER,               FSM_EXIT,                           NULL},
-            {STATE_ERROR,                       FSM_EXIT,                           NULL},
+            {FSM_INIT,                          STATE_READ_FROM_KEYBOARD,   read_from_keyboard_handler},
+            {STATE_READ_FROM_KEYBOARD,          FSM_EXIT,                   NULL},
+            {STATE_ERROR,                       FSM_EXIT,                   NULL},
     };
 
     fsm_run(ctx, &err, transitions);
@@ -778,86 +1309,533 @@ void *init_server_thread(void *ptr)
     return NULL;
 }
 
-void *init_keyboard_thread(void *ptr)
+void *init_gui_function(void *ptr)
 {
     struct fsm_context *ctx = (struct fsm_context*) ptr;
     struct fsm_error err;
 
-    static struct fsm_transition transitions[] = {
-            {FSM_INIT,                          STATE_READ_FROM_KEYBOARD,   read_from_keyboard_handler},
-            {STATE_READ_FROM_KEYBOARD,          FSM_EXIT,                   NULL},
-            {STATE_ERROR,                       FSM_EXIT,                   NULL},
-    };
-
-    fsm_run(ctx, &err, transitions);
+    while(!exit_flag)
+    {
+        ctx->args->connected_gui_fd = socket_accept_connection(ctx->args->proxy_gui_fd, &err);
+        ctx->args->is_connected_gui++;
+    }
 
     return NULL;
 }
 
-void *init_client_delay_thread(void *ptr)
+static void uring_route_packet(struct fsm_context *ctx, const struct uring_event *event)
 {
-    struct fsm_context   *ctx;
-    struct packet        *temp_packet;
+    struct sockaddr_storage *addr;
+    struct impairment       *imp;
+    uint64_t                delay;
+    unsigned int            route;
+    uint8_t                 drop_rate, delay_rate;
+    int                     result, dropped_stat, delayed_stat;
+
+    if (event -> route == CLIENT_ROUTE)
+    {
+        route           = SERVER_ROUTE;
+        addr            = &ctx -> args -> server_addr_struct;
+        imp             = &ctx -> args -> client_impairment;
+        drop_rate       = ctx -> args -> client_drop_rate;
+        delay_rate      = ctx -> args -> client_delay_rate;
+        dropped_stat    = DROPPED_CLIENT_PACKET;
+        delayed_stat    = DELAYED_CLIENT_PACKET;
+    }
+    else
+    {
+        route           = CLIENT_ROUTE;
+        addr            = &ctx -> args -> client_addr_struct;
+        imp             = &ctx -> args -> server_impairment;
+        drop_rate       = ctx -> args -> server_drop_rate;
+        delay_rate      = ctx -> args -> server_delay_rate;
+        dropped_stat    = DROPPED_SERVER_PACKET;
+        delayed_stat    = DELAYED_SERVER_PACKET;
+    }
 
-    ctx                  = (struct fsm_context *) ptr;
-    temp_packet          = &ctx -> args -> client_packet;
+    write_stats(ctx -> args -> received_data, event -> pt);
+    size_for_window(ctx, event -> pt);
 
-    printf("Client packet with seq number: %u ack number: %u flags: %u delayed for %u seconds\n",
-           temp_packet -> hd.seq_number, temp_packet -> hd.ack_number, temp_packet -> hd.flags, DELAY_TIME);
+    if (ctx -> args -> is_connected_gui)
+    {
+        send_stats_gui(ctx -> args -> connected_gui_fd, RECEIVED_PACKET);
+    }
 
-    delay_packet(DELAY_TIME);
-    send_packet(ctx -> args -> server_sockfd, temp_packet, &ctx -> args -> server_addr_struct,
-                ctx -> args -> sent_data);
+    result = calculate_lossiness(imp, drop_rate, delay_rate, ctx -> args -> corruption_rate);
+    if (result == DROP)
+    {
+        uring_release(&ctx -> args -> ring, event -> buffer_id);
 
-    if (ctx -> args -> is_connected_gui)
+        if (ctx -> args -> is_connected_gui)
+        {
+            send_stats_gui(ctx -> args -> connected_gui_fd, dropped_stat);
+        }
+
+        return;
+    }
+
+    if (result == CORRUPT && strnlen(event -> pt -> data, DATA_SIZE) < DATA_SIZE && event -> pt -> data[0] != '\0')
     {
-        send_stats_gui(ctx -> args -> connected_gui_fd, SENT_PACKET);
+        char *temp;
+
+        temp = event -> pt -> data;
+        corrupt_data(&imp -> rng, &temp, strlen(event -> pt -> data));
+        strcpy(event -> pt -> data, temp);
+        free(temp);
+
+        if (ctx -> args -> is_connected_gui)
+        {
+            send_stats_gui(ctx -> args -> connected_gui_fd, CORRUPTED_DATA);
+        }
     }
 
-    printf("Client packet with seq number: %u ack number: %u flags: %u sent\n",
-           temp_packet -> hd.seq_number, temp_packet -> hd.ack_number, temp_packet -> hd.flags);
+    if (result == DELAY && ctx -> args -> is_connected_gui)
+    {
+        send_stats_gui(ctx -> args -> connected_gui_fd, delayed_stat);
+    }
 
-    return NULL;
+    // reordering and duplication work on the delay queue, which this path does not use
+    delay = 0;
+    if (impairment_holds(imp) && schedule_packet(ctx, event -> pt, (int) event -> route, &delay) == -1)
+    {
+        uring_release(&ctx -> args -> ring, event -> buffer_id);
+        return;
+    }
+
+    delay += result == DELAY ? DELAY_TIME_USEC : 0;
+    if (uring_forward(&ctx -> args -> ring, event -> buffer_id, route, addr, delay) == -1)
+    {
+        uring_release(&ctx -> args -> ring, event -> buffer_id);
+    }
 }
 
-void *init_server_delay_thread(void *ptr)
+// -1 only when the delay queue fails, a packet the impairments lose is not an error
+static int xdp_route_frame(struct fsm_context *ctx, const struct xdp_frame *frame, struct fsm_error *err)
 {
-    struct fsm_context   *ctx;
-    struct packet        *temp_packet;
+    struct send_queue       *queue;
+    struct sockaddr_storage *addr;
+    struct impairment       *imp;
+    unsigned int            route;
+    uint8_t                 drop_rate, delay_rate;
+    int                     result, sockfd, dropped_stat, delayed_stat;
+
+    if (frame -> route == CLIENT_ROUTE)
+    {
+        route           = SERVER_ROUTE;
+        queue           = &ctx -> args -> server_queue;
+        sockfd          = ctx -> args -> server_sockfd;
+        addr            = &ctx -> args -> server_addr_struct;
+        imp             = &ctx -> args -> client_impairment;
+        drop_rate       = ctx -> args -> client_drop_rate;
+        delay_rate      = ctx -> args -> client_delay_rate;
+        dropped_stat    = DROPPED_CLIENT_PACKET;
+        delayed_stat    = DELAYED_CLIENT_PACKET;
+    }
+    else
+    {
+        route           = CLIENT_ROUTE;
+        queue           = &ctx -> args -> client_queue;
+        sockfd          = ctx -> args -> client_sockfd;
+        addr            = &ctx -> args -> client_addr_struct;
+        imp             = &ctx -> args -> server_impairment;
+        drop_rate       = ctx -> args -> server_drop_rate;
+        delay_rate      = ctx -> args -> server_delay_rate;
+        dropped_stat    = DROPPED_SERVER_PACKET;
+        delayed_stat    = DELAYED_SERVER_PACKET;
+    }
 
-    ctx                  = (struct fsm_context *) ptr;
-    temp_packet          = &ctx -> args -> server_packet;
+    write_stats(ctx -> args -> received_data, frame -> pt);
 
-    printf("Server packet with seq number: %u ack number: %u flags: %u delayed for %u seconds\n",
-           temp_packet -> hd.seq_number, temp_packet -> hd.ack_number, temp_packet -> hd.flags, DELAY_TIME);
+    if (ctx -> args -> is_connected_gui)
+    {
+        send_stats_gui(ctx -> args -> connected_gui_fd, RECEIVED_PACKET);
+    }
+
+    result = calculate_lossiness(imp, drop_rate, delay_rate, ctx -> args -> corruption_rate);
+    if (result == DROP)
+    {
+        xdp_release(&ctx -> args -> xdp, frame);
+
+        if (ctx -> args -> is_connected_gui)
+        {
+            send_stats_gui(ctx -> args -> connected_gui_fd, dropped_stat);
+        }
+
+        return 0;
+    }
 
-    delay_packet(DELAY_TIME);
-    send_packet(ctx -> args -> client_sockfd, temp_packet, &ctx -> args -> client_addr_struct,
-                ctx -> args -> sent_data);
+    if (result == CORRUPT && strnlen(frame -> pt -> data, DATA_SIZE) < DATA_SIZE && frame -> pt -> data[0] != '\0')
+    {
+        char *temp;
+
+        temp = frame -> pt -> data;
+        corrupt_data(&imp -> rng, &temp, strlen(frame -> pt -> data));
+        strcpy(frame -> pt -> data, temp);
+        free(temp);
+
+        if (ctx -> args -> is_connected_gui)
+        {
+            send_stats_gui(ctx -> args -> connected_gui_fd, CORRUPTED_DATA);
+        }
+    }
+
+    // the UMEM frame cannot be parked while the packet waits, a delayed packet moves to the pool instead
+    if (result == DELAY || impairment_holds(imp))
+    {
+        struct packet   *pt;
+        size_t          length;
+        int             held;
+
+        // an empty pool loses the packet the way a full bottleneck queue does
+        held    = 1;
+        pt      = packet_pool_get(&ctx -> args -> pool);
+        length  = frame -> len - XDP_HEADERS_SIZE;
+        if (pt != NULL)
+        {
+            memset(pt, 0, sizeof(*pt));
+            memcpy(pt, frame -> pt, length < sizeof(*pt) ? length : sizeof(*pt));
+            held = hold_packet(ctx, pt, (int) frame -> route, result == DELAY ? DELAY_TIME_USEC : 0, NULL, err);
+            packet_release(pt);
+        }
+
+        xdp_release(&ctx -> args -> xdp, frame);
+
+        if (held == -1)
+        {
+            return -1;
+        }
+
+        if (held == 1 && ctx -> args -> is_connected_gui)
+        {
+            send_stats_gui(ctx -> args -> connected_gui_fd, dropped_stat);
+        }
+        else if (result == DELAY && ctx -> args -> is_connected_gui)
+        {
+            send_stats_gui(ctx -> args -> connected_gui_fd, delayed_stat);
+        }
+
+        return 0;
+    }
+
+    if (xdp_forward(&ctx -> args -> xdp, frame, route) == -1)
+    {
+        send_queue_push(queue, sockfd, addr, frame -> pt, ctx -> args -> sent_data, err);
+        xdp_release(&ctx -> args -> xdp, frame);
+    }
+    else
+    {
+        write_stats(ctx -> args -> sent_data, frame -> pt);
+    }
 
     if (ctx -> args -> is_connected_gui)
     {
         send_stats_gui(ctx -> args -> connected_gui_fd, SENT_PACKET);
     }
 
-    printf("Server packet with seq number: %u ack number: %u flags: %u sent\n",
-           temp_packet -> hd.seq_number, temp_packet -> hd.ack_number, temp_packet -> hd.flags);
+    return 0;
+}
 
-    return NULL;
+static int watch_fd(int epoll_fd, int fd)
+{
+    struct epoll_event event;
+
+    event.events    = EPOLLIN;
+    event.data.fd   = fd;
+
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
 }
 
-void *init_gui_function(void *ptr)
+// the impairment of the packet being handled, its flow's own when the proxy carries several
+static struct impairment *route_impairment(struct fsm_context *ctx, int route)
+{
+    if (ctx -> args -> flow != NULL)
+    {
+        return route == CLIENT_ROUTE ? &ctx -> args -> flow -> client_impairment : &ctx -> args -> flow -> server_impairment;
+    }
+
+    return route == CLIENT_ROUTE ? &ctx -> args -> client_impairment : &ctx -> args -> server_impairment;
+}
+
+// a new client gets a socket of its own toward the server on an ephemeral proxy port, and a copy of the
+// configured impairments with random streams of its own, so no flow's draws depend on another's traffic
+static struct flow *open_flow(struct fsm_context *ctx, const struct sockaddr_storage *addr, struct fsm_error *err)
+{
+    struct sockaddr_storage local;
+    struct flow             *entry;
+    int                     fd, result;
+
+    fd = socket_create(ctx -> args -> proxy_addr_struct.ss_family, SOCK_DGRAM, 0, err);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    local = ctx -> args -> proxy_addr_struct;
+    if (socket_bind(fd, &local, 0, err) == -1 || fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    entry = flow_table_add(&ctx -> args -> flows, addr, fd, err);
+    if (entry == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    result = receive_batch_init(&entry -> batch, &ctx -> args -> pool, fd, FLOW_BATCH_SIZE, err);
+    if (result == 0 && watch_fd(ctx -> args -> epoll_fd, fd) == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        result = -1;
+    }
+
+    // nothing refers to the flow yet, so it can be taken back out whole
+    if (result == -1)
+    {
+        receive_batch_destroy(&entry -> batch);
+        flow_table_remove_last(&ctx -> args -> flows);
+        close(fd);
+        return NULL;
+    }
+
+    entry -> client_impairment = ctx -> args -> client_impairment;
+    entry -> server_impairment = ctx -> args -> server_impairment;
+
+    // flow n draws from the streams 2n + 2 and 2n + 3 jumps past the seed's, the first two are the defaults
+    entry -> client_impairment.rng = ctx -> args -> next_flow_rng;
+    prng_jump(&ctx -> args -> next_flow_rng);
+    entry -> server_impairment.rng = ctx -> args -> next_flow_rng;
+    prng_jump(&ctx -> args -> next_flow_rng);
+
+    if (ctx -> args -> shared_bottleneck)
+    {
+        entry -> client_impairment.shared_link = &ctx -> args -> client_impairment.link;
+        entry -> server_impairment.shared_link = &ctx -> args -> server_impairment.link;
+    }
+
+    printf("Flow %zu opened for a new client\n", ctx -> args -> flows.count - 1);
+
+    return entry;
+}
+
+// out of the socket toward the packet's destination, through the flow's own upstream socket and to its client
+static int forward_packet(struct fsm_context *ctx, struct flow *current, int route, const struct packet *pt,
+                          struct fsm_error *err)
+{
+    int result;
+
+    if (route == CLIENT_ROUTE)
+    {
+        result = send_queue_push(&ctx -> args -> server_queue,
+                                 current != NULL ? current -> upstream_fd : ctx -> args -> server_sockfd,
+                                 &ctx -> args -> server_addr_struct, pt, ctx -> args -> sent_data, err);
+    }
+    else
+    {
+        result = send_queue_push(&ctx -> args -> client_queue, ctx -> args -> client_sockfd,
+                                 current != NULL ? &current -> client_addr : &ctx -> args -> client_addr_struct,
+                                 pt, ctx -> args -> sent_data, err);
+    }
+
+    if (result == 0 && current != NULL && route == CLIENT_ROUTE)
+    {
+        current -> client_forwarded++;
+    }
+    else if (result == 0 && current != NULL)
+    {
+        current -> server_forwarded++;
+    }
+
+    return result;
+}
+
+// the wait the packet's direction puts on it, -1 when a full bottleneck queue tail-drops it instead
+static int schedule_packet(struct fsm_context *ctx, const struct packet *pt, int route, uint64_t *delay_usec)
+{
+    struct impairment   *imp;
+    int                 result;
+
+    imp     = route_impairment(ctx, route);
+    result  = impairment_schedule(imp, sizeof(*pt), delay_usec);
+
+    if (ctx -> args -> queue_data != NULL && impairment_link(imp) -> rate_bps > 0)
+    {
+        fprintf(ctx -> args -> queue_data, "%s,%" PRIu64 ",%" PRIu64 ",%d\n",
+                route == CLIENT_ROUTE ? "client" : "server",
+                impairment_link(imp) -> backlog_bytes, impairment_link(imp) -> wait_usec, result == -1);
+    }
+
+    if (result == -1 && ctx -> args -> is_connected_gui)
+    {
+        send_stats_gui(ctx -> args -> connected_gui_fd,
+                       route == CLIENT_ROUTE ? DROPPED_CLIENT_PACKET : DROPPED_SERVER_PACKET);
+    }
+
+    return result;
+}
+
+// 1 when the bottleneck tail-dropped the packet, otherwise it is in the delay queue with extra_usec on top;
+// held_usec, when not NULL, gets how long the first copy was scheduled to wait
+static int hold_packet(struct fsm_context *ctx, struct packet *pt, int route,
+                       uint64_t extra_usec, uint64_t *held_usec, struct fsm_error *err)
+{
+    struct impairment   *imp;
+    uint64_t            delay;
+    int                 copies;
+
+    imp     = route_impairment(ctx, route);
+    copies  = impairment_duplicates(imp) ? 2 : 1;
+
+    // a duplicate is one more packet on the path, it takes its own turn at the bottleneck and its own latency
+    for (int i = 0; i < copies; i++)
+    {
+        if (schedule_packet(ctx, pt, route, &delay) == -1)
+        {
+            return i == 0 ? 1 : 0;
+        }
+
+        delay += extra_usec;
+
+        if (i == 0 && held_usec != NULL)
+        {
+            *held_usec = delay;
+        }
+
+        if (impairment_reorders(imp))
+        {
+            if (delay_queue_push(&ctx -> args -> delay_queue, pt, route, ctx -> args -> flow, delay + REORDER_MAX_HOLD_USEC,
+                                 &imp -> reorder.held_order, err) == -1)
+            {
+                return -1;
+            }
+
+            continue;
+        }
+
+        if (delay_queue_push(&ctx -> args -> delay_queue, pt, route, ctx -> args -> flow, delay, NULL, err) == -1)
+        {
+            return -1;
+        }
+
+        if (impairment_overtaken(imp) &&
+            delay_queue_reschedule(&ctx -> args -> delay_queue, imp -> reorder.held_order, delay) == -1)
+        {
+            SET_ERROR(err, strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int release_delayed_packets(struct fsm_context *ctx, struct fsm_error *err)
+{
+    struct packet   *pt;
+    struct flow     *current;
+    int             route;
+
+    while (delay_queue_pop(&ctx -> args -> delay_queue, &pt, &route, &current))
+    {
+        int result;
+
+        result = forward_packet(ctx, current, route, pt, err);
+
+        printf("%s packet with seq number: %u ack number: %u flags: %u sent\n",
+               route == CLIENT_ROUTE ? "Client" : "Server",
+               pt -> hd.seq_number, pt -> hd.ack_number, pt -> hd.flags);
+        packet_release(pt);
+
+        if (result == -1)
+        {
+            return -1;
+        }
+
+        if (ctx -> args -> is_connected_gui)
+        {
+            send_stats_gui(ctx -> args -> connected_gui_fd, SENT_PACKET);
+        }
+    }
+
+    return 0;
+}
+
+// the window only shows up in the headers going by, the buffers follow the largest one seen so far
+static void size_for_window(struct fsm_context *ctx, const struct packet *pt)
 {
-    struct fsm_context *ctx = (struct fsm_context*) ptr;
     struct fsm_error err;
 
-    while(!exit_flag)
+    if (pt -> hd.window_size <= ctx -> args -> window_size)
     {
-        ctx->args->connected_gui_fd = socket_accept_connection(ctx->args->proxy_gui_fd, &err);
-        ctx->args->is_connected_gui++;
+        return;
     }
 
-    return NULL;
+    ctx -> args -> window_size = pt -> hd.window_size;
+
+    if (socket_size_buffers(ctx -> args -> client_sockfd, ctx -> args -> window_size, sizeof(struct packet), &err) == -1 ||
+        socket_size_buffers(ctx -> args -> server_sockfd, ctx -> args -> window_size, sizeof(struct packet), &err) == -1)
+    {
+        fprintf(stderr, "Could not size socket buffers: %s\n", err.err_msg);
+    }
+}
+
+// overflow drops never reach the lossiness decision, so they are reported next to its own drops to tell the two apart
+static void report_kernel_drops(struct fsm_context *ctx)
+{
+    uint32_t total;
+
+    total = ctx -> args -> client_batch.kernel_drops + ctx -> args -> server_batch.kernel_drops;
+    if (!ctx -> args -> is_connected_gui)
+    {
+        ctx -> args -> reported_kernel_drops = total;
+        return;
+    }
+
+    while (ctx -> args -> reported_kernel_drops != total)
+    {
+        ctx -> args -> reported_kernel_drops++;
+        send_stats_gui(ctx -> args -> connected_gui_fd, KERNEL_DROPPED_PACKET);
+    }
+}
+
+static void accept_gui(struct fsm_context *ctx, struct fsm_error *err)
+{
+    int fd;
+
+    fd = socket_accept_connection(ctx -> args -> proxy_gui_fd, err);
+    if (fd == -1)
+    {
+        return;
+    }
+
+    ctx -> args -> connected_gui_fd = fd;
+    ctx -> args -> is_connected_gui++;
+}
+
+static void sigint_handler(int signum)
+{
+    (void) signum;
+    exit_flag = 1;
+}
+
+// no SA_RESTART, a blocked epoll_wait has to come back with EINTR to see the flag
+static int setup_signal_handler(struct fsm_error *err)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigint_handler;
+    sigemptyset(&sa.sa_mask);
+
+    if (sigaction(SIGINT, &sa, NULL) == -1 || sigaction(SIGTERM, &sa, NULL) == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+    return 0;
 }
 
 int create_file(const char *filepath, FILE **fp, struct fsm_error *err)
@@ -0,0 +1,90 @@
+#include "packet_pool.h"
+#include <errno.h>
+#include <string.h>
+
+int packet_pool_init(struct packet_pool *pool, size_t count, struct fsm_error *err)
+{
+    pool -> free_list = NULL;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        struct pooled_packet *entry;
+
+        entry = malloc(sizeof(*entry));
+        if (entry == NULL)
+        {
+            packet_pool_destroy(pool);
+            SET_ERROR(err, strerror(errno));
+            return -1;
+        }
+
+        entry -> pool       = pool;
+        entry -> next       = pool -> free_list;
+        pool -> free_list   = entry;
+    }
+
+    return 0;
+}
+
+struct packet *packet_pool_get(struct packet_pool *pool)
+{
+    struct pooled_packet *entry;
+
+    entry = pool -> free_list;
+    if (entry != NULL)
+    {
+        pool -> free_list   = entry -> next;
+    }
+    else
+    {
+        // everything is still referenced, grow instead of stalling the receive path
+        entry = malloc(sizeof(*entry));
+        if (entry == NULL)
+        {
+            return NULL;
+        }
+
+        entry -> pool       = pool;
+    }
+
+    entry -> refcount       = 1;
+    entry -> next           = NULL;
+
+    return &entry -> pt;
+}
+
+void packet_hold(struct packet *pt)
+{
+    ((struct pooled_packet *) pt) -> refcount++;
+}
+
+void packet_release(struct packet *pt)
+{
+    struct pooled_packet *entry;
+
+    if (pt == NULL)
+    {
+        return;
+    }
+
+    entry = (struct pooled_packet *) pt;
+    if (--entry -> refcount > 0)
+    {
+        return;
+    }
+
+    entry -> next                   = entry -> pool -> free_list;
+    entry -> pool -> free_list      = entry;
+}
+
+void packet_pool_destroy(struct packet_pool *pool)
+{
+    struct pooled_packet *entry;
+
+    while (pool -> free_list != NULL)
+    {
+        entry               = pool -> free_list;
+        pool -> free_list   = entry -> next;
+        free(entry);
+    }
+}
@@ -0,0 +1,107 @@
+#include "prng.h"
+#include <math.h>
+
+static uint64_t rotl(uint64_t x, int k);
+static uint64_t splitmix64(uint64_t *state);
+
+// splitmix64 spreads the seed over all four words, xoshiro must never start from all zeroes
+void prng_seed(struct prng *rng, uint64_t seed)
+{
+    for (size_t i = 0; i < 4; i++)
+    {
+        rng -> s[i] = splitmix64(&seed);
+    }
+}
+
+// advances by 2^128 draws, so a copy of a state jumped once gives a stream that cannot overlap the original
+void prng_jump(struct prng *rng)
+{
+    static const uint64_t   jump[] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                      0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+    uint64_t                s[4] = {0, 0, 0, 0};
+
+    for (size_t i = 0; i < sizeof(jump) / sizeof(jump[0]); i++)
+    {
+        for (int b = 0; b < 64; b++)
+        {
+            if (jump[i] & (1ULL << b))
+            {
+                for (size_t j = 0; j < 4; j++)
+                {
+                    s[j] ^= rng -> s[j];
+                }
+            }
+
+            prng_next(rng);
+        }
+    }
+
+    for (size_t j = 0; j < 4; j++)
+    {
+        rng -> s[j] = s[j];
+    }
+}
+
+uint64_t prng_next(struct prng *rng)
+{
+    uint64_t result, t;
+
+    result      = rotl(rng -> s[1] * 5, 7) * 9;
+    t           = rng -> s[1] << 17;
+
+    rng -> s[2] ^= rng -> s[0];
+    rng -> s[3] ^= rng -> s[1];
+    rng -> s[1] ^= rng -> s[2];
+    rng -> s[0] ^= rng -> s[3];
+    rng -> s[2] ^= t;
+    rng -> s[3] = rotl(rng -> s[3], 45);
+
+    return result;
+}
+
+// Lemire's multiply and shift instead of a modulo; the draws whose low half falls under 2^32 mod bound are the
+// ones that would bias it, they are redrawn, which happens with a chance below bound / 2^32
+uint32_t prng_below(struct prng *rng, uint32_t bound)
+{
+    uint64_t product;
+    uint32_t threshold;
+
+    if (bound == 0)
+    {
+        return 0;
+    }
+
+    product = (prng_next(rng) >> 32) * bound;
+    if ((uint32_t) product < bound)
+    {
+        threshold = (uint32_t) (0 - bound) % bound;
+        while ((uint32_t) product < threshold)
+        {
+            product = (prng_next(rng) >> 32) * bound;
+        }
+    }
+
+    return (uint32_t) (product >> 32);
+}
+
+// 53 random bits with the lowest forced on, so the result is never exactly 0 or 1
+double prng_uniform(struct prng *rng)
+{
+    return ldexp((double) ((prng_next(rng) >> 11) | 1), -53);
+}
+
+static uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t splitmix64(uint64_t *state)
+{
+    uint64_t z;
+
+    z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+    return z ^ (z >> 31);
+}
@@ -1,16 +1,34 @@
 #include "proxy_config.h"
+#include "packet_pool.h"
 
-int random_number(size_t upperbound)
+static void set_rate(const char *line, uint8_t *rate, const char *name);
+static void print_menu(const struct keyboard_menu *menu);
+
+int random_number(struct prng *rng, size_t upperbound)
 {
-    return upperbound == 0 ? 0 : rand() % upperbound;
+    return upperbound == 0 ? 0 : (int) prng_below(rng, (uint32_t) upperbound);
 }
 
-int calculate_lossiness(uint8_t drop_rate, uint8_t delay_rate, uint8_t corruption_rate)
+int calculate_lossiness(struct impairment *imp, uint8_t drop_rate, uint8_t delay_rate, uint8_t corruption_rate)
 {
-    printf("delay: %u drop %u corruption: %u\n", delay_rate, drop_rate, corruption_rate);
+    int replayed;
+
+    // a recorded trace decides the packet's fate on its own
+    replayed = impairment_replay(imp);
+    if (replayed != -1)
+    {
+        return replayed;
+    }
+
+    // the loss model runs on every packet, its state would not move otherwise
+    if (impairment_drops(imp))
+    {
+        return DROP;
+    }
+
     if (drop_rate > 0)
     {
-        if (calculate_drop(drop_rate))
+        if (calculate_drop(&imp -> rng, drop_rate))
         {
             return DROP;
         }
@@ -18,7 +36,7 @@ int calculate_lossiness(uint8_t drop_rate, uint8_t delay_rate, uint8_t corruptio
 
     if (delay_rate > 0)
     {
-        if (calculate_delay(delay_rate))
+        if (calculate_delay(&imp -> rng, delay_rate))
         {
             return DELAY;
         }
@@ -26,7 +44,7 @@ int calculate_lossiness(uint8_t drop_rate, uint8_t delay_rate, uint8_t corruptio
 
     if (corruption_rate > 0)
     {
-        if (calculate_corruption(corruption_rate))
+        if (calculate_corruption(&imp -> rng, corruption_rate))
         {
             return CORRUPT;
         }
@@ -35,26 +53,26 @@ int calculate_lossiness(uint8_t drop_rate, uint8_t delay_rate, uint8_t corruptio
     return SEND;
 }
 
-int calculate_drop(uint8_t percentage)
+int calculate_drop(struct prng *rng, uint8_t percentage)
 {
     int rand;
-    rand = random_number(101);
+    rand = random_number(rng, 101);
 
     return rand > percentage ? FALSE : TRUE;
 }
 
-int calculate_delay(uint8_t percentage)
+int calculate_delay(struct prng *rng, uint8_t percentage)
 {
     int rand;
-    rand = random_number(101);
+    rand = random_number(rng, 101);
 
     return rand > percentage ? FALSE : TRUE;
 }
 
-int calculate_corruption(uint8_t percentage)
+int calculate_corruption(struct prng *rng, uint8_t percentage)
 {
     int rand;
-    rand = random_number(101);
+    rand = random_number(rng, 101);
 
     return rand > percentage ? FALSE : TRUE;
 }
@@ -76,175 +94,274 @@ int send_packet(int sockfd, packet *pt, struct sockaddr_storage *addr, FILE *fp)
     return 0;
 }
 
-int receive_packet(int sockfd, struct packet *pt, FILE *fp)
+int receive_packet(int sockfd, struct receive_batch *batch, struct packet **pt,
+                   struct sockaddr_storage *addr, FILE *fp)
 {
-    struct sockaddr_storage     client_addr;
-    socklen_t                   client_addr_len;
-    struct packet               temp_pt;
-    ssize_t                     result;
+    struct packet               *received;
+
+    received = receive_batch_next(batch, sockfd, addr);
 
-    client_addr_len = sizeof(client_addr);
-    result = recvfrom(sockfd, &temp_pt, sizeof(temp_pt), 0, (struct sockaddr *) &client_addr, &client_addr_len);
+    if (received == NULL && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return 1;
+    }
 
-    if (result == -1)
+    if (received == NULL)
     {
         printf("Error: %s\n", strerror(errno));
         return -1;
     }
 
-    *pt = temp_pt;
-    write_stats_to_file(fp, pt);
+    // the previous packet is dropped here unless the delay queue still holds it
+    packet_release(*pt);
+    *pt = received;
+
+    write_stats_to_file(fp, *pt);
 
     return 0;
 }
 
-void delay_packet(uint8_t delay_time)
+socklen_t size_of_address(struct sockaddr_storage *addr)
 {
-    sleep(delay_time);
+    return addr->ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
 }
 
-socklen_t size_of_address(struct sockaddr_storage *addr)
+void read_keyboard(uint8_t *client_drop, uint8_t *client_delay, uint8_t *server_drop, uint8_t *server_delay, uint8_t *corruption_rate)
 {
-    return addr->ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+    struct keyboard_menu    menu;
+    char                    buf[128];
+
+    keyboard_menu_init(&menu, client_drop, client_delay, server_drop, server_delay, corruption_rate);
+
+    while (fgets(buf, sizeof(buf), stdin) != NULL)
+    {
+        if (keyboard_menu_input(&menu, buf) == 1)
+        {
+            return;
+        }
+    }
+}
+
+void keyboard_menu_init(struct keyboard_menu *menu, uint8_t *client_drop, uint8_t *client_delay,
+                        uint8_t *server_drop, uint8_t *server_delay, uint8_t *corruption_rate)
+{
+    menu -> level           = MENU_MAIN;
+    menu -> length          = 0;
+    menu -> client_drop     = client_drop;
+    menu -> client_delay    = client_delay;
+    menu -> server_drop     = server_drop;
+    menu -> server_delay    = server_delay;
+    menu -> corruption_rate = corruption_rate;
+
+    print_menu(menu);
 }
 
-void read_keyboard(uint8_t *client_drop, uint8_t *client_delay, uint8_t *server_drop, uint8_t *server_delay, uint8_t *corruption_rate) {
-    int first_menu;
-    int second_menu;
-    int third_menu;
-    char menu[200];
-    char client_menu[100];
-
-    snprintf(menu, sizeof (menu), "\nDynamic Proxy Lossiness Value:\n"
-                                  "1. Client Losiness\n"
-                                  "2. Server Losiness\n"
-                                  "3. Data Corruption\n"
-                                  "4. Exit\n"
-                                  "Enter your Answer: ");
-
-    snprintf(client_menu, sizeof (client_menu), "Client Drop and Delay rate:\n"
-                                  "1. Drop Rate\n"
-                                  "2. Delay Rate\n"
-                                  "3. Back\n"
-                                  "Enter your Answer: ");
-    do {
-        printf("%s", menu);
-        first_menu = read_menu(4);
-        switch (first_menu)
+// -1 once stdin is closed, 1 once the menu was exited; either way the caller stops reading
+int keyboard_menu_read(struct keyboard_menu *menu, int fd)
+{
+    ssize_t result;
+    char    *newline;
+
+    result = read(fd, menu -> line + menu -> length, sizeof(menu -> line) - 1 - menu -> length);
+    if (result <= 0)
+    {
+        return -1;
+    }
+
+    menu -> length += (size_t) result;
+
+    // only whole lines are answers, a partial one waits for the next read
+    while ((newline = memchr(menu -> line, '\n', menu -> length)) != NULL)
+    {
+        char    line[sizeof(menu -> line)];
+        size_t  line_length;
+
+        line_length = (size_t) (newline - menu -> line) + 1;
+        memcpy(line, menu -> line, line_length);
+        line[line_length] = '\0';
+
+        memmove(menu -> line, menu -> line + line_length, menu -> length - line_length);
+        menu -> length -= line_length;
+
+        if (keyboard_menu_input(menu, line) == 1)
         {
-            case 1:
-                printf("%d\n", first_menu);
-                do
-                {
-                    printf("%s", client_menu);
-                    second_menu = read_menu(3);
-                    switch (second_menu)
-                    {
-                        case 1:
-                            printf("Enter Client's Drop Rate: ");
-                            int drop =  read_menu(100);
-                            if(drop == -1)
-                            {
-                                printf("Client's Drop Rate value should be between 0-100!\n");
-                                break;
-                            }
-                            *client_drop = (uint8_t) drop;
-                            break;
-                        case 2:
-                            printf("Enter Client's Delay Rate: ");
-                            int delay =read_menu(100);
-                            if(delay == -1)
-                            {
-                                printf("Client's Delay Rate value should be between 0-100!\n");
-                                break;
-                            }
-                            *client_delay = (uint8_t) delay;
-                            break;
-                        case 3:
-                            break;
-                        case -1:
-                            printf("It is not valid, try again\n");
-                        default:
-                            break;
-                    }
-                }
-                while(second_menu != 3);
-                break;
-            case 2:
-                do
-                {
-                    printf("Server Drop and Delay rate:\n");
-                    printf("1. Drop Rate \n");
-                    printf("2. Delay Rate \n");
-                    printf("3. Back \n");
-                    printf("Enter your Answer: ");
-                    third_menu = read_menu(3);
-                    switch (third_menu)
-                    {
-                        case 1:
-                            printf("Enter Server's Drop Rate: ");
-                            int drop =  read_menu(100);
-                            if(drop == -1)
-                            {
-                                printf("Server's Drop Rate value should be between 0-100!\n");
-                                break;
-                            }
-                            *server_drop = (uint8_t) drop;
-                            break;
-
-                        case 2:
-                            printf("Enter Server's Delay Rate: ");
-                            int delay =read_menu(100);
-                            if(delay == -1)
-                            {
-                                printf("Server's Delay Rate value should be between 0-100!\n");
-                                break;
-                            }
-                            *server_delay = (uint8_t) delay;
-                            break;
-
-                        case 3:
-                            break;
-                        case -1:
-                            printf("It is not valid, try again\n\n");
-                            break;
-                        default:
-                            break;
-                    }
-                }while(third_menu != 3);
-                break;
-            case 3:
-                printf("Enter Data Corruption's Rate: ");
-                int rate =  read_menu(100);
-                if(rate == -1)
-                {
-                    printf("Data Corruption's Rate value should be between 0-100!\n");
-                    break;
-                }
-                *corruption_rate = (uint8_t) rate;
-                break;
-            case 4:
-                return;
-            case -1:
-                printf("It is not valid, try again\n");
-            default:
-                break;
+            return 1;
         }
-    } while (1);
+    }
+
+    if (menu -> length == sizeof(menu -> line) - 1)
+    {
+        menu -> length = 0;
+    }
+
+    return 0;
+}
+
+// 1 when the answer was to exit the menu, the rates keep the values they have
+int keyboard_menu_input(struct keyboard_menu *menu, const char *line)
+{
+    int value;
+
+    switch (menu -> level)
+    {
+        case MENU_MAIN:
+            value = parse_menu(line, 4);
+            if (value == 1)
+            {
+                printf("%d\n", value);
+                menu -> level = MENU_CLIENT;
+            }
+            else if (value == 2)
+            {
+                menu -> level = MENU_SERVER;
+            }
+            else if (value == 3)
+            {
+                menu -> level = MENU_CORRUPTION;
+            }
+            else if (value == 4)
+            {
+                return 1;
+            }
+            else if (value == -1)
+            {
+                printf("It is not valid, try again\n");
+            }
+            break;
+        case MENU_CLIENT:
+        case MENU_SERVER:
+            value = parse_menu(line, 3);
+            if (value == 1)
+            {
+                menu -> level = menu -> level == MENU_CLIENT ? MENU_CLIENT_DROP : MENU_SERVER_DROP;
+            }
+            else if (value == 2)
+            {
+                menu -> level = menu -> level == MENU_CLIENT ? MENU_CLIENT_DELAY : MENU_SERVER_DELAY;
+            }
+            else if (value == 3)
+            {
+                menu -> level = MENU_MAIN;
+            }
+            else if (value == -1)
+            {
+                printf("It is not valid, try again\n%s", menu -> level == MENU_SERVER ? "\n" : "");
+            }
+            break;
+        case MENU_CLIENT_DROP:
+            set_rate(line, menu -> client_drop, "Client's Drop Rate");
+            menu -> level = MENU_CLIENT;
+            break;
+        case MENU_CLIENT_DELAY:
+            set_rate(line, menu -> client_delay, "Client's Delay Rate");
+            menu -> level = MENU_CLIENT;
+            break;
+        case MENU_SERVER_DROP:
+            set_rate(line, menu -> server_drop, "Server's Drop Rate");
+            menu -> level = MENU_SERVER;
+            break;
+        case MENU_SERVER_DELAY:
+            set_rate(line, menu -> server_delay, "Server's Delay Rate");
+            menu -> level = MENU_SERVER;
+            break;
+        case MENU_CORRUPTION:
+            set_rate(line, menu -> corruption_rate, "Data Corruption's Rate");
+            menu -> level = MENU_MAIN;
+            break;
+        default:
+            menu -> level = MENU_MAIN;
+            break;
+    }
+
+    print_menu(menu);
+
+    return 0;
+}
+
+static void set_rate(const char *line, uint8_t *rate, const char *name)
+{
+    int value;
+
+    value = parse_menu(line, 100);
+    if (value == -1)
+    {
+        printf("%s value should be between 0-100!\n", name);
+        return;
+    }
+
+    *rate = (uint8_t) value;
+}
+
+static void print_menu(const struct keyboard_menu *menu)
+{
+    switch (menu -> level)
+    {
+        case MENU_MAIN:
+            printf("\nDynamic Proxy Lossiness Value:\n"
+                   "1. Client Losiness\n"
+                   "2. Server Losiness\n"
+                   "3. Data Corruption\n"
+                   "4. Exit\n"
+                   "Enter your Answer: ");
+            break;
+        case MENU_CLIENT:
+            printf("Client Drop and Delay rate:\n"
+                   "1. Drop Rate\n"
+                   "2. Delay Rate\n"
+                   "3. Back\n"
+                   "Enter your Answer: ");
+            break;
+        case MENU_SERVER:
+            printf("Server Drop and Delay rate:\n"
+                   "1. Drop Rate \n"
+                   "2. Delay Rate \n"
+                   "3. Back \n"
+                   "Enter your Answer: ");
+            break;
+        case MENU_CLIENT_DROP:
+            printf("Enter Client's Drop Rate: ");
+            break;
+        case MENU_CLIENT_DELAY:
+            printf("Enter Client's Delay Rate: ");
+            break;
+        case MENU_SERVER_DROP:
+            printf("Enter Server's Drop Rate: ");
+            break;
+        case MENU_SERVER_DELAY:
+            printf("Enter Server's Delay Rate: ");
+            break;
+        case MENU_CORRUPTION:
+            printf("Enter Data Corruption's Rate: ");
+            break;
+        default:
+            break;
+    }
+
+    // the prompt has no newline, and nothing else flushes stdout before the next answer arrives
+    fflush(stdout);
 }
 
 int read_menu(int upperbound)
 {
     char buf[128];
-    errno = 0;
-    fgets(buf, 128, stdin);
 
+    if (fgets(buf, 128, stdin) == NULL)
+    {
+        return -1;
+    }
+
+    return parse_menu(buf, upperbound);
+}
+
+int parse_menu(const char *buf, int upperbound)
+{
     char            *endptr;
-    int temp = (int)strtol(buf, &endptr, 10);
+    int             temp;
+
+    errno = 0;
+    temp = (int)strtol(buf, &endptr, 10);
     if (errno != 0)
     {
-//        SET_ERROR(err, strerror(errno));
-
         return -1;
     }
 
@@ -263,7 +380,7 @@ int read_menu(int upperbound)
     return (int) temp ;
 }
 
-int corrupt_data(char **data, size_t length)
+int corrupt_data(struct prng *rng, char **data, size_t length)
 {
     char *temp;
 
@@ -274,8 +391,8 @@ int corrupt_data(char **data, size_t length)
         int rbyte;
         int rbit;
 
-        rbyte   = random_number(length);
-        rbit    = random_number(8);
+        rbyte   = random_number(rng, length);
+        rbit    = random_number(rng, 8);
 
         temp[rbyte] ^= 1 << rbit;
     }
@@ -287,14 +404,21 @@ int corrupt_data(char **data, size_t length)
 
 int write_stats_to_file(FILE *fp, const struct packet *pt)
 {
-    fprintf(fp, "%u,%u,%u,%u,%u,%s\n",
+    write_stats(fp, pt);
+    fflush(fp);
+
+    return 0;
+}
+
+int write_stats(FILE *fp, const struct packet *pt)
+{
+    fprintf(fp, "%u,%u,%u,%u,%u,%.*s\n",
             pt -> hd.seq_number,
             pt -> hd.ack_number,
             pt -> hd.flags,
             pt -> hd.window_size,
             pt -> hd.checksum,
-            pt -> data);
-    fflush(fp);
+            DATA_SIZE, pt -> data);
 
     return 0;
 }
@@ -0,0 +1,214 @@
+#include "receive_batch.h"
+#include "packet_pool.h"
+#include <errno.h>
+#include <string.h>
+
+static ssize_t refill(struct receive_batch *batch, int sockfd);
+static int resegment(struct receive_batch *batch, size_t length, size_t segment_size);
+
+// size is at most RECEIVE_BATCH_SIZE, a smaller batch trades reads per wakeup for pooled packets held
+int receive_batch_init(struct receive_batch *batch, struct packet_pool *pool, int sockfd,
+                       size_t size, struct fsm_error *err)
+{
+    int on;
+
+    memset(batch -> packets, 0, sizeof(batch -> packets));
+    batch -> pool           = pool;
+    batch -> size           = size < RECEIVE_BATCH_SIZE ? size : RECEIVE_BATCH_SIZE;
+    batch -> count          = 0;
+    batch -> next           = 0;
+    batch -> kernel_drops   = 0;
+
+    on = 1;
+
+#ifdef UDP_GRO
+    // best effort, a kernel without GRO returns one datagram per recvmsg; anything else is a bad socket.
+    // a coalesced read can carry RECEIVE_BATCH_SIZE segments, so a smaller batch reads them one at a time
+    if (batch -> size == RECEIVE_BATCH_SIZE &&
+        setsockopt(sockfd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == -1 && errno != ENOPROTOOPT)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+#endif
+
+    // best effort as well, the drop counter then just stays at zero
+    setsockopt(sockfd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+
+    return 0;
+}
+
+struct packet *receive_batch_next(struct receive_batch *batch, int sockfd, struct sockaddr_storage *addr)
+{
+    struct packet *pt;
+
+    if (batch -> next >= batch -> count && refill(batch, sockfd) == -1)
+    {
+        return NULL;
+    }
+
+    // the caller takes over the batch's reference
+    pt                                  = batch -> packets[batch -> next];
+    batch -> packets[batch -> next++]   = NULL;
+
+    if (addr != NULL)
+    {
+        *addr = batch -> addr;
+    }
+
+    return pt;
+}
+
+int receive_batch_pending(const struct receive_batch *batch)
+{
+    return batch -> next < batch -> count;
+}
+
+void receive_batch_destroy(struct receive_batch *batch)
+{
+    for (size_t i = 0; i < RECEIVE_BATCH_SIZE; i++)
+    {
+        packet_release(batch -> packets[i]);
+        batch -> packets[i] = NULL;
+    }
+
+    batch -> count  = 0;
+    batch -> next   = 0;
+}
+
+static ssize_t refill(struct receive_batch *batch, int sockfd)
+{
+    struct msghdr       msg;
+    struct cmsghdr      *cmsg;
+    ssize_t             result;
+    size_t              segment_size;
+    union
+    {
+        char            buf[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(uint32_t))];
+        struct cmsghdr  align;
+    } control;
+
+    // every slot handed out last time gets a fresh pooled packet, the kernel scatters into them directly
+    for (size_t i = 0; i < batch -> size; i++)
+    {
+        if (batch -> packets[i] == NULL)
+        {
+            batch -> packets[i] = packet_pool_get(batch -> pool);
+            if (batch -> packets[i] == NULL)
+            {
+                errno = ENOMEM;
+                return -1;
+            }
+        }
+
+        batch -> iovs[i].iov_base   = batch -> packets[i];
+        batch -> iovs[i].iov_len    = sizeof(struct packet);
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name            = &batch -> addr;
+    msg.msg_namelen         = sizeof(batch -> addr);
+    msg.msg_iov             = batch -> iovs;
+    msg.msg_iovlen          = batch -> size;
+    msg.msg_control         = control.buf;
+    msg.msg_controllen      = sizeof(control.buf);
+
+    result = recvmsg(sockfd, &msg, 0);
+    if (result == -1)
+    {
+        return -1;
+    }
+
+    segment_size            = (size_t) result;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg -> cmsg_level == SOL_SOCKET && cmsg -> cmsg_type == SO_RXQ_OVFL)
+        {
+            memcpy(&batch -> kernel_drops, CMSG_DATA(cmsg), sizeof(batch -> kernel_drops));
+        }
+
+#ifdef UDP_GRO
+        if (cmsg -> cmsg_level == SOL_UDP && cmsg -> cmsg_type == UDP_GRO)
+        {
+            int size;
+
+            memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+            if (size > 0)
+            {
+                segment_size = (size_t) size;
+            }
+        }
+#endif
+    }
+
+    batch -> next           = 0;
+
+    // peers send whole packets, so each segment already sits in its own pooled packet
+    if (segment_size == sizeof(struct packet) || (size_t) result <= sizeof(struct packet))
+    {
+        batch -> count      = ((size_t) result + sizeof(struct packet) - 1) / sizeof(struct packet);
+        batch -> count      = batch -> count == 0 ? 1 : batch -> count;
+        return result;
+    }
+
+    if (resegment(batch, (size_t) result, segment_size) == -1)
+    {
+        return -1;
+    }
+
+    return result;
+}
+
+// odd-sized segments straddle the pooled packets, copy each one out into a packet of its own
+static int resegment(struct receive_batch *batch, size_t length, size_t segment_size)
+{
+    struct packet   *segments[RECEIVE_BATCH_SIZE];
+    size_t          count, offset;
+
+    count = 0;
+    for (offset = 0; offset < length && count < RECEIVE_BATCH_SIZE; offset += segment_size)
+    {
+        size_t copied, size;
+
+        segments[count] = packet_pool_get(batch -> pool);
+        if (segments[count] == NULL)
+        {
+            while (count > 0)
+            {
+                packet_release(segments[--count]);
+            }
+
+            errno = ENOMEM;
+            return -1;
+        }
+
+        size = length - offset < segment_size ? length - offset : segment_size;
+        size = size < sizeof(struct packet) ? size : sizeof(struct packet);
+
+        for (copied = 0; copied < size; )
+        {
+            size_t index, inner, chunk;
+
+            index   = (offset + copied) / sizeof(struct packet);
+            inner   = (offset + copied) % sizeof(struct packet);
+            chunk   = sizeof(struct packet) - inner;
+            chunk   = chunk < size - copied ? chunk : size - copied;
+
+            memcpy((char *) segments[count] + copied, (char *) batch -> packets[index] + inner, chunk);
+            copied += chunk;
+        }
+
+        count++;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        packet_release(batch -> packets[i]);
+        batch -> packets[i] = segments[i];
+    }
+
+    batch -> count = count;
+
+    return 0;
+}
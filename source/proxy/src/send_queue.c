@@ -0,0 +1,183 @@
+#include "send_queue.h"
+
+static int flush_locked(struct send_queue *queue, FILE *fp, struct fsm_error *err);
+static int send_segmented(struct send_queue *queue, int sockfd);
+
+int send_queue_init(struct send_queue *queue)
+{
+    queue -> count              = 0;
+    queue -> sockfd             = -1;
+    queue -> same_destination   = TRUE;
+#ifdef UDP_SEGMENT
+    queue -> gso_enabled        = TRUE;
+#else
+    queue -> gso_enabled        = FALSE;
+#endif
+
+    return pthread_mutex_init(&queue -> lock, NULL) == 0 ? 0 : -1;
+}
+
+int send_queue_push(struct send_queue *queue, int sockfd, struct sockaddr_storage *addr,
+                    const struct packet *pt, FILE *fp, struct fsm_error *err)
+{
+    unsigned int    index;
+    int             result;
+
+    result = 0;
+    pthread_mutex_lock(&queue -> lock);
+
+    if (queue -> count == SEND_QUEUE_SIZE || (queue -> count > 0 && queue -> sockfd != sockfd))
+    {
+        result = flush_locked(queue, fp, err);
+    }
+
+    queue -> sockfd                         = sockfd;
+    index                                   = queue -> count++;
+
+    if (index == 0)
+    {
+        queue -> same_destination           = TRUE;
+    }
+    else if (size_of_address(addr) != queue -> msgs[0].msg_hdr.msg_namelen ||
+             memcmp(addr, &queue -> addrs[0], size_of_address(addr)) != 0)
+    {
+        queue -> same_destination           = FALSE;
+    }
+
+    queue -> packets[index]                 = *pt;
+    queue -> addrs[index]                   = *addr;
+    queue -> iovs[index].iov_base           = &queue -> packets[index];
+    queue -> iovs[index].iov_len            = sizeof(queue -> packets[index]);
+
+    memset(&queue -> msgs[index], 0, sizeof(queue -> msgs[index]));
+    queue -> msgs[index].msg_hdr.msg_name       = &queue -> addrs[index];
+    queue -> msgs[index].msg_hdr.msg_namelen    = size_of_address(addr);
+    queue -> msgs[index].msg_hdr.msg_iov        = &queue -> iovs[index];
+    queue -> msgs[index].msg_hdr.msg_iovlen     = 1;
+
+    pthread_mutex_unlock(&queue -> lock);
+
+    return result;
+}
+
+int send_queue_flush(struct send_queue *queue, FILE *fp, struct fsm_error *err)
+{
+    int result;
+
+    pthread_mutex_lock(&queue -> lock);
+    result = flush_locked(queue, fp, err);
+    pthread_mutex_unlock(&queue -> lock);
+
+    return result;
+}
+
+void send_queue_destroy(struct send_queue *queue)
+{
+    pthread_mutex_destroy(&queue -> lock);
+}
+
+static int flush_locked(struct send_queue *queue, FILE *fp, struct fsm_error *err)
+{
+    unsigned int    sent;
+    int             result, sockfd;
+
+    sockfd = queue -> sockfd;
+
+    if (queue -> gso_enabled && queue -> same_destination && queue -> count > 1)
+    {
+        if (send_segmented(queue, sockfd) == 0)
+        {
+            for (unsigned int i = 0; i < queue -> count; i++)
+            {
+                write_stats_to_file(fp, &queue -> packets[i]);
+            }
+
+            queue -> count = 0;
+            return 0;
+        }
+
+        if (errno != EIO && errno != EINVAL && errno != ENOPROTOOPT && errno != EOPNOTSUPP)
+        {
+            SET_ERROR(err, strerror(errno));
+            queue -> count = 0;
+            return -1;
+        }
+
+        // no GSO on this path, stay on plain sendmmsg from now on
+        queue -> gso_enabled = FALSE;
+    }
+
+    sent = 0;
+    while (sent < queue -> count)
+    {
+        result = sendmmsg(sockfd, &queue -> msgs[sent], queue -> count - sent, 0);
+
+        if (result == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            // the rest of the batch is dropped, retransmission timers recover it
+            SET_ERROR(err, strerror(errno));
+            queue -> count = 0;
+            return -1;
+        }
+
+        for (int i = 0; i < result; i++)
+        {
+            write_stats_to_file(fp, &queue -> packets[sent + i]);
+        }
+
+        sent += result;
+    }
+
+    queue -> count = 0;
+
+    return 0;
+}
+
+static int send_segmented(struct send_queue *queue, int sockfd)
+{
+#ifdef UDP_SEGMENT
+    struct msghdr       msg;
+    struct iovec        iov;
+    struct cmsghdr      *cmsg;
+    ssize_t             result;
+    union
+    {
+        char            buf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr  align;
+    } control;
+
+    // the queued packets are contiguous and equal-sized, the kernel slices them back up
+    iov.iov_base            = queue -> packets;
+    iov.iov_len             = sizeof(queue -> packets[0]) * queue -> count;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_name            = &queue -> addrs[0];
+    msg.msg_namelen         = queue -> msgs[0].msg_hdr.msg_namelen;
+    msg.msg_iov             = &iov;
+    msg.msg_iovlen          = 1;
+    msg.msg_control         = control.buf;
+    msg.msg_controllen      = sizeof(control.buf);
+
+    cmsg                    = CMSG_FIRSTHDR(&msg);
+    cmsg -> cmsg_level      = SOL_UDP;
+    cmsg -> cmsg_type       = UDP_SEGMENT;
+    cmsg -> cmsg_len        = CMSG_LEN(sizeof(uint16_t));
+    *(uint16_t *) CMSG_DATA(cmsg) = sizeof(queue -> packets[0]);
+
+    do
+    {
+        result = sendmsg(sockfd, &msg, 0);
+    } while (result == -1 && errno == EINTR);
+
+    return result == -1 ? -1 : 0;
+#else
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
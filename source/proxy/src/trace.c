@@ -0,0 +1,351 @@
+#include "trace.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int  parse_step(char *action, char *argument, struct trace_step *step);
+static int  parse_change(char *stamp, char **save, struct trace_change *change);
+static int  parse_field(const char *name, const char *value, struct trace_change *change);
+static int  parse_number(const char *string, uint64_t *value);
+static int  parse_rate(const char *string, uint64_t *value);
+static int  grow(void **array, size_t count, size_t *capacity, size_t size);
+
+// one packet per line: forward, drop, corrupt or delay <usec>
+// or a change to the link: @<usec> latency=<usec> jitter=<usec> rate=<bps>[k|m|g] queue=<bytes> loss=<percent>
+int trace_load(struct trace *replay, const char *path, struct fsm_error *err)
+{
+    static char message[96];
+    FILE        *fp;
+    char        line[TRACE_LINE_LENGTH];
+    size_t      step_capacity, change_capacity, line_number;
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+    memset(replay, 0, sizeof(*replay));
+    step_capacity   = 0;
+    change_capacity = 0;
+    line_number     = 0;
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        char    *action, *argument, *save;
+        int     result;
+
+        line_number++;
+        line[strcspn(line, "#\r\n")] = '\0';
+
+        action = strtok_r(line, " \t", &save);
+        if (action == NULL)
+        {
+            continue;
+        }
+
+        if (action[0] == '@')
+        {
+            struct trace_change change;
+
+            result = parse_change(action, &save, &change);
+            if (result == 0 && replay -> change_count > 0 &&
+                change.at_usec < replay -> changes[replay -> change_count - 1].at_usec)
+            {
+                result = -1;
+            }
+
+            if (result == 0)
+            {
+                result = grow((void **) &replay -> changes, replay -> change_count, &change_capacity,
+                              sizeof(*replay -> changes));
+                if (result == -1)
+                {
+                    SET_ERROR(err, strerror(errno));
+                    trace_destroy(replay);
+                    fclose(fp);
+                    return -1;
+                }
+                replay -> changes[replay -> change_count++] = change;
+            }
+        }
+        else
+        {
+            struct trace_step step;
+
+            argument    = strtok_r(NULL, " \t", &save);
+            result      = parse_step(action, argument, &step);
+
+            if (result == 0 && strtok_r(NULL, " \t", &save) != NULL)
+            {
+                result = -1;
+            }
+
+            if (result == 0)
+            {
+                result = grow((void **) &replay -> steps, replay -> step_count, &step_capacity,
+                              sizeof(*replay -> steps));
+                if (result == -1)
+                {
+                    SET_ERROR(err, strerror(errno));
+                    trace_destroy(replay);
+                    fclose(fp);
+                    return -1;
+                }
+                replay -> steps[replay -> step_count++] = step;
+            }
+        }
+
+        if (result == -1)
+        {
+            snprintf(message, sizeof(message), "Invalid trace line %zu in %s.", line_number, path);
+            SET_ERROR(err, message);
+            trace_destroy(replay);
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    fclose(fp);
+
+    if (replay -> step_count == 0 && replay -> change_count == 0)
+    {
+        SET_ERROR(err, "Trace is empty.");
+        return -1;
+    }
+
+    return 0;
+}
+
+void trace_destroy(struct trace *replay)
+{
+    free(replay -> steps);
+    free(replay -> changes);
+    replay -> steps          = NULL;
+    replay -> changes        = NULL;
+    replay -> step_count     = 0;
+    replay -> change_count   = 0;
+}
+
+bool trace_loaded(const struct trace *replay)
+{
+    return replay -> step_count > 0 || replay -> change_count > 0;
+}
+
+// NULL when the trace only changes the link, the packet is then left to the other impairments
+const struct trace_step *trace_next_step(struct trace *replay)
+{
+    const struct trace_step *step;
+
+    if (replay -> step_count == 0)
+    {
+        return NULL;
+    }
+
+    step = &replay -> steps[replay -> next_step++];
+    replay -> replayed++;
+
+    if (replay -> next_step == replay -> step_count)
+    {
+        replay -> next_step = 0;
+        replay -> loops++;
+    }
+
+    return step;
+}
+
+// one change per call, the caller keeps asking until nothing more is due
+const struct trace_change *trace_due_change(struct trace *replay, uint64_t now_usec)
+{
+    if (replay -> next_change == replay -> change_count)
+    {
+        return NULL;
+    }
+
+    // the clock starts with the first packet, not when the proxy starts
+    if (replay -> start_usec == 0)
+    {
+        replay -> start_usec = now_usec;
+    }
+
+    if (now_usec - replay -> start_usec < replay -> changes[replay -> next_change].at_usec)
+    {
+        return NULL;
+    }
+
+    return &replay -> changes[replay -> next_change++];
+}
+
+static int parse_step(char *action, char *argument, struct trace_step *step)
+{
+    static const char *names[] = {"forward", "drop", "delay", "corrupt"};
+
+    step -> delay_usec = 0;
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if (strcmp(action, names[i]) == 0)
+        {
+            step -> action = (int) i;
+
+            // only a delay carries a number
+            if (step -> action == TRACE_DELAY)
+            {
+                return argument == NULL ? -1 : parse_number(argument, &step -> delay_usec);
+            }
+
+            return argument == NULL ? 0 : -1;
+        }
+    }
+
+    return -1;
+}
+
+static int parse_change(char *stamp, char **save, struct trace_change *change)
+{
+    char *field;
+
+    memset(change, 0, sizeof(*change));
+
+    if (parse_number(stamp + 1, &change -> at_usec) == -1)
+    {
+        return -1;
+    }
+
+    while ((field = strtok_r(NULL, " \t", save)) != NULL)
+    {
+        char *value;
+
+        value = strchr(field, '=');
+        if (value == NULL)
+        {
+            return -1;
+        }
+        *value++ = '\0';
+
+        if (parse_field(field, value, change) == -1)
+        {
+            return -1;
+        }
+    }
+
+    return change -> fields == 0 ? -1 : 0;
+}
+
+static int parse_field(const char *name, const char *value, struct trace_change *change)
+{
+    if (strcmp(name, "latency") == 0)
+    {
+        change -> fields |= TRACE_LATENCY;
+        return parse_number(value, &change -> latency_usec);
+    }
+
+    if (strcmp(name, "jitter") == 0)
+    {
+        change -> fields |= TRACE_JITTER;
+        return parse_number(value, &change -> jitter_usec);
+    }
+
+    if (strcmp(name, "rate") == 0)
+    {
+        change -> fields |= TRACE_RATE;
+        return parse_rate(value, &change -> rate_bps);
+    }
+
+    if (strcmp(name, "queue") == 0)
+    {
+        change -> fields |= TRACE_QUEUE;
+        return parse_number(value, &change -> limit_bytes);
+    }
+
+    if (strcmp(name, "loss") == 0)
+    {
+        char *end;
+
+        errno           = 0;
+        change -> loss  = strtod(value, &end);
+        change -> fields |= TRACE_LOSS;
+
+        if (end == value || *end != '\0' || errno != 0 || change -> loss < 0 || change -> loss > 100)
+        {
+            return -1;
+        }
+
+        change -> loss /= 100;
+        return 0;
+    }
+
+    return -1;
+}
+
+static int parse_number(const char *string, uint64_t *value)
+{
+    char        *end;
+    uintmax_t   parsed;
+
+    errno   = 0;
+    parsed  = strtoumax(string, &end, 10);
+    if (errno != 0 || end == string || *end != '\0' || string[0] == '-')
+    {
+        return -1;
+    }
+
+    *value = (uint64_t) parsed;
+
+    return 0;
+}
+
+// the same suffixes the rate options take
+static int parse_rate(const char *string, uint64_t *value)
+{
+    char        *end;
+    uintmax_t   parsed, scale;
+
+    errno   = 0;
+    parsed  = strtoumax(string, &end, 10);
+    if (errno != 0 || end == string || string[0] == '-')
+    {
+        return -1;
+    }
+
+    scale = *end == 'k' ? 1000 : *end == 'm' ? 1000000 : *end == 'g' ? 1000000000 : 1;
+    if (scale > 1)
+    {
+        end++;
+    }
+
+    if (*end != '\0' || parsed > UINT64_MAX / scale)
+    {
+        return -1;
+    }
+
+    *value = (uint64_t) (parsed * scale);
+
+    return 0;
+}
+
+static int grow(void **array, size_t count, size_t *capacity, size_t size)
+{
+    void    *grown;
+    size_t  wanted;
+
+    if (count < *capacity)
+    {
+        return 0;
+    }
+
+    wanted  = *capacity == 0 ? 256 : *capacity * 2;
+    grown   = realloc(*array, wanted * size);
+    if (grown == NULL)
+    {
+        return -1;
+    }
+
+    *array      = grown;
+    *capacity   = wanted;
+
+    return 0;
+}
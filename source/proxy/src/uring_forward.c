@@ -0,0 +1,463 @@
+#include "uring_forward.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define URING_OP_RECEIVE 1ULL
+#define URING_OP_SEND 2ULL
+#define URING_OP_TIMEOUT 3ULL
+#define USER_DATA(op, route, buffer_id) ((op) << 32 | (uint64_t) (route) << 16 | (buffer_id))
+
+static int                  map_rings(struct uring *ring, struct io_uring_params *params);
+static int                  register_buffers(struct uring *ring);
+static struct io_uring_sqe  *get_sqe(struct uring *ring);
+static int                  reserve_sqes(struct uring *ring, unsigned int count);
+static int                  enter(struct uring *ring, unsigned int min_complete, unsigned int flags);
+static void                 prepare_send(struct io_uring_sqe *sqe, struct uring *ring, unsigned int route,
+                                         unsigned int buffer_id);
+
+int uring_init(struct uring *ring, const int *sockfds, unsigned int routes, struct fsm_error *err)
+{
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    ring -> ring_fd     = -1;
+    ring -> routes      = routes;
+    params.flags        = IORING_SETUP_CQSIZE;
+    params.cq_entries   = URING_QUEUE_DEPTH * 4;
+
+    ring -> ring_fd = (int) syscall(__NR_io_uring_setup, URING_QUEUE_DEPTH, &params);
+    if (ring -> ring_fd == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+    if (map_rings(ring, &params) == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        uring_destroy(ring);
+        return -1;
+    }
+
+    // the two sockets never change, so let the kernel skip the fd lookup on every op
+    if (syscall(__NR_io_uring_register, ring -> ring_fd, IORING_REGISTER_FILES, sockfds, routes) == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        uring_destroy(ring);
+        return -1;
+    }
+
+    if (register_buffers(ring) == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        uring_destroy(ring);
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < URING_BUFFER_COUNT; i++)
+    {
+        uring_release(ring, i);
+    }
+
+    for (unsigned int i = 0; i < routes; i++)
+    {
+        ring -> rearm[i] = TRUE;
+    }
+
+    return 0;
+}
+
+int uring_forward(struct uring *ring, unsigned int buffer_id, unsigned int route,
+                  struct sockaddr_storage *addr, uint64_t delay_usec)
+{
+    struct uring_slot       *slot;
+    struct io_uring_sqe     *sqe;
+
+    slot                    = &ring -> slots[buffer_id];
+    slot -> msg.msg_name    = addr;
+    slot -> msg.msg_namelen = size_of_address(addr);
+
+    if (delay_usec == 0)
+    {
+        ring -> pending[route][ring -> pending_count[route]++] = buffer_id;
+        return 0;
+    }
+
+    if (reserve_sqes(ring, 2) == -1)
+    {
+        return -1;
+    }
+
+    // the timer holds back only this packet, the send runs once it fires
+    slot -> delay.tv_sec    = (long long) (delay_usec / 1000000);
+    slot -> delay.tv_nsec   = (long long) (delay_usec % 1000000) * 1000;
+
+    sqe                     = get_sqe(ring);
+    sqe -> opcode           = IORING_OP_TIMEOUT;
+    sqe -> fd               = -1;
+    sqe -> addr             = (uint64_t) (uintptr_t) &slot -> delay;
+    sqe -> len              = 1;
+    sqe -> timeout_flags    = IORING_TIMEOUT_ETIME_SUCCESS;
+    sqe -> flags            = IOSQE_IO_LINK;
+    sqe -> user_data        = USER_DATA(URING_OP_TIMEOUT, route, buffer_id);
+
+    prepare_send(get_sqe(ring), ring, route, buffer_id);
+
+    return 0;
+}
+
+void uring_release(struct uring *ring, unsigned int buffer_id)
+{
+    struct io_uring_buf *buf;
+
+    buf             = &ring -> buf_ring -> bufs[ring -> buf_tail & (URING_BUFFER_COUNT - 1)];
+    buf -> addr     = (uint64_t) (uintptr_t) (ring -> buffers + (size_t) buffer_id * URING_BUFFER_SIZE);
+    buf -> len      = URING_BUFFER_SIZE;
+    buf -> bid      = (uint16_t) buffer_id;
+
+    ring -> buf_tail++;
+    ring -> free_buffers++;
+    __atomic_store_n(&ring -> buf_ring -> tail, ring -> buf_tail, __ATOMIC_RELEASE);
+}
+
+int uring_submit_and_wait(struct uring *ring, struct fsm_error *err)
+{
+    struct io_uring_sqe *sqe;
+
+    for (unsigned int route = 0; route < ring -> routes; route++)
+    {
+        unsigned int count;
+
+        count = ring -> pending_count[route];
+        if (count == 0)
+        {
+            continue;
+        }
+
+        if (reserve_sqes(ring, count) == -1)
+        {
+            SET_ERROR(err, strerror(errno));
+            return -1;
+        }
+
+        // linked so the kernel sends them in arrival order without another round trip
+        for (unsigned int i = 0; i < count; i++)
+        {
+            sqe = get_sqe(ring);
+            prepare_send(sqe, ring, route, ring -> pending[route][i]);
+
+            if (i + 1 < count)
+            {
+                sqe -> flags |= IOSQE_IO_LINK;
+            }
+        }
+
+        ring -> pending_count[route] = 0;
+    }
+
+    for (unsigned int route = 0; route < ring -> routes; route++)
+    {
+        // an exhausted buffer ring ends the multishot receive, re-arm once buffers come back
+        if (!ring -> rearm[route] || ring -> free_buffers == 0)
+        {
+            continue;
+        }
+
+        if (reserve_sqes(ring, 1) == -1)
+        {
+            SET_ERROR(err, strerror(errno));
+            return -1;
+        }
+
+        sqe                 = get_sqe(ring);
+        sqe -> opcode       = IORING_OP_RECVMSG;
+        sqe -> fd           = (int) route;
+        sqe -> flags        = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+        sqe -> ioprio       = IORING_RECV_MULTISHOT;
+        sqe -> buf_group    = URING_BUFFER_GROUP;
+        sqe -> addr         = (uint64_t) (uintptr_t) &ring -> recv_msg;
+        sqe -> len          = 1;
+        sqe -> user_data    = USER_DATA(URING_OP_RECEIVE, route, 0);
+
+        ring -> rearm[route] = FALSE;
+    }
+
+    if (enter(ring, 1, IORING_ENTER_GETEVENTS) == -1)
+    {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+        {
+            return 0;
+        }
+
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int uring_next_event(struct uring *ring, struct uring_event *event)
+{
+    unsigned int head, tail;
+
+    head = *ring -> cq_head;
+    tail = __atomic_load_n(ring -> cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail)
+    {
+        struct io_uring_cqe             *cqe;
+        struct io_uring_recvmsg_out     *out;
+        uint64_t                        op;
+        unsigned int                    route, buffer_id;
+        int                             found;
+
+        cqe         = &ring -> cqes[head & *ring -> cq_mask];
+        op          = cqe -> user_data >> 32;
+        route       = (unsigned int) (cqe -> user_data >> 16) & 0xFFFF;
+        buffer_id   = (unsigned int) cqe -> user_data & 0xFFFF;
+        found       = FALSE;
+
+        if (op == URING_OP_SEND)
+        {
+            event -> type       = URING_SENT;
+            event -> result     = cqe -> res;
+            event -> route      = route;
+            event -> buffer_id  = buffer_id;
+            event -> pt         = ring -> slots[buffer_id].iov.iov_base;
+            found               = TRUE;
+        }
+        else if (op == URING_OP_RECEIVE)
+        {
+            if (!(cqe -> flags & IORING_CQE_F_MORE))
+            {
+                ring -> rearm[route] = TRUE;
+            }
+
+            if (cqe -> flags & IORING_CQE_F_BUFFER)
+            {
+                buffer_id = cqe -> flags >> IORING_CQE_BUFFER_SHIFT;
+                ring -> free_buffers--;
+                out = (struct io_uring_recvmsg_out *) (ring -> buffers + (size_t) buffer_id * URING_BUFFER_SIZE);
+
+                if (cqe -> res < 0 || out -> payloadlen == 0 || (out -> flags & MSG_TRUNC))
+                {
+                    uring_release(ring, buffer_id);
+                }
+                else
+                {
+                    ring -> slots[buffer_id].iov.iov_base  = out + 1;
+                    ring -> slots[buffer_id].iov.iov_len   = out -> payloadlen;
+
+                    event -> type       = URING_RECEIVED;
+                    event -> result     = cqe -> res;
+                    event -> route      = route;
+                    event -> buffer_id  = buffer_id;
+                    event -> pt         = (struct packet *) (out + 1);
+                    found               = TRUE;
+                }
+            }
+        }
+
+        head++;
+        __atomic_store_n(ring -> cq_head, head, __ATOMIC_RELEASE);
+
+        if (found)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+void uring_destroy(struct uring *ring)
+{
+    if (ring -> sqes != NULL)
+    {
+        munmap(ring -> sqes, ring -> sqes_size);
+    }
+
+    if (ring -> cq_ring != NULL && ring -> cq_ring != ring -> sq_ring)
+    {
+        munmap(ring -> cq_ring, ring -> cq_ring_size);
+    }
+
+    if (ring -> sq_ring != NULL)
+    {
+        munmap(ring -> sq_ring, ring -> sq_ring_size);
+    }
+
+    if (ring -> ring_fd != -1)
+    {
+        close(ring -> ring_fd);
+    }
+
+    if (ring -> buf_ring != NULL)
+    {
+        munmap(ring -> buf_ring, sizeof(struct io_uring_buf) * URING_BUFFER_COUNT);
+    }
+
+    free(ring -> buffers);
+    memset(ring, 0, sizeof(*ring));
+    ring -> ring_fd = -1;
+}
+
+static int map_rings(struct uring *ring, struct io_uring_params *params)
+{
+    char *sq, *cq;
+
+    ring -> sq_entries      = params -> sq_entries;
+    ring -> sq_ring_size    = params -> sq_off.array + params -> sq_entries * sizeof(unsigned int);
+    ring -> cq_ring_size    = params -> cq_off.cqes + params -> cq_entries * sizeof(struct io_uring_cqe);
+    ring -> sqes_size       = params -> sq_entries * sizeof(struct io_uring_sqe);
+
+    if (params -> features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring -> cq_ring_size > ring -> sq_ring_size)
+        {
+            ring -> sq_ring_size = ring -> cq_ring_size;
+        }
+        ring -> cq_ring_size = ring -> sq_ring_size;
+    }
+
+    sq = mmap(NULL, ring -> sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              ring -> ring_fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+    {
+        return -1;
+    }
+    ring -> sq_ring = sq;
+
+    if (params -> features & IORING_FEAT_SINGLE_MMAP)
+    {
+        cq = sq;
+    }
+    else
+    {
+        cq = mmap(NULL, ring -> cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring -> ring_fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED)
+        {
+            return -1;
+        }
+    }
+    ring -> cq_ring = cq;
+
+    ring -> sqes = mmap(NULL, ring -> sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring -> ring_fd, IORING_OFF_SQES);
+    if (ring -> sqes == MAP_FAILED)
+    {
+        ring -> sqes = NULL;
+        return -1;
+    }
+
+    ring -> sq_head     = (unsigned int *) (sq + params -> sq_off.head);
+    ring -> sq_tail     = (unsigned int *) (sq + params -> sq_off.tail);
+    ring -> sq_mask     = (unsigned int *) (sq + params -> sq_off.ring_mask);
+    ring -> sq_array    = (unsigned int *) (sq + params -> sq_off.array);
+    ring -> cq_head     = (unsigned int *) (cq + params -> cq_off.head);
+    ring -> cq_tail     = (unsigned int *) (cq + params -> cq_off.tail);
+    ring -> cq_mask     = (unsigned int *) (cq + params -> cq_off.ring_mask);
+    ring -> cqes        = (struct io_uring_cqe *) (cq + params -> cq_off.cqes);
+    ring -> sqe_tail    = *ring -> sq_tail;
+
+    return 0;
+}
+
+static int register_buffers(struct uring *ring)
+{
+    struct io_uring_buf_reg reg;
+    void                    *mapping;
+
+    ring -> buffers = malloc((size_t) URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+    if (ring -> buffers == NULL)
+    {
+        return -1;
+    }
+
+    // the buffer ring has to be page aligned, anonymous mmap guarantees that
+    mapping = mmap(NULL, sizeof(struct io_uring_buf) * URING_BUFFER_COUNT, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        return -1;
+    }
+    ring -> buf_ring = mapping;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr       = (uint64_t) (uintptr_t) ring -> buf_ring;
+    reg.ring_entries    = URING_BUFFER_COUNT;
+    reg.bgid            = URING_BUFFER_GROUP;
+
+    if (syscall(__NR_io_uring_register, ring -> ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static struct io_uring_sqe *get_sqe(struct uring *ring)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int        index;
+
+    index                       = ring -> sqe_tail & *ring -> sq_mask;
+    sqe                         = &ring -> sqes[index];
+    ring -> sq_array[index]     = index;
+    ring -> sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+static int reserve_sqes(struct uring *ring, unsigned int count)
+{
+    unsigned int head;
+
+    head = __atomic_load_n(ring -> sq_head, __ATOMIC_ACQUIRE);
+    if (ring -> sq_entries - (ring -> sqe_tail - head) >= count)
+    {
+        return 0;
+    }
+
+    // a link chain must not straddle two submissions, so push out what is queued first
+    return enter(ring, 0, 0);
+}
+
+static int enter(struct uring *ring, unsigned int min_complete, unsigned int flags)
+{
+    unsigned int    to_submit;
+    long            result;
+
+    __atomic_store_n(ring -> sq_tail, ring -> sqe_tail, __ATOMIC_RELEASE);
+    to_submit = ring -> sqe_tail - ring -> sqe_submitted;
+
+    result = syscall(__NR_io_uring_enter, ring -> ring_fd, to_submit, min_complete, flags, NULL, 0);
+    if (result == -1)
+    {
+        return -1;
+    }
+
+    ring -> sqe_submitted += (unsigned int) result;
+
+    return 0;
+}
+
+static void prepare_send(struct io_uring_sqe *sqe, struct uring *ring, unsigned int route,
+                         unsigned int buffer_id)
+{
+    struct uring_slot *slot;
+
+    slot                    = &ring -> slots[buffer_id];
+    slot -> msg.msg_iov     = &slot -> iov;
+    slot -> msg.msg_iovlen  = 1;
+
+    sqe -> opcode           = IORING_OP_SENDMSG;
+    sqe -> fd               = (int) route;
+    sqe -> flags            = IOSQE_FIXED_FILE;
+    sqe -> addr             = (uint64_t) (uintptr_t) &slot -> msg;
+    sqe -> len              = 1;
+    sqe -> user_data        = USER_DATA(URING_OP_SEND, route, buffer_id);
+}
@@ -0,0 +1,547 @@
+#include "xdp_forward.h"
+#include <stddef.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define INSN(c, d, s, o, i) ((struct bpf_insn) {.code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i)})
+
+static int          create_map(struct xdp *sock);
+static int          load_program(struct xdp *sock);
+static int          attach_program(struct xdp *sock, int zerocopy);
+static int          create_socket(struct xdp *sock, int zerocopy);
+static int          map_ring(struct xdp *sock, struct xdp_ring *ring, const struct xdp_ring_offset *offset,
+                             uint32_t size, size_t desc_size, off_t pgoff);
+static int          read_local_mac(struct xdp *sock, const char *ifname);
+static int          lookup_neighbour(struct xdp_peer *peer);
+static void         reclaim_completions(struct xdp *sock);
+static uint16_t     ip_checksum(const void *data, size_t len);
+static long         bpf(int cmd, union bpf_attr *attr);
+
+int xdp_init(struct xdp *sock, const char *ifname, int zerocopy,
+             const struct sockaddr_storage *local, const uint16_t *ports,
+             const struct sockaddr_storage *peers, struct fsm_error *err)
+{
+    union bpf_attr  attr;
+    uint32_t        queue;
+
+    memset(sock, 0, sizeof(*sock));
+    sock -> xsk_fd   = -1;
+    sock -> map_fd   = -1;
+    sock -> prog_fd  = -1;
+    sock -> link_fd  = -1;
+
+    // frames are rewritten in place, which is only done for plain IPv4 + UDP
+    if (local -> ss_family != AF_INET)
+    {
+        SET_ERROR(err, "The AF_XDP path only supports IPv4.");
+        return -1;
+    }
+
+    sock -> ifindex  = (int) if_nametoindex(ifname);
+    if (sock -> ifindex == 0)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+    sock -> local_ip = ((const struct sockaddr_in *) local) -> sin_addr.s_addr;
+    for (int i = 0; i < XDP_MAX_ROUTES; i++)
+    {
+        sock -> ports[i]         = ports[i];
+        sock -> peers[i].ip      = ((const struct sockaddr_in *) &peers[i]) -> sin_addr.s_addr;
+        sock -> peers[i].port    = ((const struct sockaddr_in *) &peers[i]) -> sin_port;
+    }
+
+    if (read_local_mac(sock, ifname) == -1 || create_map(sock) == -1 || load_program(sock) == -1 ||
+        create_socket(sock, zerocopy) == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        xdp_destroy(sock);
+        return -1;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    queue               = XDP_QUEUE_ID;
+    attr.map_fd         = (uint32_t) sock -> map_fd;
+    attr.key            = (uint64_t) (uintptr_t) &queue;
+    attr.value          = (uint64_t) (uintptr_t) &sock -> xsk_fd;
+
+    if (bpf(BPF_MAP_UPDATE_ELEM, &attr) == -1 || attach_program(sock, zerocopy) == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        xdp_destroy(sock);
+        return -1;
+    }
+
+    return 0;
+}
+
+int xdp_wait(struct xdp *sock, int extra_fd, int timeout_ms, struct fsm_error *err)
+{
+    struct pollfd   fds[2];
+    int             result;
+
+    fds[0].fd       = sock -> xsk_fd;
+    fds[0].events   = POLLIN;
+    fds[1].fd       = extra_fd;
+    fds[1].events   = POLLIN;
+
+    result = poll(fds, extra_fd >= 0 ? 2 : 1, timeout_ms);
+    if (result == -1 && errno != EINTR)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int xdp_next_frame(struct xdp *sock, struct xdp_frame *frame)
+{
+    struct xdp_desc     *desc;
+    struct iphdr        *ip;
+    struct udphdr       *udp;
+    char                *data;
+    uint32_t            consumer;
+
+    consumer = *sock -> rx.consumer;
+    while (consumer != __atomic_load_n(sock -> rx.producer, __ATOMIC_ACQUIRE))
+    {
+        desc            = &((struct xdp_desc *) sock -> rx.descs)[consumer & sock -> rx.mask];
+        frame -> addr   = desc -> addr;
+        frame -> len    = desc -> len;
+        consumer++;
+        __atomic_store_n(sock -> rx.consumer, consumer, __ATOMIC_RELEASE);
+
+        // the redirect program already checked ethertype, IHL 5 and UDP, so only the length is left
+        data    = sock -> umem + frame -> addr;
+        ip      = (struct iphdr *) (data + sizeof(struct ether_header));
+        udp     = (struct udphdr *) (ip + 1);
+
+        if (frame -> len < XDP_HEADERS_SIZE + sizeof(struct header))
+        {
+            xdp_release(sock, frame);
+            continue;
+        }
+
+        frame -> route  = udp -> dest == sock -> ports[0] ? 0 : 1;
+        frame -> pt     = (struct packet *) (data + XDP_HEADERS_SIZE);
+
+        // learn the sender's MAC so replies need no neighbour lookup
+        for (int i = 0; i < XDP_MAX_ROUTES; i++)
+        {
+            if (!sock -> peers[i].has_mac && ip -> saddr == sock -> peers[i].ip)
+            {
+                memcpy(sock -> peers[i].mac, ((struct ether_header *) data) -> ether_shost, ETH_ALEN);
+                sock -> peers[i].has_mac = TRUE;
+            }
+        }
+
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+int xdp_forward(struct xdp *sock, const struct xdp_frame *frame, unsigned int route)
+{
+    struct xdp_peer     *peer;
+    struct ether_header *eth;
+    struct iphdr        *ip;
+    struct udphdr       *udp;
+    struct xdp_desc     *desc;
+    uint32_t            producer;
+
+    peer = &sock -> peers[route];
+    if (!peer -> has_mac && lookup_neighbour(peer) == -1)
+    {
+        return -1;
+    }
+
+    producer = *sock -> tx.producer;
+    if (producer - __atomic_load_n(sock -> tx.consumer, __ATOMIC_ACQUIRE) >= sock -> tx.size)
+    {
+        reclaim_completions(sock);
+        return -1;
+    }
+
+    // turn the frame around in place: proxy becomes the source, the peer the destination
+    eth = (struct ether_header *) (sock -> umem + frame -> addr);
+    ip  = (struct iphdr *) (eth + 1);
+    udp = (struct udphdr *) (ip + 1);
+
+    memcpy(eth -> ether_dhost, peer -> mac, ETH_ALEN);
+    memcpy(eth -> ether_shost, sock -> local_mac, ETH_ALEN);
+    ip -> saddr     = sock -> local_ip;
+    ip -> daddr     = peer -> ip;
+    ip -> ttl       = IPDEFTTL;
+    ip -> check     = 0;
+    ip -> check     = ip_checksum(ip, sizeof(*ip));
+    udp -> source   = sock -> ports[route];
+    udp -> dest     = peer -> port;
+    // optional over IPv4, and the payload may just have been corrupted on purpose
+    udp -> check    = 0;
+
+    desc            = &((struct xdp_desc *) sock -> tx.descs)[producer & sock -> tx.mask];
+    desc -> addr    = frame -> addr;
+    desc -> len     = frame -> len;
+    desc -> options = 0;
+    __atomic_store_n(sock -> tx.producer, producer + 1, __ATOMIC_RELEASE);
+    sock -> need_kick = TRUE;
+
+    return 0;
+}
+
+void xdp_release(struct xdp *sock, const struct xdp_frame *frame)
+{
+    uint32_t producer;
+
+    // the fill ring holds every frame, so it can never be full here
+    producer = *sock -> fill.producer;
+    ((uint64_t *) sock -> fill.descs)[producer & sock -> fill.mask] = frame -> addr & ~((uint64_t) XDP_FRAME_SIZE - 1);
+    __atomic_store_n(sock -> fill.producer, producer + 1, __ATOMIC_RELEASE);
+}
+
+void xdp_flush(struct xdp *sock)
+{
+    // copy mode always needs the syscall to transmit, native mode only when the driver asks
+    if (sock -> need_kick)
+    {
+        sendto(sock -> xsk_fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+        sock -> need_kick = FALSE;
+    }
+
+    reclaim_completions(sock);
+}
+
+void xdp_destroy(struct xdp *sock)
+{
+    struct xdp_ring *rings[] = {&sock -> fill, &sock -> completion, &sock -> rx, &sock -> tx};
+
+    // closing the link detaches the program and hands the queue back to the kernel stack
+    if (sock -> link_fd >= 0)
+    {
+        close(sock -> link_fd);
+    }
+
+    for (size_t i = 0; i < sizeof(rings) / sizeof(rings[0]); i++)
+    {
+        if (rings[i] -> map != NULL)
+        {
+            munmap(rings[i] -> map, rings[i] -> map_size);
+        }
+    }
+
+    if (sock -> xsk_fd >= 0)
+    {
+        close(sock -> xsk_fd);
+    }
+
+    if (sock -> prog_fd >= 0)
+    {
+        close(sock -> prog_fd);
+    }
+
+    if (sock -> map_fd >= 0)
+    {
+        close(sock -> map_fd);
+    }
+
+    if (sock -> umem != NULL)
+    {
+        munmap(sock -> umem, sock -> umem_size);
+    }
+
+    memset(sock, 0, sizeof(*sock));
+    sock -> xsk_fd   = -1;
+    sock -> map_fd   = -1;
+    sock -> prog_fd  = -1;
+    sock -> link_fd  = -1;
+}
+
+static int create_map(struct xdp *sock)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type       = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size       = sizeof(uint32_t);
+    attr.value_size     = sizeof(int);
+    attr.max_entries    = XDP_QUEUE_ID + 1;
+
+    sock -> map_fd = (int) bpf(BPF_MAP_CREATE, &attr);
+
+    return sock -> map_fd == -1 ? -1 : 0;
+}
+
+// hands IPv4 UDP frames for the two proxy ports to the socket, everything else (ARP, other
+// traffic) goes on to the kernel stack as usual
+static int load_program(struct xdp *sock)
+{
+    union bpf_attr  attr;
+    struct bpf_insn program[] = {
+            INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0),
+            INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, data), 0),
+            INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_6, offsetof(struct xdp_md, data_end), 0),
+            INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0),
+            INSN(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, XDP_HEADERS_SIZE),
+            INSN(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 9, 0),
+            INSN(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, 12, 0),
+            INSN(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 7, htons(ETHERTYPE_IP)),
+            INSN(BPF_LDX | BPF_MEM | BPF_B, BPF_REG_5, BPF_REG_2, 14, 0),
+            INSN(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 5, 0x45),
+            INSN(BPF_LDX | BPF_MEM | BPF_B, BPF_REG_5, BPF_REG_2, 23, 0),
+            INSN(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 3, IPPROTO_UDP),
+            INSN(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, 36, 0),
+            INSN(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_5, 0, 3, sock -> ports[0]),
+            INSN(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_5, 0, 2, sock -> ports[1]),
+            INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS),
+            INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+            INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index), 0),
+            INSN(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, sock -> map_fd),
+            INSN(0, 0, 0, 0, 0),
+            // the low bits of the flags are the action when the queue has no socket bound
+            INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS),
+            INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+            INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+    };
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type  = BPF_PROG_TYPE_XDP;
+    attr.insns      = (uint64_t) (uintptr_t) program;
+    attr.insn_cnt   = sizeof(program) / sizeof(program[0]);
+    attr.license    = (uint64_t) (uintptr_t) "GPL";
+
+    sock -> prog_fd = (int) bpf(BPF_PROG_LOAD, &attr);
+
+    return sock -> prog_fd == -1 ? -1 : 0;
+}
+
+static int attach_program(struct xdp *sock, int zerocopy)
+{
+    union bpf_attr attr;
+
+    // generic mode runs on any device (veth included), zero copy needs the driver hook
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd        = (uint32_t) sock -> prog_fd;
+    attr.link_create.target_ifindex = (uint32_t) sock -> ifindex;
+    attr.link_create.attach_type    = BPF_XDP;
+    attr.link_create.flags          = zerocopy ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+
+    sock -> link_fd = (int) bpf(BPF_LINK_CREATE, &attr);
+
+    return sock -> link_fd == -1 ? -1 : 0;
+}
+
+static int create_socket(struct xdp *sock, int zerocopy)
+{
+    struct xdp_umem_reg     reg;
+    struct xdp_mmap_offsets offsets;
+    struct sockaddr_xdp     addr;
+    socklen_t               length;
+    int                     fill_size, ring_size;
+
+    sock -> xsk_fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (sock -> xsk_fd == -1)
+    {
+        return -1;
+    }
+
+    sock -> umem_size    = (size_t) XDP_FRAME_SIZE * XDP_FRAME_COUNT;
+    sock -> umem         = mmap(NULL, sock -> umem_size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (sock -> umem == MAP_FAILED)
+    {
+        sock -> umem = NULL;
+        return -1;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.addr        = (uint64_t) (uintptr_t) sock -> umem;
+    reg.len         = sock -> umem_size;
+    reg.chunk_size  = XDP_FRAME_SIZE;
+
+    fill_size       = XDP_FRAME_COUNT;
+    ring_size       = XDP_RING_SIZE;
+    length          = sizeof(offsets);
+
+    if (setsockopt(sock -> xsk_fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) == -1 ||
+        setsockopt(sock -> xsk_fd, SOL_XDP, XDP_UMEM_FILL_RING, &fill_size, sizeof(fill_size)) == -1 ||
+        setsockopt(sock -> xsk_fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) == -1 ||
+        setsockopt(sock -> xsk_fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) == -1 ||
+        setsockopt(sock -> xsk_fd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)) == -1 ||
+        getsockopt(sock -> xsk_fd, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &length) == -1)
+    {
+        return -1;
+    }
+
+    if (map_ring(sock, &sock -> fill, &offsets.fr, XDP_FRAME_COUNT, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) == -1 ||
+        map_ring(sock, &sock -> completion, &offsets.cr, XDP_RING_SIZE, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) == -1 ||
+        map_ring(sock, &sock -> rx, &offsets.rx, XDP_RING_SIZE, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) == -1 ||
+        map_ring(sock, &sock -> tx, &offsets.tx, XDP_RING_SIZE, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) == -1)
+    {
+        return -1;
+    }
+
+    // every frame starts out on the fill ring, forwarded frames come back through completions
+    for (uint64_t i = 0; i < XDP_FRAME_COUNT; i++)
+    {
+        ((uint64_t *) sock -> fill.descs)[i] = i * XDP_FRAME_SIZE;
+    }
+    __atomic_store_n(sock -> fill.producer, XDP_FRAME_COUNT, __ATOMIC_RELEASE);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sxdp_family    = AF_XDP;
+    addr.sxdp_ifindex   = (uint32_t) sock -> ifindex;
+    addr.sxdp_queue_id  = XDP_QUEUE_ID;
+    addr.sxdp_flags     = zerocopy ? XDP_ZEROCOPY : XDP_COPY;
+
+    return bind(sock -> xsk_fd, (struct sockaddr *) &addr, sizeof(addr));
+}
+
+static int map_ring(struct xdp *sock, struct xdp_ring *ring, const struct xdp_ring_offset *offset,
+                    uint32_t size, size_t desc_size, off_t pgoff)
+{
+    char *map;
+
+    ring -> map_size    = offset -> desc + size * desc_size;
+    map                 = mmap(NULL, ring -> map_size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, sock -> xsk_fd, pgoff);
+    if (map == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    ring -> map         = map;
+    ring -> producer    = (uint32_t *) (map + offset -> producer);
+    ring -> consumer    = (uint32_t *) (map + offset -> consumer);
+    ring -> flags       = (uint32_t *) (map + offset -> flags);
+    ring -> descs       = map + offset -> desc;
+    ring -> size        = size;
+    ring -> mask        = size - 1;
+
+    return 0;
+}
+
+static int read_local_mac(struct xdp *sock, const char *ifname)
+{
+    struct ifreq    request;
+    int             fd;
+    int             result;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    memset(&request, 0, sizeof(request));
+    strncpy(request.ifr_name, ifname, IFNAMSIZ - 1);
+    result = ioctl(fd, SIOCGIFHWADDR, &request);
+    close(fd);
+
+    if (result == -1)
+    {
+        return -1;
+    }
+
+    memcpy(sock -> local_mac, request.ifr_hwaddr.sa_data, ETH_ALEN);
+
+    return 0;
+}
+
+// the kernel's ARP table; until it has the peer the caller sends through its UDP socket,
+// which resolves the address as a side effect
+static int lookup_neighbour(struct xdp_peer *peer)
+{
+    FILE            *fp;
+    char            line[256], ip[64], mac[32];
+    unsigned int    flags, bytes[ETH_ALEN];
+    struct in_addr  addr;
+
+    fp = fopen("/proc/net/arp", "r");
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    addr.s_addr = peer -> ip;
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        if (sscanf(line, "%63s %*s %x %31s", ip, &flags, mac) != 3 || strcmp(ip, inet_ntoa(addr)) != 0 ||
+            !(flags & 0x2) ||
+            sscanf(mac, "%x:%x:%x:%x:%x:%x", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5]) != 6)
+        {
+            continue;
+        }
+
+        for (int i = 0; i < ETH_ALEN; i++)
+        {
+            peer -> mac[i] = (unsigned char) bytes[i];
+        }
+
+        peer -> has_mac = TRUE;
+        break;
+    }
+
+    fclose(fp);
+
+    return peer -> has_mac ? 0 : -1;
+}
+
+static void reclaim_completions(struct xdp *sock)
+{
+    uint32_t        consumer, producer;
+    struct xdp_frame frame;
+
+    consumer = *sock -> completion.consumer;
+    producer = __atomic_load_n(sock -> completion.producer, __ATOMIC_ACQUIRE);
+
+    while (consumer != producer)
+    {
+        frame.addr = ((uint64_t *) sock -> completion.descs)[consumer & sock -> completion.mask];
+        xdp_release(sock, &frame);
+        consumer++;
+    }
+
+    __atomic_store_n(sock -> completion.consumer, consumer, __ATOMIC_RELEASE);
+}
+
+static uint16_t ip_checksum(const void *data, size_t len)
+{
+    const uint16_t  *words;
+    uint32_t        sum;
+
+    words   = data;
+    sum     = 0;
+
+    for (size_t i = 0; i < len / 2; i++)
+    {
+        sum += words[i];
+    }
+
+    while (sum >> 16)
+    {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+
+    return (uint16_t) ~sum;
+}
+
+static long bpf(int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
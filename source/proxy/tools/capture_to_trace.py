@@ -0,0 +1,287 @@
+#!/usr/bin/env python3
+"""Turns a packet capture of one connection into traces for the proxy's --client-trace and --server-trace.
+
+The capture is taken next to the receiver, as server.pcapng is: the data direction (the one carrying PSH packets)
+becomes the client trace and the acknowledgements going back become the server trace. Outcomes are inferred:
+- a data packet is dropped when the receiver's sequence jumps past bytes it never saw, one drop per missing segment
+- an acknowledgement is dropped when the sender retransmits something it covers before the next one goes out
+- everything the receiver saw arrive is forwarded
+With --interval the data direction is summarised instead as a loss rate per interval, as timed link changes.
+"""
+
+import argparse
+import struct
+import sys
+
+
+DATA_SIZE = 512
+PSH = 4
+
+LINKTYPE_NULL = 0
+LINKTYPE_ETHERNET = 1
+LINKTYPE_RAW = 101
+LINKTYPE_LINUX_SLL = 113
+LINKTYPE_LINUX_SLL2 = 276
+
+
+def read_pcapng(data):
+    offset = 0
+    endian = '<'
+    interfaces = []
+
+    while offset + 12 <= len(data):
+        block_type, = struct.unpack_from(endian + 'I', data, offset)
+
+        # the section header sets the byte order for everything after it
+        if block_type == 0x0A0D0D0A:
+            endian = '<' if data[offset + 8:offset + 12] == b'\x4d\x3c\x2b\x1a' else '>'
+            interfaces = []
+
+        block_length, = struct.unpack_from(endian + 'I', data, offset + 4)
+        if block_length < 12:
+            break
+        body = data[offset + 8:offset + block_length - 4]
+
+        if block_type == 0x00000001:
+            linktype, = struct.unpack_from(endian + 'H', body, 0)
+            interfaces.append((linktype, interface_resolution(body[8:], endian)))
+        elif block_type == 0x00000006:
+            interface, high, low, captured = struct.unpack_from(endian + 'IIII', body, 0)
+            linktype, resolution = interfaces[interface]
+            yield ((high << 32) | low) * 1000000 // resolution, linktype, body[20:20 + captured]
+        elif block_type == 0x00000003:
+            captured = len(body) - 4
+            yield None, interfaces[0][0], body[4:4 + captured]
+
+        offset += block_length
+
+
+# if_tsresol, microseconds unless the interface says otherwise
+def interface_resolution(options, endian):
+    offset = 0
+
+    while offset + 4 <= len(options):
+        code, length = struct.unpack_from(endian + 'HH', options, offset)
+        if code == 0:
+            break
+        if code == 9 and length == 1:
+            value = options[offset + 4]
+            return 2 ** (value & 0x7f) if value & 0x80 else 10 ** value
+        offset += 4 + (length + 3) // 4 * 4
+
+    return 1000000
+
+
+def read_pcap(data):
+    magic = data[:4]
+    endian = '<' if magic in (b'\xd4\xc3\xb2\xa1', b'\x4d\x3c\xb2\xa1') else '>'
+    nanoseconds = magic in (b'\x4d\x3c\xb2\xa1', b'\xa1\xb2\x3c\x4d')
+    linktype, = struct.unpack_from(endian + 'I', data, 20)
+    offset = 24
+
+    while offset + 16 <= len(data):
+        seconds, fraction, captured, _ = struct.unpack_from(endian + 'IIII', data, offset)
+        offset += 16
+        usec = fraction // 1000 if nanoseconds else fraction
+        yield seconds * 1000000 + usec, linktype & 0xffff, data[offset:offset + captured]
+        offset += captured
+
+
+# (source, destination, udp payload) or None for anything that is not UDP over IP
+def udp_datagram(linktype, frame):
+    if linktype == LINKTYPE_ETHERNET:
+        ethertype, = struct.unpack_from('!H', frame, 12)
+        offset = 14
+        while ethertype in (0x8100, 0x88a8):
+            ethertype, = struct.unpack_from('!H', frame, offset + 2)
+            offset += 4
+    elif linktype == LINKTYPE_LINUX_SLL:
+        ethertype, = struct.unpack_from('!H', frame, 14)
+        offset = 16
+    elif linktype == LINKTYPE_LINUX_SLL2:
+        ethertype, = struct.unpack_from('!H', frame, 0)
+        offset = 20
+    elif linktype == LINKTYPE_NULL:
+        family = struct.unpack_from('<I', frame, 0)[0]
+        ethertype = 0x0800 if family == 2 else 0x86dd
+        offset = 4
+    elif linktype == LINKTYPE_RAW:
+        ethertype = 0x0800 if frame[0] >> 4 == 4 else 0x86dd
+        offset = 0
+    else:
+        return None
+
+    if ethertype == 0x0800:
+        header_length = (frame[offset] & 0x0f) * 4
+        if frame[offset + 9] != 17:
+            return None
+        source = frame[offset + 12:offset + 16]
+        destination = frame[offset + 16:offset + 20]
+        offset += header_length
+    elif ethertype == 0x86dd:
+        if frame[offset + 6] != 17:
+            return None
+        source = frame[offset + 8:offset + 24]
+        destination = frame[offset + 24:offset + 40]
+        offset += 40
+    else:
+        return None
+
+    source_port, destination_port, length = struct.unpack_from('!HHH', frame, offset)
+    return (source, source_port), (destination, destination_port), frame[offset + 8:offset + length]
+
+
+# seq, ack, flags and the data length, the data is the last DATA_SIZE bytes and ends at its first NUL
+def segment(payload):
+    if len(payload) < DATA_SIZE + 9:
+        return None
+
+    seq, ack, flags = struct.unpack_from('<IIB', payload, 0)
+    data = payload[len(payload) - DATA_SIZE:]
+    end = data.find(b'\0')
+
+    return seq, ack, flags, DATA_SIZE if end == -1 else end
+
+
+def load_packets(path):
+    with open(path, 'rb') as capture:
+        data = capture.read()
+
+    records = read_pcapng(data) if data[:4] == b'\x0a\x0d\x0d\x0a' else read_pcap(data)
+    packets = []
+
+    for timestamp, linktype, frame in records:
+        try:
+            datagram = udp_datagram(linktype, frame)
+        except (struct.error, IndexError):
+            continue
+        if datagram is None:
+            continue
+
+        source, destination, payload = datagram
+        fields = segment(payload)
+        if fields is not None:
+            packets.append((timestamp, source, destination) + fields)
+
+    return packets
+
+
+# the direction that carries data, and the one its acknowledgements come back on
+def split_directions(packets):
+    carried = {}
+
+    for packet in packets:
+        if packet[5] & PSH:
+            carried[(packet[1], packet[2])] = carried.get((packet[1], packet[2]), 0) + 1
+
+    if not carried:
+        sys.exit('No data packets of the protocol in the capture.')
+
+    data_direction = max(carried, key=carried.get)
+    ack_direction = (data_direction[1], data_direction[0])
+
+    return ([p for p in packets if (p[1], p[2]) == data_direction],
+            [p for p in packets if (p[1], p[2]) == ack_direction])
+
+
+def data_outcomes(data_packets):
+    outcomes = []
+    seen = set()
+    expected = None
+    lengths = []
+
+    for timestamp, _, _, seq, _, flags, length in data_packets:
+        if flags & PSH:
+            if expected is not None and seq > expected:
+                average = sum(lengths) / len(lengths) if lengths else length or 1
+                outcomes.extend([(timestamp, 'drop')] * max(1, round((seq - expected) / max(average, 1))))
+            if seq not in seen:
+                seen.add(seq)
+                lengths.append(length)
+            expected = max(expected or 0, seq + length)
+        outcomes.append((timestamp, 'forward'))
+
+    return outcomes
+
+
+def ack_outcomes(data_packets, ack_packets):
+    events = sorted([(p[0], 0, p) for p in data_packets] + [(p[0], 1, p) for p in ack_packets],
+                    key=lambda event: (event[0] or 0, event[1]))
+    outcomes = []
+    seen = set()
+    pending = None
+
+    for _, is_ack, packet in events:
+        _, _, _, seq, ack, flags, length = packet
+
+        if is_ack:
+            if pending is not None:
+                outcomes.append(pending)
+            pending = 'forward'
+            pending_ack = ack
+            continue
+
+        # the sender went back over what the last acknowledgement covered, so that one never reached it
+        if flags & PSH and seq in seen and pending == 'forward' and seq + length <= pending_ack:
+            pending = 'drop'
+        if flags & PSH:
+            seen.add(seq)
+
+    if pending is not None:
+        outcomes.append(pending)
+
+    return outcomes
+
+
+def timed_loss(outcomes, interval):
+    start = outcomes[0][0]
+    lines = []
+    bucket, sent, lost = 0, 0, 0
+
+    for timestamp, outcome in outcomes:
+        while timestamp - start >= (bucket + 1) * interval:
+            lines.append('@%d loss=%.2f' % (bucket * interval, 100 * lost / sent if sent else 0))
+            bucket, sent, lost = bucket + 1, 0, 0
+        sent += 1
+        lost += outcome == 'drop'
+
+    lines.append('@%d loss=%.2f' % (bucket * interval, 100 * lost / sent if sent else 0))
+
+    return lines
+
+
+def write_trace(path, source, lines):
+    with open(path, 'w') as trace:
+        trace.write('# inferred from %s\n' % source)
+        for line in lines:
+            trace.write(line + '\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Convert a pcap or pcapng capture into proxy impairment traces.')
+    parser.add_argument('capture', help='pcap or pcapng file of one connection, captured at the receiver')
+    parser.add_argument('--client-trace', default='client.trace', help='where the data direction is written')
+    parser.add_argument('--server-trace', default='server.trace', help='where the acknowledgements are written')
+    parser.add_argument('--interval', type=int, default=0,
+                        help='write the data direction as a loss rate per this many microseconds instead')
+    args = parser.parse_args()
+
+    data_packets, ack_packets = split_directions(load_packets(args.capture))
+    outcomes = data_outcomes(data_packets)
+
+    if args.interval > 0:
+        if any(timestamp is None for timestamp, _ in outcomes):
+            sys.exit('The capture has packets without timestamps, --interval needs them.')
+        write_trace(args.client_trace, args.capture, timed_loss(outcomes, args.interval))
+    else:
+        write_trace(args.client_trace, args.capture, [outcome for _, outcome in outcomes])
+
+    write_trace(args.server_trace, args.capture, ack_outcomes(data_packets, ack_packets))
+
+    print('%s: %d data packets, %d dropped' % (args.client_trace, len(outcomes),
+                                               sum(outcome == 'drop' for _, outcome in outcomes)))
+    print('%s: %d acknowledgements' % (args.server_trace, len(ack_packets)))
+
+
+if __name__ == '__main__':
+    main()
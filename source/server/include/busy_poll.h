@@ -0,0 +1,25 @@
+#ifndef SERVER_BUSY_POLL_H
+#define SERVER_BUSY_POLL_H
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include "fsm.h"
+
+#define BUSY_POLL_MAX_USEC 100000
+#define MAX_PINNED_CPUS 64
+// a failed non-blocking read is cheaper than reading the clock, so the budget is checked every few spins
+#define SPIN_CLOCK_INTERVAL 64
+
+typedef struct cpu_list
+{
+    int                         cpus[MAX_PINNED_CPUS];
+    int                         count;
+} cpu_list;
+
+int                 parse_busy_poll(const char *str, unsigned int *usec, struct fsm_error *err);
+int                 parse_cpu_list(const char *str, struct cpu_list *list, struct fsm_error *err);
+int                 socket_busy_poll(int sockfd, unsigned int usec, struct fsm_error *err);
+ssize_t             spin_recvmsg(int sockfd, struct msghdr *msg, unsigned int budget_usec);
+int                 pin_thread(const struct cpu_list *list, int index, struct fsm_error *err);
+
+#endif //SERVER_BUSY_POLL_H
@@ -10,14 +10,19 @@
 #include <inttypes.h>
 #include "fsm.h"
 
+#define MAX_WORKERS 64
+
 int                 parse_arguments(int argc, char *argv[], char **server_addr,
                                     char **client_addr, char **server_port_str,
-                                    char **client_port_str, struct fsm_error *err);
+                                    char **client_port_str, char **workers_str, char **busy_poll_str,
+                                    char **cpus_str, char **delivery_path, struct fsm_error *err);
 void                usage(const char *program_name);
 int                 handle_arguments(const char *binary_name, const char *server_addr,
                                      const char *client_addr, const char *server_port_str,
-                                     const char *client_port_str, in_port_t *server_port,
-                                     in_port_t *client_port, struct fsm_error *err);
+                                     const char *client_port_str, const char *workers_str,
+                                     in_port_t *server_port, in_port_t *client_port,
+                                     int *num_of_workers, struct fsm_error *err);
 int                 parse_in_port_t(const char *binary_name, const char *str, in_port_t *port, struct fsm_error *err);
+int                 parse_workers(const char *binary_name, const char *str, int *num_of_workers, struct fsm_error *err);
 
 #endif //CLIENT_COMMAND_LINE_H
@@ -0,0 +1,82 @@
+#ifndef SERVER_CONNECTION_TABLE_H
+#define SERVER_CONNECTION_TABLE_H
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include "fsm.h"
+#include "packet_config.h"
+
+// must be a power of two, the hash is masked with size - 1
+#define CONNECTION_TABLE_BUCKETS 4096
+// a connection id is worker (8 bits) | generation (8 bits) | slot (16 bits), 0 is never handed out
+#define CONNECTION_SLOT_BITS 16
+#define CONNECTION_GENERATION_BITS 8
+#define CONNECTION_WORKER_SHIFT (CONNECTION_SLOT_BITS + CONNECTION_GENERATION_BITS)
+#define CONNECTION_MAX_WORKERS (1 << (32 - CONNECTION_WORKER_SHIFT))
+#define CONNECTION_WORKER(id) ((int) ((id) >> CONNECTION_WORKER_SHIFT))
+// past this a new SYN is turned away instead of growing the table without bound
+#define MAX_CONNECTIONS (1 << CONNECTION_SLOT_BITS)
+#define CONNECTION_IDLE_TIMEOUT 60
+// connections come out of slabs of this many, allocated the first time a slot in their range is needed
+#define CONNECTION_SLAB_BITS 10
+#define CONNECTION_SLAB_SIZE (1 << CONNECTION_SLAB_BITS)
+#define CONNECTION_SLABS (MAX_CONNECTIONS / CONNECTION_SLAB_SIZE)
+#define CONNECTION_GENERATION(id) (((id) >> CONNECTION_SLOT_BITS) & ((1 << CONNECTION_GENERATION_BITS) - 1))
+
+// everything a data packet touches once the handshake is complete, 24 bytes so blocks share cache lines;
+// found by id, or by address until the peer has seen its id in a reply
+typedef struct connection
+{
+    // a free block keeps only its slot here, generation 0 is never handed out
+    uint32_t                    id;
+    uint32_t                    expected_seq_number;
+    time_t                      last_active;
+    // the address bucket chain while in use, the free list while not
+    struct connection           *next;
+} connection;
+
+// only the address lookup and rebinding read the peer, so it sits apart from the hot blocks
+typedef union connection_peer
+{
+    struct sockaddr             sa;
+    struct sockaddr_in          v4;
+    struct sockaddr_in6         v6;
+} connection_peer;
+
+typedef struct connection_slab
+{
+    struct connection           hot[CONNECTION_SLAB_SIZE];
+    union connection_peer       cold[CONNECTION_SLAB_SIZE];
+    // the last generation each slot handed out, survives the slot being freed
+    uint8_t                     generations[CONNECTION_SLAB_SIZE];
+} connection_slab;
+
+// returning TRUE drops the visited connection from the table
+typedef int (*connection_visitor)(struct connection *conn, void *arg);
+
+// slabs are only given back when the table is destroyed, a freed block goes to the front of the free list
+typedef struct connection_table
+{
+    struct connection           **buckets;
+    struct connection_slab      *slabs[CONNECTION_SLABS];
+    struct connection           *free_list;
+    size_t                      slab_count, count;
+    uint32_t                    worker_id;
+} connection_table;
+
+int                 connection_table_init(struct connection_table *table, int worker_id, struct fsm_error *err);
+struct connection   *connection_find(struct connection_table *table, const struct sockaddr_storage *peer);
+struct connection   *connection_find_id(struct connection_table *table, uint32_t id);
+struct connection   *connection_create(struct connection_table *table, const struct sockaddr_storage *peer,
+                                       struct fsm_error *err);
+void                connection_rebind(struct connection_table *table, struct connection *conn,
+                                      const struct sockaddr_storage *peer);
+void                connection_remove(struct connection_table *table, struct connection *conn);
+void                connection_table_sweep(struct connection_table *table, connection_visitor visit, void *arg);
+void                connection_table_destroy(struct connection_table *table);
+int                 connection_steer_workers(int sockfd, const int *worker_cpus, int num_of_workers,
+                                             struct fsm_error *err);
+time_t              connection_clock(void);
+
+#endif //SERVER_CONNECTION_TABLE_H
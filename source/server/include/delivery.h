@@ -0,0 +1,40 @@
+#ifndef SERVER_DELIVERY_H
+#define SERVER_DELIVERY_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include "fsm.h"
+#include "packet_config.h"
+
+// must be a power of two, positions are masked with size - 1
+#define DELIVERY_QUEUE_SIZE 1024
+// one writev takes at most this many segments, well under IOV_MAX
+#define DELIVERY_MAX_IOV 256
+#define DELIVERY_STDOUT "-"
+
+typedef struct delivery_chunk
+{
+    uint32_t                    length;
+    char                        data[DATA_SIZE];
+} delivery_chunk;
+
+// filled by one worker and drained by its own writer thread, so a slow disk or pipe only ever fills the queue
+typedef struct delivery
+{
+    int                         fd, running, failed;
+    pthread_t                   thread;
+    pthread_mutex_t             lock;
+    pthread_cond_t              ready;
+    struct delivery_chunk       *chunks;
+    // head is advanced by the writer once a batch is written, tail by the worker
+    uint32_t                    head, tail;
+    uint64_t                    delivered_bytes, writes;
+    uint32_t                    refused;
+} delivery;
+
+int                 delivery_claim_stdout(struct fsm_error *err);
+int                 delivery_start(struct delivery *sink, const char *path, struct fsm_error *err);
+int                 delivery_submit(struct delivery *sink, const char *data, size_t length);
+void                delivery_stop(struct delivery *sink);
+
+#endif //SERVER_DELIVERY_H
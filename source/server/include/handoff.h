@@ -0,0 +1,49 @@
+#ifndef SERVER_HANDOFF_H
+#define SERVER_HANDOFF_H
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include "fsm.h"
+#include "packet_config.h"
+
+// must be a power of two, positions are masked with size - 1
+#define HANDOFF_RING_SIZE 1024
+#define CACHE_LINE_SIZE 64
+
+// a cell is free for the producer whose position equals its sequence, and full once it is one past it
+typedef struct handoff_cell
+{
+    uint32_t                    sequence;
+    struct sockaddr_storage     peer;
+    struct timespec             received_at;
+    struct packet               pt;
+} handoff_cell;
+
+// many producers, one consumer: every worker may push, only the owning worker pops
+typedef struct handoff_ring
+{
+    struct handoff_cell         *cells;
+    int                         wakeup_fd;
+    // padded apart so producers claiming positions do not keep stealing the owner's line
+    char                        pad0[CACHE_LINE_SIZE];
+    uint32_t                    tail;
+    char                        pad1[CACHE_LINE_SIZE - sizeof(uint32_t)];
+    uint32_t                    head;
+    // written by the owner only, read for the exit report
+    uint32_t                    received;
+    char                        pad2[CACHE_LINE_SIZE - 2 * sizeof(uint32_t)];
+    // producers count what they could not hand over
+    uint32_t                    dropped;
+} handoff_ring;
+
+int                 handoff_init(struct handoff_ring *ring, struct fsm_error *err);
+int                 handoff_push(struct handoff_ring *ring, const struct sockaddr_storage *peer,
+                                 const struct packet *pt, const struct timespec *received_at);
+int                 handoff_pop(struct handoff_ring *ring, struct sockaddr_storage *peer,
+                                struct packet *pt, struct timespec *received_at);
+int                 handoff_pending(const struct handoff_ring *ring);
+int                 handoff_wait(struct handoff_ring *ring, int sockfd, int timeout_ms);
+void                handoff_destroy(struct handoff_ring *ring);
+
+#endif //SERVER_HANDOFF_H
@@ -11,6 +11,7 @@
 #include <arpa/inet.h>
 #include "protocol.h"
 #include "server_config.h"
+#include "receive_batch.h"
 
 #define DATA_SIZE 512
 
@@ -18,7 +19,6 @@ uint8_t                     first_empty_packet;
 uint8_t                     first_unacked_packet;
 uint8_t                     is_window_available;
 uint8_t                     window_size;
-struct sockaddr_storage     *list_of_connections;
 
 typedef struct header
 {
@@ -27,6 +27,9 @@ typedef struct header
     uint8_t                     flags;
     uint8_t                     window_size;
     uint16_t                    checksum;
+    // 0 until the server hands it out in its first reply after the handshake, the SYN-ACK still carries 0;
+    // sits in what used to be padding
+    uint32_t                    connection_id;
     struct timeval              tv;
 } header;
 
@@ -38,8 +41,9 @@ typedef struct packet
 
 int                 send_packet(int sockfd, struct sockaddr_storage *addr,
                                 struct packet *pt, FILE *fp, struct fsm_error *err);
-int                 receive_packet(int sockfd, struct packet *temp_packet, FILE *fp,
-                                    struct fsm_error *err);
+int                 receive_packet(int sockfd, struct receive_batch *batch,
+                                   struct sockaddr_storage *addr, struct packet **temp_packet,
+                                   FILE *fp, struct fsm_error *err);
 uint32_t            create_second_handshake_seq_number(void);
 uint32_t            create_ack_number(uint32_t previous_ack_number, uint32_t data_size);
 uint32_t            create_sequence_number(uint32_t prev_seq_number, uint32_t data_size);
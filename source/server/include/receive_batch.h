@@ -0,0 +1,40 @@
+#ifndef SERVER_RECEIVE_BATCH_H
+#define SERVER_RECEIVE_BATCH_H
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <time.h>
+#include "fsm.h"
+
+// the kernel's UDP_GRO_CNT_MAX, one coalesced read never holds more segments
+#define RECEIVE_BATCH_SIZE 64
+
+struct packet;
+struct packet_pool;
+
+typedef struct receive_batch
+{
+    struct packet_pool          *pool;
+    struct packet               *packets[RECEIVE_BATCH_SIZE];
+    struct iovec                iovs[RECEIVE_BATCH_SIZE];
+    size_t                      count, next;
+    struct sockaddr_storage     addr;
+    // the socket's running total of datagrams the kernel dropped on a full receive buffer
+    uint32_t                    kernel_drops;
+    // the kernel's arrival stamp of the last read, shared by every segment it coalesced
+    struct timespec             received_at;
+    // how long a refill spins on a non-blocking read before it blocks, 0 blocks straight away
+    unsigned int                spin_usec;
+} receive_batch;
+
+int                 receive_batch_init(struct receive_batch *batch, struct packet_pool *pool, int sockfd,
+                                       struct fsm_error *err);
+struct packet       *receive_batch_next(struct receive_batch *batch, int sockfd, struct sockaddr_storage *addr);
+int                 receive_batch_pending(const struct receive_batch *batch);
+void                receive_batch_destroy(struct receive_batch *batch);
+
+#endif //SERVER_RECEIVE_BATCH_H
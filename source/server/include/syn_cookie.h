@@ -0,0 +1,20 @@
+#ifndef SERVER_SYN_COOKIE_H
+#define SERVER_SYN_COOKIE_H
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include "fsm.h"
+
+// a cookie is counter (8 bits) | MAC (24 bits), the counter ticks once per period
+#define SYN_COOKIE_PERIOD 64
+#define SYN_COOKIE_COUNTER_SHIFT 24
+#define SYN_COOKIE_MAC_MASK ((1U << SYN_COOKIE_COUNTER_SHIFT) - 1)
+// a handshake ACK may answer a SYN-ACK sent up to this many periods ago
+#define SYN_COOKIE_MAX_AGE 2
+
+int                 syn_cookie_init(struct fsm_error *err);
+uint32_t            syn_cookie_make(const struct sockaddr_storage *peer, uint32_t isn, time_t now);
+int                 syn_cookie_check(const struct sockaddr_storage *peer, uint32_t isn, uint32_t cookie, time_t now);
+
+#endif //SERVER_SYN_COOKIE_H
@@ -0,0 +1,147 @@
+#include "busy_poll.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static long elapsed_usec(const struct timespec *start);
+
+int parse_busy_poll(const char *str, unsigned int *usec, struct fsm_error *err)
+{
+    char            *endptr;
+    uintmax_t       parsed_value;
+
+    errno           = 0;
+    parsed_value    = strtoumax(str, &endptr, 10);
+
+    if (errno != 0)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+    if (*endptr != '\0' || parsed_value > BUSY_POLL_MAX_USEC)
+    {
+        SET_ERROR(err, "busy poll budget must be 0-100000 microseconds.");
+        return -1;
+    }
+
+    *usec = (unsigned int) parsed_value;
+
+    return 0;
+}
+
+int parse_cpu_list(const char *str, struct cpu_list *list, struct fsm_error *err)
+{
+    const char      *cursor;
+    char            *endptr;
+    uintmax_t       parsed_value;
+
+    list -> count   = 0;
+    cursor          = str;
+
+    while (*cursor != '\0')
+    {
+        errno           = 0;
+        parsed_value    = strtoumax(cursor, &endptr, 10);
+
+        if (errno != 0 || endptr == cursor || (*endptr != ',' && *endptr != '\0') ||
+            parsed_value >= CPU_SETSIZE || list -> count == MAX_PINNED_CPUS)
+        {
+            SET_ERROR(err, "CPU list must look like 0,2,3.");
+            return -1;
+        }
+
+        list -> cpus[list -> count++] = (int) parsed_value;
+        cursor = *endptr == ',' ? endptr + 1 : endptr;
+    }
+
+    return 0;
+}
+
+int socket_busy_poll(int sockfd, unsigned int usec, struct fsm_error *err)
+{
+    int value;
+
+    // the driver is polled from inside recvmsg for up to this long before the socket sleeps
+    value = (int) usec;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+#ifdef SO_PREFER_BUSY_POLL
+    value = 1;
+
+    // best effort, older kernels simply keep interrupt-driven processing alongside the polling
+    setsockopt(sockfd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &value, sizeof(value));
+#endif
+
+    return 0;
+}
+
+ssize_t spin_recvmsg(int sockfd, struct msghdr *msg, unsigned int budget_usec)
+{
+    struct timespec start;
+    ssize_t         result;
+
+    if (budget_usec == 0)
+    {
+        return recvmsg(sockfd, msg, 0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (unsigned int i = 1; ; i++)
+    {
+        result = recvmsg(sockfd, msg, MSG_DONTWAIT);
+        if (result >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            return result;
+        }
+
+        if (i % SPIN_CLOCK_INTERVAL == 0 && elapsed_usec(&start) >= (long) budget_usec)
+        {
+            break;
+        }
+    }
+
+    // the budget ran out with nothing arriving, sleep like the default mode does
+    return recvmsg(sockfd, msg, 0);
+}
+
+int pin_thread(const struct cpu_list *list, int index, struct fsm_error *err)
+{
+    cpu_set_t   set;
+    int         result;
+
+    if (list -> count == 0)
+    {
+        return 0;
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(list -> cpus[index % list -> count], &set);
+
+    result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (result != 0)
+    {
+        SET_ERROR(err, strerror(result));
+        return -1;
+    }
+
+    return 0;
+}
+
+static long elapsed_usec(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start -> tv_sec) * 1000000L + (now.tv_nsec - start -> tv_nsec) / 1000L;
+}
@@ -3,18 +3,23 @@
 
 int parse_arguments(int argc, char *argv[], char **server_addr,
                 char **client_addr, char **server_port_str,
-                char **client_port_str, struct fsm_error *err)
+                char **client_port_str, char **workers_str, char **busy_poll_str,
+                char **cpus_str, char **delivery_path, struct fsm_error *err)
 {
     int opt;
-    bool C_flag, c_flag, S_flag, s_flag;
+    bool C_flag, c_flag, S_flag, s_flag, n_flag, b_flag, a_flag, o_flag;
 
     opterr = 0;
     C_flag = 0;
     c_flag = 0;
     S_flag = 0;
     s_flag = 0;
+    n_flag = 0;
+    b_flag = 0;
+    a_flag = 0;
+    o_flag = 0;
 
-    while ((opt = getopt(argc, argv, "C:c:S:s:h")) != -1)
+    while ((opt = getopt(argc, argv, "C:c:S:s:n:b:a:o:h")) != -1)
     {
         switch (opt)
         {
@@ -86,6 +91,74 @@ int parse_arguments(int argc, char *argv[], char **server_addr,
                 *server_port_str = optarg;
                 break;
             }
+            case 'n':
+            {
+                if (n_flag)
+                {
+                    char message[40];
+
+                    snprintf(message, sizeof(message), "option '-n' can only be passed in once.");
+                    usage(argv[0]);
+                    SET_ERROR(err, message);
+
+                    return -1;
+                }
+
+                n_flag++;
+                *workers_str = optarg;
+                break;
+            }
+            case 'b':
+            {
+                if (b_flag)
+                {
+                    char message[40];
+
+                    snprintf(message, sizeof(message), "option '-b' can only be passed in once.");
+                    usage(argv[0]);
+                    SET_ERROR(err, message);
+
+                    return -1;
+                }
+
+                b_flag++;
+                *busy_poll_str = optarg;
+                break;
+            }
+            case 'a':
+            {
+                if (a_flag)
+                {
+                    char message[40];
+
+                    snprintf(message, sizeof(message), "option '-a' can only be passed in once.");
+                    usage(argv[0]);
+                    SET_ERROR(err, message);
+
+                    return -1;
+                }
+
+                a_flag++;
+                *cpus_str = optarg;
+                break;
+            }
+            case 'o':
+            {
+                if (o_flag)
+                {
+                    char message[40];
+
+                    snprintf(message, sizeof(message), "option '-o' can only be passed in once.");
+                    usage(argv[0]);
+                    SET_ERROR(err, message);
+
+                    return -1;
+                }
+
+                o_flag++;
+                *delivery_path = optarg;
+                break;
+            }
             case 'h':
             {
                 usage(argv[0]);
@@ -115,19 +188,24 @@ int parse_arguments(int argc, char *argv[], char **server_addr,
 
 void usage(const char *program_name)
 {
-    fprintf(stderr, "Usage: %s [-C] <value> [-c] <value> [-S] <value> [-s] <value> [-h]\n", program_name);
+    fprintf(stderr, "Usage: %s [-C] <value> [-c] <value> [-S] <value> [-s] <value> [-n] <value> [-b] <value> [-a] <value> [-o] <value> [-h]\n", program_name);
     fputs("Options:\n", stderr);
     fputs("  -h                     Display this help message\n", stderr);
     fputs("  -C <value>             Option 'C' (required) with value, Sets the IP client_addr\n", stderr);
     fputs("  -c <value>             Option 'c' (required) with value, Sets the client port\n", stderr);
     fputs("  -S <value>             Option 'S' (required) with value, Sets the IP server_addr\n", stderr);
     fputs("  -s <value>             Option 's' (required) with value, Sets the server port\n", stderr);
+    fputs("  -n <value>             Option 'n' (optional) with value, Sets the number of worker threads\n", stderr);
+    fputs("  -b <value>             Option 'b' (optional) with value, Busy polls receives for this many microseconds\n", stderr);
+    fputs("  -a <value>             Option 'a' (optional) with value, Pins the worker threads to this comma separated CPU list\n", stderr);
+    fputs("  -o <value>             Option 'o' (optional) with value, Writes received data in order to this file, FIFO or - for stdout, diagnostics then go to stderr\n", stderr);
 }
 
 int handle_arguments(const char *binary_name, const char *server_addr,
                                      const char *client_addr, const char *server_port_str,
-                                     const char *client_port_str, in_port_t *server_port,
-                                     in_port_t *client_port, struct fsm_error *err)
+                                     const char *client_port_str, const char *workers_str,
+                                     in_port_t *server_port, in_port_t *client_port,
+                                     int *num_of_workers, struct fsm_error *err)
 {
     if(server_addr == NULL)
     {
@@ -173,6 +251,12 @@ int handle_arguments(const char *binary_name, const char *server_addr,
         return -1;
     }
 
+    if (workers_str != NULL && parse_workers(binary_name, workers_str, num_of_workers, err) == -1)
+    {
+        printf("for workers: %s\n", workers_str);
+        return -1;
+    }
+
 
     return 0;
 }
@@ -213,3 +297,38 @@ int parse_in_port_t(const char *binary_name, const char *str, in_port_t *port, s
     *port = (in_port_t)parsed_value;
     return 0;
 }
+
+int parse_workers(const char *binary_name, const char *str, int *num_of_workers, struct fsm_error *err)
+{
+    char            *endptr;
+    uintmax_t       parsed_value;
+
+    errno           = 0;
+    parsed_value    = strtoumax(str, &endptr, 10);
+
+    if(errno != 0)
+    {
+        SET_ERROR(err, strerror(errno));
+
+        return -1;
+    }
+
+    if(*endptr != '\0')
+    {
+        SET_ERROR(err, "Invalid characters in input.");
+        usage(binary_name);
+
+        return -1;
+    }
+
+    if(parsed_value == 0 || parsed_value > MAX_WORKERS)
+    {
+        SET_ERROR(err, "number of workers out of range.");
+        usage(binary_name);
+
+        return -1;
+    }
+
+    *num_of_workers = (int)parsed_value;
+    return 0;
+}
@@ -0,0 +1,346 @@
+#include "connection_table.h"
+#include <linux/filter.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t hash_peer(const struct sockaddr *peer);
+static int same_peer(const struct sockaddr *a, const struct sockaddr *b);
+static void unlink_peer(struct connection_table *table, struct connection *conn);
+static union connection_peer *peer_of(struct connection_table *table, const struct connection *conn);
+static void set_peer(union connection_peer *cold, const struct sockaddr_storage *peer);
+static int grow(struct connection_table *table);
+
+int connection_table_init(struct connection_table *table, int worker_id, struct fsm_error *err)
+{
+    memset(table -> slabs, 0, sizeof(table -> slabs));
+    table -> buckets        = calloc(CONNECTION_TABLE_BUCKETS, sizeof(*table -> buckets));
+    table -> free_list      = NULL;
+    table -> slab_count     = 0;
+    table -> count          = 0;
+    table -> worker_id      = (uint32_t) worker_id;
+
+    if (table -> buckets == NULL)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+struct connection *connection_find(struct connection_table *table, const struct sockaddr_storage *peer)
+{
+    struct connection *conn;
+
+    for (conn = table -> buckets[hash_peer((const struct sockaddr *) peer)]; conn != NULL; conn = conn -> next)
+    {
+        if (same_peer(&peer_of(table, conn) -> sa, (const struct sockaddr *) peer))
+        {
+            return conn;
+        }
+    }
+
+    return NULL;
+}
+
+// one probe; a stale id from an earlier occupant of the slot fails the generation check
+struct connection *connection_find_id(struct connection_table *table, uint32_t id)
+{
+    struct connection_slab  *slab;
+    struct connection       *conn;
+    uint32_t                slot;
+
+    slot = id & (MAX_CONNECTIONS - 1);
+    slab = table -> slabs[slot >> CONNECTION_SLAB_BITS];
+
+    // a free block holds just its slot, which a forged id with generation 0 would otherwise match
+    if (slab == NULL || CONNECTION_GENERATION(id) == 0)
+    {
+        return NULL;
+    }
+
+    conn = &slab -> hot[slot & (CONNECTION_SLAB_SIZE - 1)];
+
+    return conn -> id == id ? conn : NULL;
+}
+
+struct connection *connection_create(struct connection_table *table, const struct sockaddr_storage *peer,
+                                     struct fsm_error *err)
+{
+    struct connection_slab  *slab;
+    struct connection       *conn;
+    uint32_t                bucket, slot, generation;
+
+    if (table -> free_list == NULL && grow(table) == -1)
+    {
+        SET_ERROR(err, table -> slab_count == CONNECTION_SLABS ? "Connection table full." : strerror(errno));
+        return NULL;
+    }
+
+    conn                        = table -> free_list;
+    table -> free_list          = conn -> next;
+    slot                        = conn -> id;
+    slab                        = table -> slabs[slot >> CONNECTION_SLAB_BITS];
+    generation                  = ++slab -> generations[slot & (CONNECTION_SLAB_SIZE - 1)];
+
+    // generation 0 marks a free block, and would make slot 0 of worker 0 the reserved id 0
+    if (generation == 0)
+    {
+        generation              = ++slab -> generations[slot & (CONNECTION_SLAB_SIZE - 1)];
+    }
+
+    bucket                      = hash_peer((const struct sockaddr *) peer);
+    conn -> id                  = table -> worker_id << CONNECTION_WORKER_SHIFT |
+                                  generation << CONNECTION_SLOT_BITS | slot;
+    conn -> expected_seq_number = 0;
+    conn -> last_active         = connection_clock();
+    conn -> next                = table -> buckets[bucket];
+    table -> buckets[bucket]    = conn;
+    table -> count++;
+    set_peer(&slab -> cold[slot & (CONNECTION_SLAB_SIZE - 1)], peer);
+
+    return conn;
+}
+
+// the peer's address changed under NAT, the id still names the same connection
+void connection_rebind(struct connection_table *table, struct connection *conn,
+                       const struct sockaddr_storage *peer)
+{
+    uint32_t bucket;
+
+    if (same_peer(&peer_of(table, conn) -> sa, (const struct sockaddr *) peer))
+    {
+        return;
+    }
+
+    unlink_peer(table, conn);
+
+    bucket                      = hash_peer((const struct sockaddr *) peer);
+    conn -> next                = table -> buckets[bucket];
+    table -> buckets[bucket]    = conn;
+    set_peer(peer_of(table, conn), peer);
+}
+
+void connection_remove(struct connection_table *table, struct connection *conn)
+{
+    unlink_peer(table, conn);
+    conn -> id          = conn -> id & (MAX_CONNECTIONS - 1);
+    conn -> next        = table -> free_list;
+    table -> free_list  = conn;
+    table -> count--;
+}
+
+void connection_table_sweep(struct connection_table *table, connection_visitor visit, void *arg)
+{
+    struct connection *conn;
+
+    for (size_t i = 0; i < table -> slab_count; i++)
+    {
+        for (size_t j = 0; j < CONNECTION_SLAB_SIZE; j++)
+        {
+            conn = &table -> slabs[i] -> hot[j];
+
+            if (CONNECTION_GENERATION(conn -> id) != 0 && visit(conn, arg))
+            {
+                connection_remove(table, conn);
+            }
+        }
+    }
+}
+
+void connection_table_destroy(struct connection_table *table)
+{
+    for (size_t i = 0; i < table -> slab_count; i++)
+    {
+        free(table -> slabs[i]);
+        table -> slabs[i] = NULL;
+    }
+
+    free(table -> buckets);
+    table -> buckets        = NULL;
+    table -> free_list      = NULL;
+    table -> slab_count     = 0;
+    table -> count          = 0;
+}
+
+// SO_REUSEPORT would hash a rebound peer onto another worker, which has never heard of its id.
+// This program sends a packet to the worker named in its id instead. A SYN has id 0: with pinned
+// workers it goes to the one on the CPU that took it, otherwise the out of range index it gets back
+// leaves it to the kernel's usual hash.
+int connection_steer_workers(int sockfd, const int *worker_cpus, int num_of_workers, struct fsm_error *err)
+{
+    struct sock_filter  code[2 * CONNECTION_MAX_WORKERS + 6];
+    struct sock_fprog   program;
+    size_t              length, pinned;
+
+    pinned = 0;
+    if (worker_cpus != NULL)
+    {
+        pinned = (size_t) num_of_workers;
+    }
+
+    length          = 0;
+    code[length++]  = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct header, connection_id));
+    code[length++]  = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0,
+                                                    (uint8_t) ((pinned > 0 ? 1 + 2 * pinned : 0) + 1));
+
+    if (pinned > 0)
+    {
+        code[length++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+
+        // the first worker pinned to a CPU wins, the ones sharing it only get peers by hash
+        for (size_t i = 0; i < pinned; i++)
+        {
+            code[length++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                                                           (uint32_t) worker_cpus[i], 0, 1);
+            code[length++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, (uint32_t) i);
+        }
+    }
+
+    code[length++]  = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+    // the header is host order, on little endian the worker byte is the last one
+    code[length++]  = (struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_ABS, offsetof(struct header, connection_id) +
+                                                    (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? 3 : 0));
+    code[length++]  = (struct sock_filter) BPF_STMT(BPF_RET | BPF_A, 0);
+
+    program.len     = (unsigned short) length;
+    program.filter  = code;
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+// timeouts only need seconds, and must not jump when the wall clock is set
+time_t connection_clock(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec;
+}
+
+// FNV-1a over the address and port, the rest of the sockaddr is padding
+static uint32_t hash_peer(const struct sockaddr *peer)
+{
+    const unsigned char *bytes;
+    size_t              length;
+    uint32_t            hash;
+    in_port_t           port;
+
+    if (peer -> sa_family == AF_INET)
+    {
+        bytes   = (const unsigned char *) &((const struct sockaddr_in *) peer) -> sin_addr;
+        length  = sizeof(struct in_addr);
+        port    = ((const struct sockaddr_in *) peer) -> sin_port;
+    }
+    else
+    {
+        bytes   = (const unsigned char *) &((const struct sockaddr_in6 *) peer) -> sin6_addr;
+        length  = sizeof(struct in6_addr);
+        port    = ((const struct sockaddr_in6 *) peer) -> sin6_port;
+    }
+
+    hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+
+    hash = (hash ^ (port & 0xff)) * 16777619u;
+    hash = (hash ^ (port >> 8)) * 16777619u;
+
+    return hash & (CONNECTION_TABLE_BUCKETS - 1);
+}
+
+static int same_peer(const struct sockaddr *a, const struct sockaddr *b)
+{
+    if (a -> sa_family != b -> sa_family)
+    {
+        return 0;
+    }
+
+    if (a -> sa_family == AF_INET)
+    {
+        const struct sockaddr_in *a4 = (const struct sockaddr_in *) a, *b4 = (const struct sockaddr_in *) b;
+
+        return a4 -> sin_port == b4 -> sin_port && a4 -> sin_addr.s_addr == b4 -> sin_addr.s_addr;
+    }
+
+    const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *) a, *b6 = (const struct sockaddr_in6 *) b;
+
+    return a6 -> sin6_port == b6 -> sin6_port &&
+           memcmp(&a6 -> sin6_addr, &b6 -> sin6_addr, sizeof(a6 -> sin6_addr)) == 0;
+}
+
+static void unlink_peer(struct connection_table *table, struct connection *conn)
+{
+    struct connection **link;
+
+    for (link = &table -> buckets[hash_peer(&peer_of(table, conn) -> sa)]; *link != NULL; link = &(*link) -> next)
+    {
+        if (*link == conn)
+        {
+            *link = conn -> next;
+            return;
+        }
+    }
+}
+
+static union connection_peer *peer_of(struct connection_table *table, const struct connection *conn)
+{
+    uint32_t slot;
+
+    slot = conn -> id & (MAX_CONNECTIONS - 1);
+
+    return &table -> slabs[slot >> CONNECTION_SLAB_BITS] -> cold[slot & (CONNECTION_SLAB_SIZE - 1)];
+}
+
+// only the family, address and port are kept, a sockaddr_storage would be four times the size
+static void set_peer(union connection_peer *cold, const struct sockaddr_storage *peer)
+{
+    if (peer -> ss_family == AF_INET6)
+    {
+        cold -> v6 = *(const struct sockaddr_in6 *) peer;
+        return;
+    }
+
+    cold -> v4 = *(const struct sockaddr_in *) peer;
+}
+
+// one allocation per CONNECTION_SLAB_SIZE connections; its blocks go on the free list lowest slot first
+static int grow(struct connection_table *table)
+{
+    struct connection_slab  *slab;
+    uint32_t                base;
+
+    if (table -> slab_count == CONNECTION_SLABS)
+    {
+        return -1;
+    }
+
+    slab = calloc(1, sizeof(*slab));
+    if (slab == NULL)
+    {
+        return -1;
+    }
+
+    base = (uint32_t) table -> slab_count << CONNECTION_SLAB_BITS;
+
+    for (uint32_t i = CONNECTION_SLAB_SIZE; i-- > 0; )
+    {
+        slab -> hot[i].id   = base + i;
+        slab -> hot[i].next = table -> free_list;
+        table -> free_list  = &slab -> hot[i];
+    }
+
+    table -> slabs[table -> slab_count++] = slab;
+
+    return 0;
+}
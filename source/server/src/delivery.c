@@ -0,0 +1,228 @@
+#include "delivery.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static void *writer_function(void *ptr);
+static int write_all(int fd, struct iovec *iov, int count);
+
+// the real stdout once delivery_claim_stdout took it over, -1 until then
+static int stdout_fd = -1;
+
+// the data stream gets stdout to itself: the diagnostics printed on it from then on land on stderr
+int delivery_claim_stdout(struct fsm_error *err)
+{
+    fflush(stdout);
+
+    stdout_fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (stdout_fd == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    return 0;
+}
+
+int delivery_start(struct delivery *sink, const char *path, struct fsm_error *err)
+{
+    int result;
+
+    memset(sink, 0, sizeof(*sink));
+
+    // a reader going away must show up as EPIPE on the writer, not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    sink -> fd = strcmp(path, DELIVERY_STDOUT) == 0 ? dup(stdout_fd == -1 ? STDOUT_FILENO : stdout_fd) :
+                 open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (sink -> fd == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+    sink -> chunks = malloc(DELIVERY_QUEUE_SIZE * sizeof(*sink -> chunks));
+    if (sink -> chunks == NULL)
+    {
+        SET_ERROR(err, strerror(errno));
+        close(sink -> fd);
+        return -1;
+    }
+
+    pthread_mutex_init(&sink -> lock, NULL);
+    pthread_cond_init(&sink -> ready, NULL);
+    sink -> running = 1;
+
+    result = pthread_create(&sink -> thread, NULL, writer_function, sink);
+    if (result != 0)
+    {
+        SET_ERROR(err, strerror(result));
+        sink -> running = 0;
+        delivery_stop(sink);
+        return -1;
+    }
+
+    return 0;
+}
+
+// never blocks on the writer: a full queue or a broken sink refuses the segment, the peer resends it
+int delivery_submit(struct delivery *sink, const char *data, size_t length)
+{
+    struct delivery_chunk   *chunk;
+    int                     result;
+
+    result = -1;
+
+    pthread_mutex_lock(&sink -> lock);
+
+    if (!sink -> failed && sink -> tail - sink -> head < DELIVERY_QUEUE_SIZE)
+    {
+        chunk           = &sink -> chunks[sink -> tail & (DELIVERY_QUEUE_SIZE - 1)];
+        chunk -> length = (uint32_t) (length < DATA_SIZE ? length : DATA_SIZE);
+        memcpy(chunk -> data, data, chunk -> length);
+        sink -> tail++;
+        result          = 0;
+        pthread_cond_signal(&sink -> ready);
+    }
+    else
+    {
+        sink -> refused++;
+    }
+
+    pthread_mutex_unlock(&sink -> lock);
+
+    return result;
+}
+
+// whatever is still queued is written out before the writer exits
+void delivery_stop(struct delivery *sink)
+{
+    if (sink -> chunks == NULL)
+    {
+        return;
+    }
+
+    if (sink -> running)
+    {
+        pthread_mutex_lock(&sink -> lock);
+        sink -> running = 0;
+        pthread_cond_signal(&sink -> ready);
+        pthread_mutex_unlock(&sink -> lock);
+        pthread_join(sink -> thread, NULL);
+    }
+
+    pthread_cond_destroy(&sink -> ready);
+    pthread_mutex_destroy(&sink -> lock);
+    close(sink -> fd);
+    free(sink -> chunks);
+    sink -> chunks = NULL;
+}
+
+static void *writer_function(void *ptr)
+{
+    struct delivery *sink;
+    struct iovec    iov[DELIVERY_MAX_IOV];
+    uint32_t        head, tail;
+    uint64_t        length;
+    int             count, failed;
+
+    sink = (struct delivery *) ptr;
+
+    pthread_mutex_lock(&sink -> lock);
+
+    for (;;)
+    {
+        while (sink -> running && sink -> head == sink -> tail)
+        {
+            pthread_cond_wait(&sink -> ready, &sink -> lock);
+        }
+
+        head = sink -> head;
+        tail = sink -> tail;
+
+        if (head == tail || sink -> failed)
+        {
+            break;
+        }
+
+        // the worker only writes past tail, so the queued segments can be read without the lock
+        pthread_mutex_unlock(&sink -> lock);
+
+        count   = 0;
+        length  = 0;
+        while (head + (uint32_t) count != tail && count < DELIVERY_MAX_IOV)
+        {
+            struct delivery_chunk *chunk;
+
+            chunk               = &sink -> chunks[(head + (uint32_t) count) & (DELIVERY_QUEUE_SIZE - 1)];
+            iov[count].iov_base = chunk -> data;
+            iov[count].iov_len  = chunk -> length;
+            length             += chunk -> length;
+            count++;
+        }
+
+        failed = write_all(sink -> fd, iov, count) == -1;
+        if (failed)
+        {
+            fprintf(stderr, "Delivery stopped: %s\n", strerror(errno));
+        }
+
+        pthread_mutex_lock(&sink -> lock);
+
+        // the segments were already acknowledged as queued, past a failed write none are taken anymore
+        sink -> failed  = failed;
+        sink -> head    = head + (uint32_t) count;
+        sink -> writes++;
+
+        // only what reached the sink counts as delivered in the exit report
+        if (!failed)
+        {
+            sink -> delivered_bytes += length;
+        }
+    }
+
+    pthread_mutex_unlock(&sink -> lock);
+
+    return NULL;
+}
+
+// segments of one batch go out in a single call unless the sink takes them in pieces
+static int write_all(int fd, struct iovec *iov, int count)
+{
+    ssize_t written;
+
+    while (count > 0)
+    {
+        written = writev(fd, iov, count);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return -1;
+        }
+
+        while (count > 0 && (size_t) written >= iov -> iov_len)
+        {
+            written -= (ssize_t) iov -> iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count > 0)
+        {
+            iov -> iov_base = (char *) iov -> iov_base + written;
+            iov -> iov_len -= (size_t) written;
+        }
+    }
+
+    return 0;
+}
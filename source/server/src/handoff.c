@@ -0,0 +1,147 @@
+#include "handoff.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+int handoff_init(struct handoff_ring *ring, struct fsm_error *err)
+{
+    memset(ring, 0, sizeof(*ring));
+
+    ring -> wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ring -> wakeup_fd == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+    ring -> cells = malloc(HANDOFF_RING_SIZE * sizeof(*ring -> cells));
+    if (ring -> cells == NULL)
+    {
+        SET_ERROR(err, strerror(errno));
+        close(ring -> wakeup_fd);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < HANDOFF_RING_SIZE; i++)
+    {
+        ring -> cells[i].sequence = i;
+    }
+
+    return 0;
+}
+
+// producers race for a position with one compare and swap, the cell's sequence publishes the copy
+int handoff_push(struct handoff_ring *ring, const struct sockaddr_storage *peer,
+                 const struct packet *pt, const struct timespec *received_at)
+{
+    struct handoff_cell *cell;
+    uint32_t            position, sequence;
+    uint64_t            one;
+
+    position = __atomic_load_n(&ring -> tail, __ATOMIC_RELAXED);
+
+    for (;;)
+    {
+        cell        = &ring -> cells[position & (HANDOFF_RING_SIZE - 1)];
+        sequence    = __atomic_load_n(&cell -> sequence, __ATOMIC_ACQUIRE);
+
+        if (sequence == position)
+        {
+            if (__atomic_compare_exchange_n(&ring -> tail, &position, position + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if ((int32_t) (sequence - position) < 0)
+        {
+            // the owner is a full lap behind, dropping is what the kernel would have done
+            __atomic_fetch_add(&ring -> dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+        else
+        {
+            position = __atomic_load_n(&ring -> tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell -> peer        = *peer;
+    cell -> pt          = *pt;
+    cell -> received_at = *received_at;
+    __atomic_store_n(&cell -> sequence, position + 1, __ATOMIC_RELEASE);
+
+    one = 1;
+    write(ring -> wakeup_fd, &one, sizeof(one));
+
+    return 0;
+}
+
+int handoff_pop(struct handoff_ring *ring, struct sockaddr_storage *peer,
+                struct packet *pt, struct timespec *received_at)
+{
+    struct handoff_cell *cell;
+    uint32_t            position;
+
+    position    = ring -> head;
+    cell        = &ring -> cells[position & (HANDOFF_RING_SIZE - 1)];
+
+    if (__atomic_load_n(&cell -> sequence, __ATOMIC_ACQUIRE) != position + 1)
+    {
+        return -1;
+    }
+
+    *peer           = cell -> peer;
+    *pt             = cell -> pt;
+    *received_at    = cell -> received_at;
+    __atomic_store_n(&cell -> sequence, position + HANDOFF_RING_SIZE, __ATOMIC_RELEASE);
+    ring -> head    = position + 1;
+    ring -> received++;
+
+    return 0;
+}
+
+int handoff_pending(const struct handoff_ring *ring)
+{
+    return ring -> cells != NULL &&
+           __atomic_load_n(&ring -> cells[ring -> head & (HANDOFF_RING_SIZE - 1)].sequence, __ATOMIC_ACQUIRE) ==
+           ring -> head + 1;
+}
+
+// 1 once the socket is readable, 0 on a wakeup or timeout; the caller drains the ring either way
+int handoff_wait(struct handoff_ring *ring, int sockfd, int timeout_ms)
+{
+    struct pollfd   fds[2];
+    uint64_t        count;
+
+    fds[0].fd       = sockfd;
+    fds[0].events   = POLLIN;
+    fds[1].fd       = ring -> wakeup_fd;
+    fds[1].events   = POLLIN;
+
+    if (poll(fds, 2, timeout_ms) <= 0)
+    {
+        return 0;
+    }
+
+    if (fds[1].revents & POLLIN)
+    {
+        read(ring -> wakeup_fd, &count, sizeof(count));
+    }
+
+    return (fds[0].revents & POLLIN) != 0;
+}
+
+void handoff_destroy(struct handoff_ring *ring)
+{
+    if (ring -> cells == NULL)
+    {
+        return;
+    }
+
+    close(ring -> wakeup_fd);
+    free(ring -> cells);
+    ring -> cells = NULL;
+}
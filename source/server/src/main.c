@@ -2,6 +2,12 @@
 #include "protocol.h"
 #include "server_config.h"
 #include "command_line.h"
+#include "packet_pool.h"
+#include "busy_poll.h"
+#include "connection_table.h"
+#include "handoff.h"
+#include "delivery.h"
+#include "syn_cookie.h"
 #include <pthread.h>
 
 #define TIMER_TIME 1
@@ -15,18 +21,23 @@ enum application_states
     STATE_BIND_SOCKET,
     STATE_LISTEN,
     STATE_CREATE_GUI_THREAD,
+    STATE_CREATE_WORKERS,
+    STATE_JOIN_WORKERS,
     STATE_WAIT,
     STATE_COMPARE_CHECKSUM,
     STATE_SEND_SYN_ACK,
     STATE_CHECK_SEQ_NUMBER,
-    STATE_CREATE_TIMER_THREAD,
-    STATE_WAIT_FOR_ACK,
     STATE_SEND_PACKET,
     STATE_UPDATE_SEQ_NUMBER,
     STATE_CLEANUP,
     STATE_ERROR
 };
 
+enum worker_states
+{
+    STATE_START_WORKER = FSM_USER_START
+};
+
 enum gui_stats
 {
     SENT_PACKET,
@@ -37,7 +48,8 @@ enum gui_stats
     DELAYED_CLIENT_PACKET,
     DROPPED_SERVER_PACKET,
     DELAYED_SERVER_PACKET,
-    CORRUPTED_DATA
+    CORRUPTED_DATA,
+    KERNEL_DROPPED_PACKET
 };
 
 
@@ -48,46 +60,89 @@ static int create_socket_handler(struct fsm_context *context, struct fsm_error *
 static int bind_socket_handler(struct fsm_context *context, struct fsm_error *err);
 static int listen_handler(struct fsm_context *context, struct fsm_error *err);
 static int create_gui_thread_handler(struct fsm_context *context, struct fsm_error *err);
+static int create_workers_handler(struct fsm_context *context, struct fsm_error *err);
+static int join_workers_handler(struct fsm_context *context, struct fsm_error *err);
 static int wait_handler(struct fsm_context *context, struct fsm_error *err);
 static int compare_checksum_handler(struct fsm_context *context, struct fsm_error *err);
 static int send_syn_ack_handler(struct fsm_context *context, struct fsm_error *err);
-static int create_timer_handler(struct fsm_context *context, struct fsm_error *err);
 static int check_seq_number_handler(struct fsm_context *context, struct fsm_error *err);
-static int wait_for_ack_handler(struct fsm_context *context, struct fsm_error *err);
 static int send_packet_handler(struct fsm_context *context, struct fsm_error *err);
 static int update_seq_num_handler(struct fsm_context *context, struct fsm_error *err);
 static int cleanup_handler(struct fsm_context *context, struct fsm_error *err);
+static int worker_cleanup_handler(struct fsm_context *context, struct fsm_error *err);
 static int error_handler(struct fsm_context *context, struct fsm_error *err);
 
+static void                     report_kernel_drops(struct fsm_context *ctx);
+static void                     record_one_way_delay(struct fsm_context *ctx);
+static void                     service_connections(struct fsm_context *ctx);
+static int                      take_handoff(struct fsm_context *ctx);
+static int                      hand_off(struct fsm_context *ctx);
+static int                      deliver(struct fsm_context *ctx);
+static int                      cookie_valid(struct fsm_context *ctx);
+static struct connection        *accept_cookie(struct fsm_context *ctx, struct fsm_error *err);
+static int                      service_connection(struct connection *conn, void *arg);
 static void                     sigint_handler(int signum);
 static int                      setup_signal_handler(struct fsm_error *err);
 int                             create_file(const char *filepath, FILE **fp, struct fsm_error *err);
+static int                      create_worker_socket(struct arguments *args, struct fsm_error *err);
 
 static volatile sig_atomic_t exit_flag = 0;
 
-void *init_timer_function(void *ptr);
+// the GUI connection is accepted once and shared by every worker
+static volatile int connected_gui_fd = 0, is_connected_gui = 0;
+
 void *init_gui_function(void *ptr);
+void *init_worker_function(void *ptr);
+
+struct worker;
 
 typedef struct arguments
 {
-    int                     sockfd, num_of_threads, is_handshake_ack;
-    int                     server_gui_fd, connected_gui_fd, is_connected_gui;
-    char                    *server_addr, *client_addr, *server_port_str, *client_port_str;
+    int                     sockfd, num_of_threads;
+    int                     server_gui_fd, num_of_workers, worker_id;
+    char                    *server_addr, *client_addr, *server_port_str, *client_port_str, *workers_str;
+    char                    *busy_poll_str, *cpus_str, *delivery_path;
+    unsigned int            busy_poll_usec;
+    struct cpu_list         cpus;
     in_port_t               server_port, client_port;
     struct sockaddr_storage server_addr_struct, client_addr_struct, gui_addr_struct;
-    struct packet           temp_packet;
-    uint32_t                expected_seq_number;
+    struct packet           *temp_packet;
+    struct timespec         received_at;
+    struct packet_pool      pool;
+    struct receive_batch    batch;
+    // in-order payloads leave through the worker's own writer thread, when -o asks for them
+    struct delivery         delivery;
+    uint32_t                reported_kernel_drops;
+    // the peers this worker serves, and the one the packet being handled came from
+    struct connection_table connections;
+    struct connection       *connection;
+    time_t                  next_service;
+    long                    one_way_delay_usec;
+    uint32_t                delay_samples;
     pthread_t               accept_gui_thread;
     pthread_t               *thread_pool;
+    struct worker           *workers;
+    // every worker of the process, for handing a packet to the one that owns its connection
+    struct worker           *siblings;
+    uint32_t                handed_off;
     FILE                    *sent_data, *received_data;
 } arguments;
 
+// each worker owns a socket on the server port and all state of the flows the kernel hashes to it
+typedef struct worker
+{
+    pthread_t               thread;
+    struct fsm_context      context;
+    struct arguments        args;
+    // packets other workers received for connections this one owns
+    struct handoff_ring     handoff;
+} worker;
+
 int main(int argc, char **argv)
 {
     struct fsm_error err;
     struct arguments args = {
-            .expected_seq_number    = 0,
-            .is_connected_gui       = 0
+            .num_of_workers         = 1
     };
     struct fsm_context context = {
             .argc = argc,
@@ -103,22 +158,9 @@ int main(int argc, char **argv)
             {STATE_CREATE_SOCKET,           STATE_BIND_SOCKET,          bind_socket_handler},
             {STATE_BIND_SOCKET,             STATE_LISTEN,               listen_handler},
             {STATE_LISTEN,                  STATE_CREATE_GUI_THREAD,    create_gui_thread_handler},
-            {STATE_CREATE_GUI_THREAD,       STATE_WAIT,                 wait_handler},
-            {STATE_WAIT,                    STATE_COMPARE_CHECKSUM,     compare_checksum_handler},
-            {STATE_COMPARE_CHECKSUM,        STATE_CHECK_SEQ_NUMBER,     check_seq_number_handler},
-            {STATE_COMPARE_CHECKSUM,        STATE_WAIT,                 wait_handler},
-            {STATE_WAIT,                    STATE_CLEANUP,              cleanup_handler},
-            {STATE_CHECK_SEQ_NUMBER,       STATE_SEND_PACKET,          send_packet_handler},
-            {STATE_CHECK_SEQ_NUMBER,       STATE_SEND_SYN_ACK,         send_syn_ack_handler},
-            {STATE_SEND_SYN_ACK,           STATE_UPDATE_SEQ_NUMBER,    update_seq_num_handler},
-            {STATE_CHECK_SEQ_NUMBER,       STATE_WAIT,                 wait_handler },
-            {STATE_SEND_PACKET,            STATE_UPDATE_SEQ_NUMBER,    update_seq_num_handler},
-            {STATE_SEND_PACKET,            STATE_WAIT,                 wait_handler},
-            {STATE_UPDATE_SEQ_NUMBER,      STATE_WAIT,                 wait_handler},
-            {STATE_UPDATE_SEQ_NUMBER,      STATE_CREATE_TIMER_THREAD,  create_timer_handler},
-            {STATE_CREATE_TIMER_THREAD,    STATE_WAIT_FOR_ACK,         wait_for_ack_handler},
-            {STATE_WAIT_FOR_ACK,           STATE_WAIT,                 wait_handler},
-            {STATE_WAIT_FOR_ACK,           STATE_CLEANUP,              cleanup_handler},
+            {STATE_CREATE_GUI_THREAD,       STATE_CREATE_WORKERS,       create_workers_handler},
+            {STATE_CREATE_WORKERS,          STATE_JOIN_WORKERS,         join_workers_handler},
+            {STATE_JOIN_WORKERS,            STATE_CLEANUP,              cleanup_handler},
             {STATE_ERROR,                  STATE_CLEANUP,               cleanup_handler},
             {STATE_PARSE_ARGUMENTS,        STATE_ERROR,                 error_handler},
             {STATE_HANDLE_ARGUMENTS,       STATE_ERROR,                 error_handler},
@@ -127,9 +169,7 @@ int main(int argc, char **argv)
             {STATE_BIND_SOCKET,            STATE_ERROR,                 error_handler},
             {STATE_LISTEN,                 STATE_ERROR,                 error_handler},
             {STATE_CREATE_GUI_THREAD,      STATE_ERROR,                 error_handler},
-            {STATE_WAIT,                   STATE_ERROR,                 error_handler},
-            {STATE_CREATE_TIMER_THREAD,    STATE_ERROR,                 error_handler},
-            {STATE_WAIT_FOR_ACK,           STATE_ERROR,                 error_handler},
+            {STATE_CREATE_WORKERS,         STATE_ERROR,                 error_handler},
             {STATE_CLEANUP,                FSM_EXIT,                    NULL},
     };
 
@@ -146,7 +186,14 @@ static int parse_arguments_handler(struct fsm_context *context, struct fsm_error
     if (parse_arguments(ctx -> argc, ctx -> argv,
                         &ctx -> args -> server_addr, &ctx -> args -> client_addr,
                         &ctx -> args -> server_port_str, &ctx -> args -> client_port_str,
-                        err) != 0)
+                        &ctx -> args -> workers_str, &ctx -> args -> busy_poll_str,
+                        &ctx -> args -> cpus_str, &ctx -> args -> delivery_path, err) != 0)
+    {
+        return STATE_ERROR;
+    }
+
+    if (ctx -> args -> delivery_path != NULL && strcmp(ctx -> args -> delivery_path, DELIVERY_STDOUT) == 0 &&
+        delivery_claim_stdout(err) == -1)
     {
         return STATE_ERROR;
     }
@@ -160,12 +207,21 @@ static int handle_arguments_handler(struct fsm_context *context, struct fsm_erro
     SET_TRACE(context, "in handle arguments", "STATE_HANDLE_ARGUMENTS");
     if (handle_arguments(ctx -> argv[0], ctx -> args -> server_addr,
                          ctx -> args -> client_addr, ctx -> args -> server_port_str,
-                         ctx -> args -> client_port_str, &ctx -> args -> server_port,
-                         &ctx -> args -> client_port, err) != 0)
+                         ctx -> args -> client_port_str, ctx -> args -> workers_str,
+                         &ctx -> args -> server_port, &ctx -> args -> client_port,
+                         &ctx -> args -> num_of_workers, err) != 0)
     {
         return STATE_ERROR;
     }
 
+    if ((ctx -> args -> busy_poll_str != NULL &&
+         parse_busy_poll(ctx -> args -> busy_poll_str, &ctx -> args -> busy_poll_usec, err) == -1) ||
+        (ctx -> args -> cpus_str != NULL && parse_cpu_list(ctx -> args -> cpus_str, &ctx -> args -> cpus, err) == -1))
+    {
+        usage(ctx -> argv[0]);
+        return STATE_ERROR;
+    }
+
     if (create_file("../server_received_data.csv", &ctx -> args -> received_data, err) == -1)
     {
         return STATE_ERROR;
@@ -217,6 +273,11 @@ static int create_socket_handler(struct fsm_context *context, struct fsm_error *
         return STATE_ERROR;
     }
 
+    if (socket_reuse_port(ctx -> args -> sockfd, err) == -1)
+    {
+        return STATE_ERROR;
+    }
+
     ctx -> args -> server_gui_fd = socket_create(ctx -> args -> server_addr_struct.ss_family,
                                                  SOCK_STREAM, 0, err);
     if (ctx -> args -> server_gui_fd == -1)
@@ -271,7 +332,114 @@ static int create_gui_thread_handler(struct fsm_context *context, struct fsm_err
         return STATE_ERROR;
     }
 
-    return STATE_WAIT;
+    return STATE_CREATE_WORKERS;
+}
+
+static int create_workers_handler(struct fsm_context *context, struct fsm_error *err)
+{
+    struct fsm_context  *ctx;
+    struct worker       *workers;
+    int                 worker_cpus[MAX_WORKERS];
+    ctx = context;
+    SET_TRACE(context, "", "STATE_CREATE_WORKERS");
+
+    if (syn_cookie_init(err) == -1)
+    {
+        return STATE_ERROR;
+    }
+
+    workers = calloc((size_t) ctx -> args -> num_of_workers, sizeof(struct worker));
+    if (workers == NULL)
+    {
+        SET_ERROR(err, strerror(errno));
+        return STATE_ERROR;
+    }
+
+    ctx -> args -> workers = workers;
+
+    for (int i = 0; i < ctx -> args -> num_of_workers; i++)
+    {
+        struct arguments *args;
+
+        args                        = &workers[i].args;
+        *args                       = *ctx -> args;
+        args -> worker_id           = i;
+        args -> workers             = NULL;
+        args -> siblings            = workers;
+        args -> thread_pool         = NULL;
+        args -> num_of_threads      = 0;
+        args -> temp_packet         = NULL;
+        workers[i].context.argc     = ctx -> argc;
+        workers[i].context.argv     = ctx -> argv;
+        workers[i].context.args     = args;
+
+        // worker 0 takes over the socket and files main already set up
+        if (i > 0 && create_worker_socket(args, err) == -1)
+        {
+            return STATE_ERROR;
+        }
+
+        if (packet_pool_init(&args -> pool, PACKET_POOL_SIZE, err) == -1 ||
+            receive_batch_init(&args -> batch, &args -> pool, args -> sockfd, err) == -1 ||
+            connection_table_init(&args -> connections, i, err) == -1 ||
+            (ctx -> args -> num_of_workers > 1 && handoff_init(&workers[i].handoff, err) == -1) ||
+            (args -> delivery_path != NULL && delivery_start(&args -> delivery, args -> delivery_path, err) == -1) ||
+            socket_receive_timeout(args -> sockfd, TIMER_TIME * 1000000L, err) == -1)
+        {
+            return STATE_ERROR;
+        }
+
+        // raising SO_BUSY_POLL needs CAP_NET_ADMIN, the user space spin still works without it
+        args -> batch.spin_usec = args -> busy_poll_usec;
+        if (args -> busy_poll_usec > 0 && socket_busy_poll(args -> sockfd, args -> busy_poll_usec, err) == -1)
+        {
+            fprintf(stderr, "SO_BUSY_POLL unavailable: %s\n", err -> err_msg);
+        }
+    }
+
+    // pinned workers sit where pin_thread put them, new peers are steered to the one on the receiving CPU
+    for (int i = 0; i < ctx -> args -> num_of_workers && ctx -> args -> cpus.count > 0; i++)
+    {
+        worker_cpus[i] = ctx -> args -> cpus.cpus[i % ctx -> args -> cpus.count];
+    }
+
+    // every worker socket is bound by now, the group indexes them in that order
+    if (ctx -> args -> num_of_workers > 1 &&
+        connection_steer_workers(workers[0].args.sockfd, ctx -> args -> cpus.count > 0 ? worker_cpus : NULL,
+                                 ctx -> args -> num_of_workers, err) == -1)
+    {
+        fprintf(stderr, "Connection ids will not steer workers: %s\n", err -> err_msg);
+    }
+
+    ctx -> args -> sockfd           = 0;
+    ctx -> args -> sent_data        = NULL;
+    ctx -> args -> received_data    = NULL;
+
+    for (int i = 0; i < ctx -> args -> num_of_workers; i++)
+    {
+        if (pthread_create(&workers[i].thread, NULL, init_worker_function, &workers[i]) != 0)
+        {
+            SET_ERROR(err, "Error in creating worker thread.");
+            ctx -> args -> num_of_workers = i;
+            return STATE_ERROR;
+        }
+    }
+
+    return STATE_JOIN_WORKERS;
+}
+
+static int join_workers_handler(struct fsm_context *context, struct fsm_error *err)
+{
+    struct fsm_context *ctx;
+    ctx = context;
+    SET_TRACE(context, "", "STATE_JOIN_WORKERS");
+
+    for (int i = 0; i < ctx -> args -> num_of_workers; i++)
+    {
+        pthread_join(ctx -> args -> workers[i].thread, NULL);
+    }
+
+    return STATE_CLEANUP;
 }
 
 static int wait_handler(struct fsm_context *context, struct fsm_error *err)
@@ -283,17 +451,47 @@ static int wait_handler(struct fsm_context *context, struct fsm_error *err)
     SET_TRACE(context, "", "STATE_LISTEN_SERVER");
     while (!exit_flag)
     {
-        result = receive_packet(ctx->args->sockfd, &ctx -> args -> temp_packet,
-                                ctx -> args -> received_data, err);
+        if (take_handoff(ctx))
+        {
+            record_one_way_delay(ctx);
+            service_connections(ctx);
+            return STATE_COMPARE_CHECKSUM;
+        }
+
+        // with siblings to hear from, the read may only block once the socket has something for it
+        if (ctx -> args -> siblings[0].handoff.cells != NULL && ctx -> args -> batch.spin_usec == 0 &&
+            !receive_batch_pending(&ctx -> args -> batch) &&
+            handoff_wait(&ctx -> args -> siblings[ctx -> args -> worker_id].handoff, ctx -> args -> sockfd,
+                         TIMER_TIME * 1000) == 0)
+        {
+            service_connections(ctx);
+            continue;
+        }
+
+        // replies go back to whoever sent the datagram, each worker serves many peers
+        result = receive_packet(ctx->args->sockfd, &ctx -> args -> batch, &ctx -> args -> client_addr_struct,
+                                &ctx -> args -> temp_packet, ctx -> args -> received_data, err);
 
         if (result == -1)
         {
+            // the receive timeout only wakes the worker up to run its connection timers
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                service_connections(ctx);
+                continue;
+            }
+
             return STATE_ERROR;
         }
 
-        if (ctx -> args -> is_connected_gui)
+        ctx -> args -> received_at = ctx -> args -> batch.received_at;
+        report_kernel_drops(ctx);
+        record_one_way_delay(ctx);
+        service_connections(ctx);
+
+        if (is_connected_gui)
         {
-            send_stats_gui(ctx -> args -> connected_gui_fd, RECEIVED_PACKET);
+            send_stats_gui(connected_gui_fd, RECEIVED_PACKET);
         }
 
         return STATE_COMPARE_CHECKSUM;
@@ -308,146 +506,156 @@ static int compare_checksum_handler(struct fsm_context *context, struct fsm_erro
     ctx = context;
     SET_TRACE(context, "", "STATE_COMPARE_CHECKSUM");
 
-    if (compare_checksum(ctx -> args -> temp_packet.hd.checksum, ctx -> args -> temp_packet.data,
-                         strlen(ctx -> args -> temp_packet.data)))
+    if (compare_checksum(ctx -> args -> temp_packet -> hd.checksum, ctx -> args -> temp_packet -> data,
+                         strlen(ctx -> args -> temp_packet -> data)))
     {
 
         return STATE_CHECK_SEQ_NUMBER;
     }
 
-    if (ctx -> args -> is_connected_gui)
+    if (is_connected_gui)
     {
-        send_stats_gui(ctx -> args -> connected_gui_fd, DROPPED_CLIENT_PACKET);
+        send_stats_gui(connected_gui_fd, DROPPED_CLIENT_PACKET);
     }
 
     return STATE_WAIT;
 }
 static int check_seq_number_handler(struct fsm_context *context, struct fsm_error *err)
 {
-    struct fsm_context *ctx;
+    struct fsm_context  *ctx;
+    struct connection   *conn;
+    struct packet       *pt;
     ctx = context;
     SET_TRACE(context, "", "STATE_CHECK_SEQ_NUMBER");
 
-    if (check_seq_number(ctx -> args -> temp_packet.hd.seq_number, ctx -> args -> expected_seq_number))
+    pt      = ctx -> args -> temp_packet;
+
+    // every SYN is answered with a cookie and forgotten, a flood of them allocates nothing
+    if (pt -> hd.flags == SYN)
+    {
+        return STATE_SEND_SYN_ACK;
+    }
+
+    // until the peer has seen its id in a reply it sends 0, and only the address tells who it is
+    if (pt -> hd.connection_id == 0)
     {
-        if (ctx -> args -> temp_packet.hd.flags == SYN)
+        conn = connection_find(&ctx -> args -> connections, &ctx -> args -> client_addr_struct);
+
+        // a client restarted on the same port handshakes again without ever closing the old connection, so a
+        // valid cookie on a sequence number the old one does not expect replaces it; a bare SYN never does
+        if (conn != NULL && pt -> hd.seq_number != conn -> expected_seq_number && cookie_valid(ctx))
         {
-            return STATE_SEND_SYN_ACK;
+            connection_remove(&ctx -> args -> connections, conn);
+            conn = NULL;
         }
 
-        return STATE_SEND_PACKET;
+        if (conn == NULL)
+        {
+            conn = accept_cookie(ctx, err);
+        }
     }
-
-    if (ctx -> args -> is_connected_gui)
+    else
     {
-        send_stats_gui(ctx -> args -> connected_gui_fd, DROPPED_CLIENT_PACKET);
-    }
+        conn = connection_find_id(&ctx -> args -> connections, pt -> hd.connection_id);
 
-    return STATE_WAIT;
-}
-
-static int send_syn_ack_handler(struct fsm_context *context, struct fsm_error *err)
-{
-    struct fsm_context *ctx;
-    ctx = context;
-    SET_TRACE(context, "in connect socket", "STATE_START_HANDSHAKE");
-    ctx -> args -> is_handshake_ack++;
-    printf("handshake ack: %d\n", ctx -> args -> is_handshake_ack);
-    create_syn_ack_packet(ctx -> args -> sockfd, &ctx -> args -> client_addr_struct,
-                         &ctx -> args -> temp_packet, ctx -> args -> sent_data, err);
+        if (conn == NULL && hand_off(ctx))
+        {
+            return STATE_WAIT;
+        }
+    }
 
-    send_packet(ctx -> args -> sockfd, &ctx -> args -> client_addr_struct,
-                &ctx -> args -> temp_packet, ctx -> args -> sent_data, err);
+    ctx -> args -> connection = conn;
 
-    if (ctx -> args -> is_connected_gui)
+    if (conn != NULL)
     {
-        send_stats_gui(ctx -> args -> connected_gui_fd, SENT_PACKET);
-    }
+        // the id outlives a NAT rebinding, replies follow the peer to its new address
+        connection_rebind(&ctx -> args -> connections, conn, &ctx -> args -> client_addr_struct);
+        conn -> last_active = connection_clock();
 
-    return STATE_UPDATE_SEQ_NUMBER;
-}
-
-static int create_timer_handler(struct fsm_context *context, struct fsm_error *err)
-{
-    struct fsm_context  *ctx;
-    pthread_t           *temp_thread_pool;
+        // the handshake ACK has done its job once the connection exists, it is not acknowledged
+        if (pt -> hd.flags == ACK)
+        {
+            return STATE_WAIT;
+        }
 
-    ctx                 = context;
-    temp_thread_pool    = ctx -> args -> thread_pool;
-    SET_TRACE(context, "", "STATE_CREATE_TIMER_THREAD");
+        if (check_seq_number(pt -> hd.seq_number, conn -> expected_seq_number))
+        {
+            // a segment the sink cannot take yet goes unacknowledged, the peer's retransmission brings it back
+            if (pt -> hd.flags == PSHACK && check_if_equal(pt -> hd.seq_number, conn -> expected_seq_number) &&
+                deliver(ctx) == -1)
+            {
+                return STATE_WAIT;
+            }
 
-    ctx -> args -> num_of_threads++;
+            return STATE_SEND_PACKET;
+        }
+    }
 
-    temp_thread_pool    = (pthread_t *) realloc(temp_thread_pool,
-                                             sizeof(pthread_t) * ctx -> args -> num_of_threads);
-    if (temp_thread_pool == NULL)
+    if (is_connected_gui)
     {
-        return STATE_ERROR;
+        send_stats_gui(connected_gui_fd, DROPPED_CLIENT_PACKET);
     }
 
-    ctx -> args -> thread_pool = temp_thread_pool;
-
-    pthread_create(&ctx->args->thread_pool[ctx->args->num_of_threads], NULL, init_timer_function, (void *) ctx);
-
-    return STATE_WAIT_FOR_ACK;
+    return STATE_WAIT;
 }
 
-static int wait_for_ack_handler(struct fsm_context *context, struct fsm_error *err)
+static int send_syn_ack_handler(struct fsm_context *context, struct fsm_error *err)
 {
-    struct fsm_context *ctx;
-    ssize_t result;
-
+    struct fsm_context  *ctx;
+    uint32_t            cookie;
     ctx = context;
-    SET_TRACE(context, "", "STATE_WAIT_FOR_ACK");
-    while (!exit_flag)
-    {
-        printf("in wait for ack\n");
-        result = receive_packet(ctx->args->sockfd, &ctx -> args -> temp_packet,
-                                ctx -> args -> received_data, err);
+    SET_TRACE(context, "in connect socket", "STATE_START_HANDSHAKE");
 
-        if (result == -1)
-        {
-            return STATE_ERROR;
-        }
+    cookie = syn_cookie_make(&ctx -> args -> client_addr_struct, ctx -> args -> temp_packet -> hd.seq_number,
+                             connection_clock());
 
-        if (ctx -> args -> is_connected_gui)
-        {
-            send_stats_gui(ctx -> args -> connected_gui_fd, RECEIVED_PACKET);
-        }
+    // no id yet: one is only handed out with the connection, in the first reply after the handshake
+    ctx -> args -> temp_packet -> hd.connection_id = 0;
+    create_syn_ack_packet(ctx -> args -> sockfd, &ctx -> args -> client_addr_struct,
+                         ctx -> args -> temp_packet, ctx -> args -> sent_data, err);
+    ctx -> args -> temp_packet -> hd.seq_number = cookie;
 
-        if (ctx -> args -> temp_packet.hd.flags == ACK &&
-            check_if_equal(ctx -> args -> temp_packet.hd.seq_number, ctx -> args -> expected_seq_number))
-        {
-            ctx -> args -> is_handshake_ack = 0;
-            return STATE_WAIT;
-        }
+    // a lost SYN-ACK is recovered by the peer resending its SYN, there is nothing here to resend it from
+    send_packet(ctx -> args -> sockfd, &ctx -> args -> client_addr_struct,
+                ctx -> args -> temp_packet, ctx -> args -> sent_data, err);
 
-        if (check_if_less(ctx -> args -> temp_packet.hd.seq_number, ctx -> args -> expected_seq_number))
-        {
-            read_received_packet(ctx -> args -> sockfd, &ctx -> args -> client_addr_struct,
-                                 &ctx -> args -> temp_packet, ctx -> args -> sent_data, err);
-        }
+    if (is_connected_gui)
+    {
+        send_stats_gui(connected_gui_fd, SENT_PACKET);
     }
 
-    return STATE_CLEANUP;
+    return STATE_WAIT;
 }
 
 static int send_packet_handler(struct fsm_context *context, struct fsm_error *err)
 {
-    struct fsm_context *ctx;
+    struct fsm_context  *ctx;
+    uint8_t             flags;
     ctx = context;
     SET_TRACE(context, "", "STATE_SEND_PACKET");
 
+    flags = ctx -> args -> temp_packet -> hd.flags;
+
+    // replies carry the id even when the peer's packet did not, that is how it learns it
+    ctx -> args -> temp_packet -> hd.connection_id = ctx -> args -> connection -> id;
+
     read_received_packet(ctx -> args -> sockfd, &ctx -> args -> client_addr_struct,
-                             &ctx -> args -> temp_packet,
+                             ctx -> args -> temp_packet,
                              ctx -> args -> sent_data, err);
 
-    if (ctx -> args -> is_connected_gui)
+    if (is_connected_gui)
+    {
+        send_stats_gui(connected_gui_fd, SENT_PACKET);
+    }
+
+    if (flags == FINACK)
     {
-        send_stats_gui(ctx -> args -> connected_gui_fd, SENT_PACKET);
+        connection_remove(&ctx -> args -> connections, ctx -> args -> connection);
+        ctx -> args -> connection = NULL;
+        return STATE_WAIT;
     }
 
-    if (check_if_less(ctx -> args -> temp_packet.hd.seq_number, ctx -> args -> expected_seq_number))
+    if (check_if_less(ctx -> args -> temp_packet -> hd.seq_number, ctx -> args -> connection -> expected_seq_number))
     {
         return STATE_WAIT;
     }
@@ -457,25 +665,20 @@ static int send_packet_handler(struct fsm_context *context, struct fsm_error *er
 
 static int update_seq_num_handler(struct fsm_context *context, struct fsm_error *err)
 {
-    struct fsm_context *ctx;
+    struct fsm_context  *ctx;
+    struct connection   *conn;
     ctx = context;
     SET_TRACE(context, "", "STATE_UPDATE_SEQ_NUMBER");
 
-    if (ctx -> args -> temp_packet.hd.flags == SYN)
-    {
-        ctx -> args -> expected_seq_number = update_expected_seq_number(ctx -> args -> temp_packet.hd.seq_number, 1);
-        return STATE_WAIT;
-    }
+    conn = ctx -> args -> connection;
 
-    if (ctx -> args -> temp_packet.hd.flags == SYNACK)
+    // a duplicate is acknowledged again but must not pull the expected number back, or it would be delivered twice
+    if (check_if_equal(ctx -> args -> temp_packet -> hd.seq_number, conn -> expected_seq_number))
     {
-        ctx -> args -> expected_seq_number = update_expected_seq_number(ctx -> args -> temp_packet.hd.ack_number, 0);
-        return STATE_CREATE_TIMER_THREAD;
+        conn -> expected_seq_number = update_expected_seq_number(ctx -> args -> temp_packet -> hd.seq_number,
+                                                                 strlen(ctx -> args -> temp_packet -> data));
     }
 
-    ctx -> args -> expected_seq_number = update_expected_seq_number(ctx -> args -> temp_packet.hd.seq_number,
-                                                                    strlen(ctx -> args -> temp_packet.data));
-
     return STATE_WAIT;
 }
 static int cleanup_handler(struct fsm_context *context, struct fsm_error *err)
@@ -502,14 +705,85 @@ static int cleanup_handler(struct fsm_context *context, struct fsm_error *err)
         }
     }
 
-    if (ctx -> args -> connected_gui_fd)
+    if (connected_gui_fd)
+    {
+        if (socket_close(connected_gui_fd, err) == -1)
+        {
+            printf("close socket error\n");
+        }
+    }
+
+    if (ctx -> args -> sent_data)
+    {
+        fclose(ctx -> args -> sent_data);
+    }
+
+    if (ctx -> args -> received_data)
+    {
+        fclose(ctx -> args -> received_data);
+    }
+
+    // the rings outlive their owners, a sibling may still push until it is joined too
+    if (ctx -> args -> workers)
+    {
+        for (int i = 0; i < ctx -> args -> num_of_workers; i++)
+        {
+            handoff_destroy(&ctx -> args -> workers[i].handoff);
+        }
+
+        free(ctx -> args -> workers);
+    }
+
+    return FSM_EXIT;
+}
+
+static int worker_cleanup_handler(struct fsm_context *context, struct fsm_error *err)
+{
+    struct fsm_context  *ctx;
+    ctx                 = context;
+    SET_TRACE(context, "in worker cleanup handler", "STATE_CLEANUP");
+
+    if (ctx -> args -> sockfd)
     {
-        if (socket_close(ctx -> args -> connected_gui_fd, err) == -1)
+        if (socket_close(ctx -> args -> sockfd, err) == -1)
         {
             printf("close socket error\n");
         }
     }
 
+    if (ctx -> args -> batch.kernel_drops > 0)
+    {
+        printf("Worker %d: %u datagrams dropped by the kernel on a full receive buffer\n",
+               ctx -> args -> worker_id, ctx -> args -> batch.kernel_drops);
+    }
+
+    if (ctx -> args -> delay_samples > 0)
+    {
+        printf("Worker %d: smoothed one-way delay %ld us over %u data packets\n",
+               ctx -> args -> worker_id, ctx -> args -> one_way_delay_usec, ctx -> args -> delay_samples);
+    }
+
+    if (ctx -> args -> siblings[0].handoff.cells != NULL)
+    {
+        printf("Worker %d: handed %u packets to their owners, took over %u, %u lost on a full ring\n",
+               ctx -> args -> worker_id, ctx -> args -> handed_off,
+               ctx -> args -> siblings[ctx -> args -> worker_id].handoff.received,
+               __atomic_load_n(&ctx -> args -> siblings[ctx -> args -> worker_id].handoff.dropped,
+                               __ATOMIC_RELAXED));
+    }
+
+    if (ctx -> args -> delivery.chunks != NULL)
+    {
+        delivery_stop(&ctx -> args -> delivery);
+        printf("Worker %d: delivered %lu bytes in %lu writes, %u segments refused on a full queue\n",
+               ctx -> args -> worker_id, (unsigned long) ctx -> args -> delivery.delivered_bytes,
+               (unsigned long) ctx -> args -> delivery.writes, ctx -> args -> delivery.refused);
+    }
+
+    packet_release(ctx -> args -> temp_packet);
+    connection_table_destroy(&ctx -> args -> connections);
+    receive_batch_destroy(&ctx -> args -> batch);
+    packet_pool_destroy(&ctx -> args -> pool);
     fclose(ctx -> args -> sent_data);
     fclose(ctx -> args -> received_data);
 
@@ -524,36 +798,230 @@ static int error_handler(struct fsm_context *context, struct fsm_error *err)
     return STATE_CLEANUP;
 }
 
-void *init_timer_function(void *ptr)
+void *init_worker_function(void *ptr)
 {
-    struct fsm_context  *ctx;
+    struct worker       *self;
     struct fsm_error    err;
 
-    packet              packet_to_send;
-    int                 counter;
+    static struct client_fsm_transition transitions[] = {
+            {FSM_INIT,                      STATE_START_WORKER,         wait_handler},
+            {STATE_START_WORKER,            STATE_COMPARE_CHECKSUM,     compare_checksum_handler},
+            {STATE_START_WORKER,            STATE_CLEANUP,              worker_cleanup_handler},
+            {STATE_START_WORKER,            STATE_ERROR,                error_handler},
+            {STATE_WAIT,                    STATE_COMPARE_CHECKSUM,     compare_checksum_handler},
+            {STATE_COMPARE_CHECKSUM,        STATE_CHECK_SEQ_NUMBER,     check_seq_number_handler},
+            {STATE_COMPARE_CHECKSUM,        STATE_WAIT,                 wait_handler},
+            {STATE_WAIT,                    STATE_CLEANUP,              worker_cleanup_handler},
+            {STATE_CHECK_SEQ_NUMBER,       STATE_SEND_PACKET,          send_packet_handler},
+            {STATE_CHECK_SEQ_NUMBER,       STATE_SEND_SYN_ACK,         send_syn_ack_handler},
+            {STATE_SEND_SYN_ACK,           STATE_WAIT,                 wait_handler},
+            {STATE_CHECK_SEQ_NUMBER,       STATE_WAIT,                 wait_handler },
+            {STATE_SEND_PACKET,            STATE_UPDATE_SEQ_NUMBER,    update_seq_num_handler},
+            {STATE_SEND_PACKET,            STATE_WAIT,                 wait_handler},
+            {STATE_UPDATE_SEQ_NUMBER,      STATE_WAIT,                 wait_handler},
+            {STATE_ERROR,                  STATE_CLEANUP,               worker_cleanup_handler},
+            {STATE_WAIT,                   STATE_ERROR,                 error_handler},
+            {STATE_CLEANUP,                FSM_EXIT,                    NULL},
+    };
+
+    self = (struct worker *) ptr;
+    if (pin_thread(&self -> args.cpus, self -> args.worker_id, &err) == -1)
+    {
+        fprintf(stderr, "Worker %d could not be pinned: %s\n", self -> args.worker_id, err.err_msg);
+    }
 
-    ctx                     = (struct fsm_context*) ptr;
-    packet_to_send          = ctx -> args -> temp_packet;
-    counter                 = 0;
+    fsm_run(&self -> context, &err, transitions);
+
+    return NULL;
+}
 
-    while (!exit_flag || ctx -> args -> is_handshake_ack)
+// overflow drops never reach the protocol, so they are reported next to its own drops to tell the two apart
+static void report_kernel_drops(struct fsm_context *ctx)
+{
+    if (!is_connected_gui)
     {
-        sleep(TIMER_TIME);
-        if (ctx -> args -> is_handshake_ack)
-        {
-            send_packet(ctx->args->sockfd, &ctx->args->client_addr_struct,
-                        &packet_to_send, ctx -> args -> sent_data, &err);
+        ctx -> args -> reported_kernel_drops = ctx -> args -> batch.kernel_drops;
+        return;
+    }
 
-            if (ctx -> args -> is_connected_gui)
-            {
-                send_stats_gui(ctx -> args -> connected_gui_fd, RESENT_PACKET);
-            }
+    while (ctx -> args -> reported_kernel_drops != ctx -> args -> batch.kernel_drops)
+    {
+        ctx -> args -> reported_kernel_drops++;
+        send_stats_gui(connected_gui_fd, KERNEL_DROPPED_PACKET);
+    }
+}
 
-            counter++;
-        }
+// the client stamps the header as it sends, so this only means something between synchronised clocks
+static void record_one_way_delay(struct fsm_context *ctx)
+{
+    const struct packet *pt;
+    long                sample;
+
+    pt = ctx -> args -> temp_packet;
+    if (pt -> hd.flags != PSHACK)
+    {
+        return;
+    }
+
+    sample = (ctx -> args -> received_at.tv_sec - pt -> hd.tv.tv_sec) * 1000000L +
+             ctx -> args -> received_at.tv_nsec / 1000L - pt -> hd.tv.tv_usec;
+
+    // same 1/8 gain as the client's smoothed RTT
+    ctx -> args -> one_way_delay_usec = ctx -> args -> delay_samples == 0 ? sample :
+                                        (7 * ctx -> args -> one_way_delay_usec + sample) / 8;
+    ctx -> args -> delay_samples++;
+}
+
+// a packet for a connection on another worker, left by the steering program's fallback or a rebound peer
+static int hand_off(struct fsm_context *ctx)
+{
+    int owner;
+
+    owner = CONNECTION_WORKER(ctx -> args -> temp_packet -> hd.connection_id);
+
+    if (ctx -> args -> temp_packet -> hd.connection_id == 0 || owner == ctx -> args -> worker_id ||
+        owner >= ctx -> args -> num_of_workers || ctx -> args -> siblings[owner].handoff.cells == NULL)
+    {
+        return 0;
+    }
+
+    // the copy leaves the pooled packet here, pools never cross threads
+    if (handoff_push(&ctx -> args -> siblings[owner].handoff, &ctx -> args -> client_addr_struct,
+                     ctx -> args -> temp_packet, &ctx -> args -> received_at) == 0)
+    {
+        ctx -> args -> handed_off++;
+    }
+
+    return 1;
+}
+
+static int deliver(struct fsm_context *ctx)
+{
+    if (ctx -> args -> delivery.chunks == NULL)
+    {
+        return 0;
+    }
+
+    return delivery_submit(&ctx -> args -> delivery, ctx -> args -> temp_packet -> data,
+                           strlen(ctx -> args -> temp_packet -> data));
+}
+
+// the handshake ACK, or the first data segment if that ACK was lost, acknowledges the cookie plus one and
+// carries the peer's initial sequence number plus one
+static int cookie_valid(struct fsm_context *ctx)
+{
+    struct packet *pt;
+
+    pt = ctx -> args -> temp_packet;
+
+    return (pt -> hd.flags == ACK || pt -> hd.flags == PSHACK) &&
+           syn_cookie_check(&ctx -> args -> client_addr_struct, pt -> hd.seq_number - 1, pt -> hd.ack_number - 1,
+                            connection_clock());
+}
+
+// only a cookie this worker could have made creates state
+static struct connection *accept_cookie(struct fsm_context *ctx, struct fsm_error *err)
+{
+    struct connection   *conn;
+    struct packet       *pt;
+
+    pt = ctx -> args -> temp_packet;
+
+    if (!cookie_valid(ctx))
+    {
+        return NULL;
+    }
+
+    conn = connection_create(&ctx -> args -> connections, &ctx -> args -> client_addr_struct, err);
+    if (conn == NULL)
+    {
+        fprintf(stderr, "Dropping handshake: %s\n", err -> err_msg);
+        return NULL;
+    }
+
+    conn -> expected_seq_number = pt -> hd.seq_number;
+
+    // the client's window is only known now, a full one must fit in the socket buffers
+    if (socket_size_buffers(ctx -> args -> sockfd, pt -> hd.window_size, sizeof(struct packet), err) == -1)
+    {
+        fprintf(stderr, "Could not size socket buffers: %s\n", err -> err_msg);
+    }
+
+    return conn;
+}
+
+static int take_handoff(struct fsm_context *ctx)
+{
+    struct handoff_ring *ring;
+    struct packet       *pt;
+
+    ring = &ctx -> args -> siblings[ctx -> args -> worker_id].handoff;
+    if (!handoff_pending(ring))
+    {
+        return 0;
+    }
+
+    pt = packet_pool_get(&ctx -> args -> pool);
+    if (pt == NULL)
+    {
+        return 0;
+    }
+
+    handoff_pop(ring, &ctx -> args -> client_addr_struct, pt, &ctx -> args -> received_at);
+    packet_release(ctx -> args -> temp_packet);
+    ctx -> args -> temp_packet = pt;
+
+    return 1;
+}
+
+// at most once per TIMER_TIME, however busy the socket: forget idle peers
+static void service_connections(struct fsm_context *ctx)
+{
+    time_t now;
+
+    now = connection_clock();
+    if (now < ctx -> args -> next_service)
+    {
+        return;
+    }
+
+    ctx -> args -> next_service = now + TIMER_TIME;
+    ctx -> args -> connection   = NULL;
+    connection_table_sweep(&ctx -> args -> connections, service_connection, &now);
+}
+
+// arg is the sweep's clock reading, shared by every connection it visits
+static int service_connection(struct connection *conn, void *arg)
+{
+    return *(const time_t *) arg - conn -> last_active >= CONNECTION_IDLE_TIMEOUT;
+}
+
+static int create_worker_socket(struct arguments *args, struct fsm_error *err)
+{
+    char received_path[64], sent_path[64];
+
+    args -> sockfd = socket_create(args -> server_addr_struct.ss_family, SOCK_DGRAM, 0, err);
+    if (args -> sockfd == -1)
+    {
+        return -1;
     }
 
-    pthread_exit(NULL);
+    if (socket_reuse_port(args -> sockfd, err) == -1 ||
+        socket_bind(args -> sockfd, &args -> server_addr_struct, err) == -1)
+    {
+        return -1;
+    }
+
+    snprintf(received_path, sizeof(received_path), "../server_received_data_%d.csv", args -> worker_id);
+    snprintf(sent_path, sizeof(sent_path), "../server_sent_data_%d.csv", args -> worker_id);
+
+    if (create_file(received_path, &args -> received_data, err) == -1 ||
+        create_file(sent_path, &args -> sent_data, err) == -1)
+    {
+        return -1;
+    }
+
+    return 0;
 }
 
 void *init_gui_function(void *ptr)
@@ -563,8 +1031,8 @@ void *init_gui_function(void *ptr)
 
     while(!exit_flag)
     {
-        ctx->args->connected_gui_fd = socket_accept_connection(ctx->args->server_gui_fd, &err);
-        ctx->args->is_connected_gui++;
+        connected_gui_fd = socket_accept_connection(ctx->args->server_gui_fd, &err);
+        is_connected_gui++;
     }
 
     return NULL;
@@ -1,5 +1,6 @@
 #include <netinet/in.h>
 #include "packet_config.h"
+#include "packet_pool.h"
 
 int send_packet(int sockfd, struct sockaddr_storage *addr, struct packet *pt,
         FILE *fp, struct fsm_error *err)
@@ -29,32 +30,31 @@ int send_packet(int sockfd, struct sockaddr_storage *addr, struct packet *pt,
     return 0;
 }
 
-int receive_packet(int sockfd, struct packet *temp_packet, FILE *fp, struct fsm_error *err)
+int receive_packet(int sockfd, struct receive_batch *batch, struct sockaddr_storage *addr,
+                   struct packet **temp_packet, FILE *fp, struct fsm_error *err)
 {
-    struct sockaddr_storage     client_addr;
-    socklen_t                   client_addr_len;
-    struct packet               pt;
-    ssize_t                     result;
+    struct packet               *pt;
 
-    client_addr_len = sizeof(client_addr);
-    result = recvfrom(sockfd, &pt, sizeof(pt), 0, (struct sockaddr *) &client_addr, &client_addr_len);
+    pt = receive_batch_next(batch, sockfd, addr);
 
-    if (result == -1)
+    if (pt == NULL)
     {
         SET_ERROR(err, strerror(errno));
         return -1;
     }
 
+    // drop the previous packet only now, so a failed receive leaves it in place
+    packet_release(*temp_packet);
+    *temp_packet = pt;
+
     printf("RECEIVED:\n");
 //    printf("bytes: %zd\n", result);
-    printf("seq number: %u ", pt.hd.seq_number);
-//    printf("ack number: %u\n", pt.hd.ack_number);
-//    printf("flags: %u\n", pt.hd.flags);
-    printf("data: %s\n", pt.data);
-
-    *temp_packet = pt;
+    printf("seq number: %u ", pt->hd.seq_number);
+//    printf("ack number: %u\n", pt->hd.ack_number);
+//    printf("flags: %u\n", pt->hd.flags);
+    printf("data: %s\n", pt->data);
 
-    write_stats_to_file(fp, &pt);
+    write_stats_to_file(fp, pt);
 
     return 0;
 }
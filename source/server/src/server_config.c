@@ -141,6 +141,20 @@ socklen_t size_of_address(struct sockaddr_storage *addr)
     return addr->ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
 }
 
+int socket_reuse_port(int sockfd, struct fsm_error *err)
+{
+    int on;
+
+    on = 1;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
 int get_sockaddr_info(struct sockaddr_storage *addr, char **ip_address, char **port, struct fsm_error *err)
 {
     char temp_ip[NI_MAXHOST];
@@ -192,3 +206,55 @@ int send_stats_gui(int sockfd, int stat)
 
     return 0;
 }
+
+int socket_size_buffers(int sockfd, size_t window_packets, size_t packet_size, struct fsm_error *err)
+{
+    static const int    options[]   = {SO_RCVBUF, SO_SNDBUF};
+    static const int    forced[]    = {SO_RCVBUFFORCE, SO_SNDBUFFORCE};
+    int                 wanted, current;
+    socklen_t           length;
+
+    wanted = (int) (window_packets * (packet_size + SOCKET_BUFFER_OVERHEAD));
+
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++)
+    {
+        length = sizeof(current);
+        if (getsockopt(sockfd, SOL_SOCKET, options[i], &current, &length) == -1)
+        {
+            SET_ERROR(err, strerror(errno));
+            return -1;
+        }
+
+        // the kernel reports back twice what was asked for, and a buffer is never shrunk
+        if (current / 2 >= wanted)
+        {
+            continue;
+        }
+
+        // the FORCE variants go past net.core.[rw]mem_max but need CAP_NET_ADMIN
+        if (setsockopt(sockfd, SOL_SOCKET, forced[i], &wanted, sizeof(wanted)) == -1 &&
+            setsockopt(sockfd, SOL_SOCKET, options[i], &wanted, sizeof(wanted)) == -1)
+        {
+            SET_ERROR(err, strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int socket_receive_timeout(int sockfd, long usec, struct fsm_error *err)
+{
+    struct timeval timeout;
+
+    timeout.tv_sec  = usec / 1000000L;
+    timeout.tv_usec = usec % 1000000L;
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1)
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include "syn_cookie.h"
+#include "protocol.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/random.h>
+
+#define ROTATE(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+static uint32_t mac(const struct sockaddr_storage *peer, uint32_t isn, uint32_t counter);
+static uint64_t siphash(const uint8_t *data, size_t length);
+
+// drawn once per process and shared by every worker, so any of them can check a cookie another handed out
+static uint64_t secret[2];
+
+int syn_cookie_init(struct fsm_error *err)
+{
+    if (getrandom(secret, sizeof(secret), 0) != (ssize_t) sizeof(secret))
+    {
+        SET_ERROR(err, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+// the SYN-ACK's sequence number; nothing about the SYN is kept, the ACK brings it all back
+uint32_t syn_cookie_make(const struct sockaddr_storage *peer, uint32_t isn, time_t now)
+{
+    uint32_t counter;
+
+    counter = (uint32_t) (now / SYN_COOKIE_PERIOD);
+
+    return (counter << SYN_COOKIE_COUNTER_SHIFT) | mac(peer, isn, counter);
+}
+
+int syn_cookie_check(const struct sockaddr_storage *peer, uint32_t isn, uint32_t cookie, time_t now)
+{
+    uint32_t current, counter, age;
+
+    current = (uint32_t) (now / SYN_COOKIE_PERIOD);
+    age     = (current - (cookie >> SYN_COOKIE_COUNTER_SHIFT)) & 0xff;
+
+    if (age > SYN_COOKIE_MAX_AGE)
+    {
+        return FALSE;
+    }
+
+    // the cookie only carries the low bits of the counter, the MAC was taken over the full one
+    counter = current - age;
+
+    return (cookie & SYN_COOKIE_MAC_MASK) == mac(peer, isn, counter);
+}
+
+static uint32_t mac(const struct sockaddr_storage *peer, uint32_t isn, uint32_t counter)
+{
+    uint8_t buf[sizeof(struct in6_addr) + sizeof(in_port_t) + 2 * sizeof(uint32_t)];
+    size_t  length;
+
+    length = 0;
+    if (peer -> ss_family == AF_INET6)
+    {
+        const struct sockaddr_in6 *addr = (const struct sockaddr_in6 *) peer;
+
+        memcpy(buf, &addr -> sin6_addr, sizeof(addr -> sin6_addr));
+        memcpy(buf + sizeof(addr -> sin6_addr), &addr -> sin6_port, sizeof(addr -> sin6_port));
+        length = sizeof(addr -> sin6_addr) + sizeof(addr -> sin6_port);
+    }
+    else
+    {
+        const struct sockaddr_in *addr = (const struct sockaddr_in *) peer;
+
+        memcpy(buf, &addr -> sin_addr, sizeof(addr -> sin_addr));
+        memcpy(buf + sizeof(addr -> sin_addr), &addr -> sin_port, sizeof(addr -> sin_port));
+        length = sizeof(addr -> sin_addr) + sizeof(addr -> sin_port);
+    }
+
+    memcpy(buf + length, &isn, sizeof(isn));
+    length += sizeof(isn);
+    memcpy(buf + length, &counter, sizeof(counter));
+    length += sizeof(counter);
+
+    return (uint32_t) siphash(buf, length) & SYN_COOKIE_MAC_MASK;
+}
+
+// SipHash-2-4, a keyed MAC made for short inputs like this one
+static uint64_t siphash(const uint8_t *data, size_t length)
+{
+    uint64_t    v0, v1, v2, v3, m, last;
+    size_t      i;
+
+    v0 = secret[0] ^ 0x736f6d6570736575ULL;
+    v1 = secret[1] ^ 0x646f72616e646f6dULL;
+    v2 = secret[0] ^ 0x6c7967656e657261ULL;
+    v3 = secret[1] ^ 0x7465646279746573ULL;
+
+#define SIPROUND                                                            \
+    do                                                                      \
+    {                                                                       \
+        v0 += v1; v1 = ROTATE(v1, 13); v1 ^= v0; v0 = ROTATE(v0, 32);       \
+        v2 += v3; v3 = ROTATE(v3, 16); v3 ^= v2;                            \
+        v0 += v3; v3 = ROTATE(v3, 21); v3 ^= v0;                            \
+        v2 += v1; v1 = ROTATE(v1, 17); v1 ^= v2; v2 = ROTATE(v2, 32);       \
+    } while (0)
+
+    for (i = 0; i + 8 <= length; i += 8)
+    {
+        memcpy(&m, data + i, sizeof(m));
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+
+    last = (uint64_t) length << 56;
+    for (size_t j = 0; i + j < length; j++)
+    {
+        last |= (uint64_t) data[i + j] << (8 * j);
+    }
+
+    v3 ^= last;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= last;
+
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+
+#undef SIPROUND
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
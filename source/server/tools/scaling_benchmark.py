@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+"""Measures how the server's throughput scales with its worker count.
+
+For each worker count from 1 to --max-workers the server is started with -n <count> and the same set of clients
+is run against it for --duration seconds. Every client is its own process with one connection: it handshakes,
+then keeps --window segments in flight, going back to the last acknowledged byte when a reply does not come
+within --timeout. Throughput is what the server acknowledged in order, so segments it dropped or handed over
+and lost do not count. The report gives the throughput per worker count and the speedup over one worker.
+
+The server prints every packet and writes every packet to its CSV files, so the absolute numbers are well under
+what the protocol could do; the point is the shape of the curve.
+"""
+
+import argparse
+import multiprocessing
+import os
+import signal
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+
+DATA_SIZE = 512
+HEADER = struct.Struct('<IIBBHIqq')
+SYN = 1
+ACK = 2
+PSHACK = 6
+
+
+# the server's checksum: a byte sum times 34 folded to 8 bits, times the XOR of the bytes
+def checksum(data):
+    total, folded = 0, 0
+
+    for byte in data:
+        total = (total + (byte if byte < 128 else byte - 256) * 34) & 0xff
+        folded ^= byte
+
+    return (total * folded) & 0xffff
+
+
+def packet(seq, ack, flags, connection_id=0, data=b''):
+    return HEADER.pack(seq, ack, flags, 255, checksum(data), connection_id, 0, 0) + data.ljust(DATA_SIZE, b'\0')
+
+
+def client(server, payload, window, timeout, start, duration, results):
+    sock = socket.socket(socket.AF_INET6 if ':' in server[0] else socket.AF_INET, socket.SOCK_DGRAM)
+    sock.connect(server)
+    sock.settimeout(timeout)
+    segment = packet(0, 0, 0, 0, payload)[HEADER.size:]
+    checksum_value = checksum(payload)
+
+    # the cookie comes back as the SYN-ACK's sequence number and is acknowledged plus one
+    while True:
+        sock.send(packet(0, 0, SYN))
+        try:
+            cookie = HEADER.unpack_from(sock.recv(1024))[0]
+            break
+        except socket.timeout:
+            continue
+
+    sock.send(packet(1, cookie + 1, ACK))
+
+    connection_id = 0
+    acknowledged = 1
+    next_seq = 1
+    start.wait()
+    deadline = time.monotonic() + duration
+
+    while time.monotonic() < deadline:
+        while next_seq - acknowledged < window * len(payload):
+            sock.send(HEADER.pack(next_seq, cookie + 1, PSHACK, 255, checksum_value, connection_id, 0, 0) + segment)
+            next_seq += len(payload)
+
+        try:
+            _, ack, _, _, _, reply_id = HEADER.unpack_from(sock.recv(1024))[:6]
+        except socket.timeout:
+            # go back N: whatever was past the last acknowledgement is sent again
+            next_seq = acknowledged
+            continue
+
+        # the id is only known from the first reply, it steers the rest to the owning worker
+        connection_id = reply_id
+        acknowledged = max(acknowledged, ack)
+
+    results.put(acknowledged - 1)
+
+
+def run(args, workers):
+    directory = tempfile.mkdtemp(prefix='scaling_')
+    run_directory = os.path.join(directory, 'run')
+    os.mkdir(run_directory)
+
+    command = [args.server, '-C', args.address, '-c', '1', '-S', args.address, '-s', str(args.port),
+               '-n', str(workers)]
+    if args.cpus:
+        command += ['-a', args.cpus]
+
+    # the server writes its CSV files one directory up from where it runs
+    server = subprocess.Popen(command, cwd=run_directory, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    time.sleep(0.5)
+
+    if server.poll() is not None:
+        sys.exit('The server exited with %d, is the port free?' % server.returncode)
+
+    start = multiprocessing.Event()
+    results = multiprocessing.Queue()
+    payload = b'x' * args.payload
+    clients = [multiprocessing.Process(target=client, args=((args.address, args.port), payload, args.window,
+                                                            args.timeout, start, args.duration, results))
+               for _ in range(args.clients)]
+
+    for process in clients:
+        process.start()
+
+    time.sleep(1)
+    start.set()
+    total = sum(results.get() for _ in clients)
+
+    for process in clients:
+        process.join()
+
+    server.send_signal(signal.SIGINT)
+    try:
+        server.wait(5)
+    except subprocess.TimeoutExpired:
+        server.kill()
+        server.wait()
+
+    return total / args.duration
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Run the same clients against 1 to N server workers.')
+    parser.add_argument('--server', default='./server', help='the server binary')
+    parser.add_argument('--address', default='127.0.0.1', help='address the server binds to')
+    parser.add_argument('--port', type=int, default=9000, help='port the server binds to')
+    parser.add_argument('--max-workers', type=int, default=os.cpu_count(), help='largest worker count to try')
+    parser.add_argument('--clients', type=int, default=0, help='client processes, four per worker by default')
+    parser.add_argument('--window', type=int, default=16, help='segments each client keeps in flight')
+    parser.add_argument('--payload', type=int, default=256, help='bytes of data per segment')
+    parser.add_argument('--timeout', type=float, default=0.05, help='seconds before a client goes back N')
+    parser.add_argument('--duration', type=float, default=5, help='seconds each worker count is measured for')
+    parser.add_argument('--cpus', help='CPU list passed to the server as -a')
+    args = parser.parse_args()
+
+    if not 0 < args.payload < DATA_SIZE:
+        sys.exit('--payload must be between 1 and %d.' % (DATA_SIZE - 1))
+
+    if args.clients == 0:
+        args.clients = 4 * args.max_workers
+
+    print('%d clients, window %d, %d byte segments, %.1f s per run' %
+          (args.clients, args.window, args.payload, args.duration))
+    print('%7s %12s %12s %8s %10s' % ('workers', 'bytes/s', 'segments/s', 'speedup', 'efficiency'))
+
+    baseline = None
+    for workers in range(1, args.max_workers + 1):
+        throughput = run(args, workers)
+        baseline = baseline or throughput
+        speedup = throughput / baseline if baseline else 0
+        print('%7d %12.0f %12.0f %8.2f %9.0f%%' % (workers, throughput, throughput / args.payload, speedup,
+                                                   100 * speedup / workers))
+
+
+if __name__ == '__main__':
+    main()